@@ -5,8 +5,32 @@
 #include <vector>
 #include <sstream>
 #include <map>
+#include <utility>
 #include <assert.h>
 #include <memory>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include "beascratch.h"
+#include "beamemo.h"
+
+//Define BEA_ENABLE_TRACE to record timeline spans of calls and script loads (see beatrace.h)
+#ifdef BEA_ENABLE_TRACE
+#include "beatrace.h"
+#else
+#define BEA_TRACE_SPAN(category, name)
+#define BEA_TRACE_THREAD_NAME(name)
+#endif
+
+//Define BEA_ENABLE_STATS to collect per-binding call statistics (see beastats.h)
+#ifdef BEA_ENABLE_STATS
+#include "beastats.h"
+#else
+#define BEA_STATS_CALL_SCOPE(stats)
+#define BEA_STATS_CONVERT_SCOPE()
+#define BEA_STATS_FAILURE()
+#define BEA_STATS_BYTES_IN(n)
+#define BEA_STATS_BYTES_OUT(n)
+#endif
 
 namespace bea{
 	class Exception{
@@ -24,6 +48,8 @@ namespace bea{
 	};
 
 	class ArgConvertException : public Exception{
+	protected:
+		ArgConvertException(const char* message): Exception(message){}
 	public:
 		ArgConvertException(int arg, const char* message){
 			std::stringstream s; 
@@ -32,6 +58,12 @@ namespace bea{
 		}
 	};
 
+	//A result which could not be converted to javascript; METHOD_END reports it like an argument
+	class ResultConvertException : public ArgConvertException{
+	public:
+		ResultConvertException(const char* message): ArgConvertException(message){}
+	};
+
 //////////////////////////////////////////////////////////////////////////
 
 #define BEATHROW() throw bea::ArgConvertException(nArg, msg)
@@ -217,10 +249,15 @@ namespace bea{
 			if (!Is(v))	
 				BEATHROW();
 
-			return  *v8::String::AsciiValue(v->ToString());
+			BEA_STATS_CONVERT_SCOPE();
+			v8::String::AsciiValue str(v->ToString());
+			BEA_STATS_BYTES_IN(str.length());
+			return *str;
 		}
 
 		static inline v8::Handle<v8::Value> ToJS(const bea::string& val){
+			BEA_STATS_CONVERT_SCOPE();
+			BEA_STATS_BYTES_OUT(val.size());
 			return v8::String::New (val.c_str());
 		}
 	};
@@ -255,6 +292,7 @@ namespace bea{
 
 			if (!Is(v)) BEATHROW();
 
+			BEA_STATS_CONVERT_SCOPE();
 			bea::vector<T> ret;
 
 			v8::Local<v8::Array> array = v8::Array::Cast(*v);
@@ -266,13 +304,16 @@ namespace bea{
 				ret.push_back(Convert<T>::FromJS(array->Get((int32_t)k), nArg));
 			}
 
+			BEA_STATS_BYTES_IN(len * sizeof(T));
 			return ret; 
 		}
 
 		static inline v8::Handle<v8::Value> ToJS(const bea::vector<T>& val){
 
+			BEA_STATS_CONVERT_SCOPE();
 			v8::HandleScope scope; 
 			int len = (int)val.size();
+			BEA_STATS_BYTES_OUT(len * sizeof(T));
 			v8::Local<v8::Array> jsArray = v8::Array::New(len);
 
 			for (int i = 0; i < len; i++)
@@ -299,6 +340,321 @@ namespace bea{
 		}
 	};
 	
+	//bea::scratch_string: the characters are written into the call's scratch arena
+	template<>
+	struct Convert<scratch_string>{
+		static inline bool Is(v8::Handle<v8::Value> v){
+			return Convert<bea::string>::Is(v);
+		}
+
+		static inline scratch_string FromJS(v8::Handle<v8::Value> v, int nArg){
+			static const char* msg = "v8::String expected";
+
+			if (!Is(v))
+				BEATHROW();
+
+			BEA_STATS_CONVERT_SCOPE();
+			v8::Local<v8::String> str = v->ToString();
+			int len = str->Length();
+			char* data = ScratchArena::current().allocChars((size_t)len + 1);
+			str->WriteAscii(data, 0, len);
+			data[len] = '\0';
+			BEA_STATS_BYTES_IN(len);
+			return scratch_string(data, (size_t)len);
+		}
+
+		static inline v8::Handle<v8::Value> ToJS(const scratch_string& val){
+			BEA_STATS_CONVERT_SCOPE();
+			BEA_STATS_BYTES_OUT(val.size());
+			return v8::String::New(val.data(), (int)val.size());
+		}
+	};
+
+	//bea::scratch_vector<T>: the elements are built in the call's scratch arena
+	template<class T>
+	struct Convert<scratch_vector<T> >{
+		static inline bool Is(v8::Handle<v8::Value> v){
+			return !v.IsEmpty() && v->IsArray();
+		}
+
+		static inline scratch_vector<T> FromJS(v8::Handle<v8::Value> v, int nArg){
+			static const char* msg = "Array expected";
+
+			if (!Is(v)) BEATHROW();
+
+			BEA_STATS_CONVERT_SCOPE();
+			v8::Local<v8::Array> array = v8::Array::Cast(*v);
+			size_t len = (size_t)array->Length();
+
+			size_t* constructed = NULL;
+			T* data = ScratchArena::current().allocArray<T>(len, constructed);
+			for (size_t k = 0; k < len; k++){
+				new (data + k) T(Convert<T>::FromJS(array->Get((int32_t)k), nArg));
+				if (constructed)
+					(*constructed)++;
+			}
+
+			BEA_STATS_BYTES_IN(len * sizeof(T));
+			return scratch_vector<T>(data, len);
+		}
+
+		static inline v8::Handle<v8::Value> ToJS(const scratch_vector<T>& val){
+			BEA_STATS_CONVERT_SCOPE();
+			v8::HandleScope scope;
+			int len = (int)val.size();
+			BEA_STATS_BYTES_OUT(len * sizeof(T));
+			v8::Local<v8::Array> jsArray = v8::Array::New(len);
+
+			for (int i = 0; i < len; i++)
+				jsArray->Set(i, Convert<T>::ToJS(val[i]));
+
+			return scope.Close(jsArray);
+		}
+	};
+
+	//Vector returned to javascript without converting it up front.
+	//Javascript gets an object with a length and indexed properties backed by the native vector;
+	//elements are converted when they are read (and kept, if cache is set).
+	template<class T>
+	class lazy_vector{
+	public:
+		typedef std::vector<T> container;
+		boost::shared_ptr<const container> data;
+		bool cache;
+
+		lazy_vector(): data(new container()), cache(false){}
+		lazy_vector(boost::shared_ptr<const container> d, bool cacheElements = false): data(d), cache(cacheElements){}
+		lazy_vector(const container& v, bool cacheElements = false): data(new container(v)), cache(cacheElements){}
+
+		//Take the elements of v without copying them; v is left empty
+		static lazy_vector take(container& v, bool cacheElements = false){
+			container* c = new container();
+			c->swap(v);
+			return lazy_vector(boost::shared_ptr<const container>(c), cacheElements);
+		}
+
+		size_t size() const{
+			return data->size();
+		}
+		const T& operator[](size_t index) const{
+			return (*data)[index];
+		}
+	};
+
+	//bea::lazy_vector<T>
+	template<class T>
+	struct Convert<lazy_vector<T> >{
+		typedef lazy_vector<T> LazyVector;
+
+		static v8::Handle<v8::FunctionTemplate> functionTemplate(){
+			static v8::Persistent<v8::FunctionTemplate> s_tmpl;
+			if (s_tmpl.IsEmpty()){
+				v8::Handle<v8::FunctionTemplate> ftmpl = v8::FunctionTemplate::New();
+				ftmpl->SetClassName(v8::String::NewSymbol("LazyVector"));
+				v8::Handle<v8::ObjectTemplate> otmpl = ftmpl->InstanceTemplate();
+				otmpl->SetInternalFieldCount(1);
+				otmpl->SetIndexedPropertyHandler(GetIndexed, SetIndexed, QueryIndexed, 0, EnumIndexed);
+				otmpl->SetAccessor(v8::String::NewSymbol("length"), GetLength, 0, v8::Handle<v8::Value>(), v8::DEFAULT, 
+					static_cast<v8::PropertyAttribute>(v8::ReadOnly | v8::DontEnum | v8::DontDelete));
+				s_tmpl = v8::Persistent<v8::FunctionTemplate>::New(ftmpl);
+			}
+			return s_tmpl;
+		}
+
+		static inline LazyVector* holder(const v8::AccessorInfo& info){
+			return static_cast<LazyVector*>(info.Holder()->GetPointerFromInternalField(0));
+		}
+
+		static v8::Handle<v8::Value> GetIndexed(uint32_t index, const v8::AccessorInfo& info){
+			LazyVector* lv = holder(info);
+			if (index >= lv->size())
+				return v8::Handle<v8::Value>();
+			if (!lv->cache)
+				return Convert<T>::ToJS((*lv)[index]);
+
+			v8::HandleScope scope;
+			v8::Local<v8::Value> hidden = info.Holder()->GetHiddenValue(v8::String::NewSymbol("bea::cache"));
+			v8::Local<v8::Array> cache;
+			if (hidden.IsEmpty()){
+				cache = v8::Array::New((int)lv->size());
+				info.Holder()->SetHiddenValue(v8::String::NewSymbol("bea::cache"), cache);
+			}
+			else {
+				cache = v8::Local<v8::Array>::Cast(hidden);
+				if (cache->Has(index))
+					return scope.Close(cache->Get(index));
+			}
+			v8::Handle<v8::Value> res = Convert<T>::ToJS((*lv)[index]);
+			cache->Set(index, res);
+			return scope.Close(res);
+		}
+
+		static v8::Handle<v8::Value> SetIndexed(uint32_t index, v8::Local<v8::Value> value, const v8::AccessorInfo& info){
+			return v8::ThrowException(v8::Exception::TypeError(v8::String::NewSymbol("Native vector is read-only")));
+		}
+
+		static v8::Handle<v8::Integer> QueryIndexed(uint32_t index, const v8::AccessorInfo& info){
+			if (index >= holder(info)->size())
+				return v8::Handle<v8::Integer>();
+			return v8::Integer::New(v8::ReadOnly | v8::DontDelete);
+		}
+
+		static v8::Handle<v8::Array> EnumIndexed(const v8::AccessorInfo& info){
+			v8::HandleScope scope;
+			int len = (int)holder(info)->size();
+			v8::Local<v8::Array> res = v8::Array::New(len);
+			for (int k = 0; k < len; k++)
+				res->Set(k, v8::Integer::New(k));
+			return scope.Close(res);
+		}
+
+		static v8::Handle<v8::Value> GetLength(v8::Local<v8::String> property, const v8::AccessorInfo& info){
+			return v8::Integer::New((int)holder(info)->size());
+		}
+
+		static void WeakCallback(v8::Persistent<v8::Value> value, void* data){
+			delete static_cast<LazyVector*>(data);
+			value.Dispose();
+		}
+
+		static inline bool Is(v8::Handle<v8::Value> v){
+			return !v.IsEmpty() && (v->IsArray() || functionTemplate()->HasInstance(v));
+		}
+
+		//Accepts lazy vectors (sharing their data) and plain arrays
+		static inline LazyVector FromJS(v8::Handle<v8::Value> v, int nArg){
+			if (!v.IsEmpty() && functionTemplate()->HasInstance(v))
+				return *static_cast<LazyVector*>(v->ToObject()->GetPointerFromInternalField(0));
+			return LazyVector(Convert<std::vector<T> >::FromJS(v, nArg));
+		}
+
+		static inline v8::Handle<v8::Value> ToJS(const LazyVector& val){
+			v8::HandleScope scope;
+			v8::Local<v8::Object> obj = functionTemplate()->InstanceTemplate()->NewInstance();
+			LazyVector* lv = new LazyVector(val);
+			obj->SetPointerInInternalField(0, lv);
+			v8::Persistent<v8::Object>::New(obj).MakeWeak(lv, WeakCallback);
+			return scope.Close(obj);
+		}
+	};
+
+	//Own property names of an object, listed once. Keys are read into one reused buffer.
+	class PropertyKeys{
+		v8::Local<v8::Array> m_names;
+		uint32_t m_length;
+		std::string m_key;
+	public:
+		PropertyKeys(v8::Handle<v8::Object> obj): m_names(obj->GetOwnPropertyNames()), m_length(m_names->Length()){
+			m_key.reserve(64);
+		}
+		uint32_t length() const{
+			return m_length;
+		}
+		v8::Local<v8::Value> name(uint32_t index){
+			return m_names->Get(index);
+		}
+		//The name as utf8; valid until the next call
+		const std::string& key(v8::Handle<v8::Value> name){
+			v8::Local<v8::String> str = name->ToString();
+			int len = str->Utf8Length();
+			m_key.resize((size_t)len);
+			if (len > 0)
+				str->WriteUtf8(&m_key[0], len);
+			return m_key;
+		}
+	};
+
+	namespace detail{
+		template<class T> inline void reserveMap(std::map<std::string, T>&, size_t){}
+		template<class T> inline void reserveMap(boost::unordered_map<std::string, T>& m, size_t n){
+			m.reserve(n);
+		}
+	}
+
+	//Maps with string keys <-> javascript objects
+	template<class M>
+	struct ConvertStringMap{
+		typedef typename M::mapped_type T;
+
+		static inline bool Is(v8::Handle<v8::Value> v){
+			return !v.IsEmpty() && v->IsObject() && !v->IsArray() && !v->IsFunction();
+		}
+
+		static inline M FromJS(v8::Handle<v8::Value> v, int nArg){
+			static const char* msg = "Object expected";
+
+			if (!Is(v)) BEATHROW();
+
+			BEA_STATS_CONVERT_SCOPE();
+			v8::HandleScope scope;
+			v8::Local<v8::Object> obj = v->ToObject();
+			PropertyKeys keys(obj);
+			M ret;
+			detail::reserveMap(ret, keys.length());
+
+			size_t bytes = 0;
+			for (uint32_t k = 0; k < keys.length(); k++){
+				v8::Local<v8::Value> name = keys.name(k);
+				const std::string& key = keys.key(name);
+				bytes += key.size();
+				ret.insert(ret.end(), typename M::value_type(key, Convert<T>::FromJS(obj->Get(name), nArg)));
+			}
+
+			BEA_STATS_BYTES_IN(bytes + keys.length() * sizeof(T));
+			return ret;
+		}
+
+		//Keys become symbols: V8 interns them, so repeated keys share one string
+		static inline v8::Handle<v8::Value> ToJS(const M& val){
+			BEA_STATS_CONVERT_SCOPE();
+			v8::HandleScope scope;
+			v8::Local<v8::Object> obj = v8::Object::New();
+			size_t bytes = 0;
+			for (typename M::const_iterator iter = val.begin(); iter != val.end(); iter++){
+				bytes += iter->first.size();
+				obj->Set(v8::String::NewSymbol(iter->first.data(), (int)iter->first.size()), Convert<T>::ToJS(iter->second));
+			}
+			BEA_STATS_BYTES_OUT(bytes + val.size() * sizeof(T));
+			return scope.Close(obj);
+		}
+	};
+
+	//std::map<std::string, T>
+	template<class T>
+	struct Convert<std::map<std::string, T> > : public ConvertStringMap<std::map<std::string, T> >{
+	};
+
+	//boost::unordered_map<std::string, T>
+	template<class T>
+	struct Convert<boost::unordered_map<std::string, T> > : public ConvertStringMap<boost::unordered_map<std::string, T> >{
+	};
+
+	//std::pair<A, B> <-> [first, second]
+	template<class A, class B>
+	struct Convert<std::pair<A, B> >{
+		static inline bool Is(v8::Handle<v8::Value> v){
+			return !v.IsEmpty() && v->IsArray() && v8::Array::Cast(*v)->Length() == 2;
+		}
+
+		static inline std::pair<A, B> FromJS(v8::Handle<v8::Value> v, int nArg){
+			static const char* msg = "Array of 2 elements expected";
+
+			if (!Is(v)) BEATHROW();
+
+			v8::HandleScope scope;
+			v8::Local<v8::Array> array = v8::Array::Cast(*v);
+			return std::pair<A, B>(Convert<A>::FromJS(array->Get(0), nArg), Convert<B>::FromJS(array->Get(1), nArg));
+		}
+
+		static inline v8::Handle<v8::Value> ToJS(const std::pair<A, B>& val){
+			v8::HandleScope scope;
+			v8::Local<v8::Array> jsArray = v8::Array::New(2);
+			jsArray->Set(0, Convert<A>::ToJS(val.first));
+			jsArray->Set(1, Convert<B>::ToJS(val.second));
+			return scope.Close(jsArray);
+		}
+	};
+
 	///???
 	template<>
 	struct Convert<char>{
@@ -456,6 +812,29 @@ namespace bea{
 	template<> struct IndexType<float>{
 		enum {Value = v8::kExternalFloatArray};
 	};
+	template<> struct IndexType<double>{
+		enum {Value = v8::kExternalDoubleArray};
+	};
+
+	//Size in bytes of one element of an external array type
+	inline int externalArrayElementSize(int type){
+		switch (type){
+			case v8::kExternalByteArray:
+			case v8::kExternalUnsignedByteArray:
+			case v8::kExternalPixelArray:
+				return 1;
+			case v8::kExternalShortArray:
+			case v8::kExternalUnsignedShortArray:
+				return 2;
+			case v8::kExternalIntArray:
+			case v8::kExternalUnsignedIntArray:
+			case v8::kExternalFloatArray:
+				return 4;
+			case v8::kExternalDoubleArray:
+				return 8;
+		}
+		return 0;
+	}
 
 
 	template<class T>
@@ -517,6 +896,327 @@ namespace bea{
 	
 
 	//////////////////////////////////////////////////////////////////////////
+	//Overload dispatch.
+	//Each argument is classified once into an ArgType code; the codes form a signature key which selects
+	//the overload through a table filled on first use. Convert<T>::Is is only probed when several
+	//overloads accept the same key (eg. two exposed classes, which are all plain objects to javascript).
+
+	enum ArgType{
+		ArgMissing = 0,
+		ArgUndefined,
+		ArgNull,
+		ArgBool,
+		ArgSmallUint,		//int32 >= 0 (also uint32)
+		ArgNegInt,			//int32 < 0
+		ArgLargeUint,		//uint32 > 2^31 - 1
+		ArgDouble,			//any other number
+		ArgString,
+		ArgArray,
+		ArgFunction,
+		ArgExternal,
+		ArgObject
+	};
+
+	inline int argTypeOf(v8::Handle<v8::Value> v){
+		if (v->IsInt32()) return v->Int32Value() >= 0 ? ArgSmallUint : ArgNegInt;
+		if (v->IsNumber()) return v->IsUint32() ? ArgLargeUint : ArgDouble;
+		if (v->IsString()) return ArgString;
+		if (v->IsBoolean()) return ArgBool;
+		if (v->IsUndefined()) return ArgUndefined;
+		if (v->IsNull()) return ArgNull;
+		if (v->IsExternal()) return ArgExternal;
+		if (v->IsArray()) return ArgArray;
+		if (v->IsFunction()) return ArgFunction;
+		return ArgObject;
+	}
+
+	#define BEA_ARG_BIT(code) (1u << (code))
+
+	//Argument types Convert<T>::Is may accept. Types without a specialization accept anything.
+	template<class T> struct ArgMask{
+		enum {Value = 0xffff};
+	};
+
+	#define BEA_ARG_MASK(type, mask) template<> struct ArgMask<type >{ enum {Value = (mask)}; }
+	#define BEA_MASK_INT (BEA_ARG_BIT(ArgSmallUint) | BEA_ARG_BIT(ArgNegInt))
+	#define BEA_MASK_UINT (BEA_ARG_BIT(ArgSmallUint) | BEA_ARG_BIT(ArgLargeUint))
+	#define BEA_MASK_NUMBER (BEA_MASK_INT | BEA_MASK_UINT | BEA_ARG_BIT(ArgDouble))
+	#define BEA_MASK_OBJECT (BEA_ARG_BIT(ArgObject) | BEA_ARG_BIT(ArgArray) | BEA_ARG_BIT(ArgFunction))
+
+	BEA_ARG_MASK(int, BEA_MASK_INT);
+	BEA_ARG_MASK(long, BEA_MASK_INT);
+	BEA_ARG_MASK(short, BEA_MASK_INT);
+	BEA_ARG_MASK(char, BEA_MASK_INT);
+	BEA_ARG_MASK(unsigned int, BEA_MASK_UINT);
+	BEA_ARG_MASK(unsigned long, BEA_MASK_UINT);
+	BEA_ARG_MASK(unsigned short, BEA_MASK_UINT);
+	BEA_ARG_MASK(unsigned char, BEA_MASK_UINT);
+	BEA_ARG_MASK(double, BEA_MASK_NUMBER);
+	BEA_ARG_MASK(float, BEA_MASK_NUMBER);
+	BEA_ARG_MASK(bool, BEA_ARG_BIT(ArgBool));
+	BEA_ARG_MASK(std::string, BEA_ARG_BIT(ArgString));
+	BEA_ARG_MASK(bea::string, BEA_ARG_BIT(ArgString));
+	BEA_ARG_MASK(bea::scratch_string, BEA_ARG_BIT(ArgString));
+
+	template<class T> struct ArgMask<std::vector<T> >{
+		enum {Value = BEA_ARG_BIT(ArgArray)};
+	};
+	template<class T> struct ArgMask<bea::vector<T> >{
+		enum {Value = BEA_ARG_BIT(ArgArray)};
+	};
+	template<class T> struct ArgMask<scratch_vector<T> >{
+		enum {Value = BEA_ARG_BIT(ArgArray)};
+	};
+	template<class T> struct ArgMask<lazy_vector<T> >{
+		enum {Value = BEA_ARG_BIT(ArgArray) | BEA_ARG_BIT(ArgObject)};
+	};
+	template<class T> struct ArgMask<std::map<std::string, T> >{
+		enum {Value = BEA_ARG_BIT(ArgObject)};
+	};
+	template<class T> struct ArgMask<boost::unordered_map<std::string, T> >{
+		enum {Value = BEA_ARG_BIT(ArgObject)};
+	};
+	template<class A, class B> struct ArgMask<std::pair<A, B> >{
+		enum {Value = BEA_ARG_BIT(ArgArray)};
+	};
+	template<class T> struct ArgMask<external<T> >{
+		enum {Value = BEA_ARG_BIT(ArgExternal)};
+	};
+
+	template<class T> class ExposedClass;
+
+	//Argument list of one overload:  bea::Overload(cb).arg<int>().object<Mat>().opt<bool>()
+	struct Overload{
+		enum {MaxArgs = 7};
+		typedef bool (*IsFn)(v8::Handle<v8::Value>);
+
+		v8::InvocationCallback cb;
+		int nArgs;
+		int nRequired;
+		unsigned int masks[MaxArgs];
+		IsFn probes[MaxArgs];
+
+		Overload(v8::InvocationCallback callback): cb(callback), nArgs(0), nRequired(0){}
+
+		//Required argument converted with Convert<T>
+		template<class T> Overload& arg(){
+			return add(ArgMask<T>::Value, &Convert<T>::Is, true);
+		}
+		//Optional argument, read with Optional<T>
+		template<class T> Overload& opt(){
+			return add(ArgMask<T>::Value | BEA_ARG_BIT(ArgMissing), &Convert<T>::Is, false);
+		}
+		//Instance of an exposed class
+		template<class T> Overload& object(){
+			return add(BEA_MASK_OBJECT, &ExposedClass<T>::Is, true);
+		}
+
+		Overload& add(unsigned int mask, IsFn probe, bool required){
+			assert(nArgs < MaxArgs);
+			if (required)
+				nRequired = nArgs + 1;
+			masks[nArgs] = mask;
+			probes[nArgs] = probe;
+			nArgs++;
+			return *this;
+		}
+
+		//Argument count fits; strict excludes calls with extra arguments
+		inline bool acceptsCount(int len, bool strict) const{
+			return len >= nRequired && (!strict || len <= nArgs);
+		}
+
+		inline bool acceptsKey(const int* codes) const{
+			for (int k = 0; k < nArgs; k++)
+				if (!(masks[k] & BEA_ARG_BIT(codes[k])))
+					return false;
+			return true;
+		}
+
+		//The slow path: Convert<T>::Is on every argument
+		bool probe(const v8::Arguments& args) const{
+			if (args.Length() < nRequired)
+				return false;
+			for (int k = 0; k < nArgs && k < args.Length(); k++){
+				if (!probes[k](args[k]))
+					return false;
+			}
+			return true;
+		}
+	};
+
+	//Overloads of one javascript function
+	class OverloadSet{
+		struct Entry{
+			int index;				//overload to call, -1 if none accepts the key, -2 if ambiguous
+			unsigned int candidates;	//overloads accepting the key, when ambiguous
+		};
+		typedef std::map<unsigned int, Entry> DispatchTable;
+
+		std::string m_name;
+		std::vector<Overload> m_overloads;
+		DispatchTable m_table;
+		size_t m_probes;
+#ifdef BEA_ENABLE_STATS
+		CallStats* m_stats;
+#endif
+
+		//Low 4 bits: argument count; then 4 bits per argument
+		static inline bool makeKey(const v8::Arguments& args, int* codes, unsigned int& key){
+			int len = args.Length();
+			if (len > Overload::MaxArgs)
+				return false;
+			key = (unsigned int)len;
+			for (int k = 0; k < Overload::MaxArgs; k++){
+				codes[k] = k < len ? argTypeOf(args[k]) : ArgMissing;
+				key |= (unsigned int)codes[k] << (4 + 4 * k);
+			}
+			return true;
+		}
+
+		Entry resolve(int len, const int* codes){
+			Entry e = {-1, 0};
+			for (int pass = 0; pass < 2 && !e.candidates; pass++){
+				for (size_t k = 0; k < m_overloads.size() && k < 32; k++){
+					if (m_overloads[k].acceptsCount(len, pass == 0) && m_overloads[k].acceptsKey(codes))
+						e.candidates |= 1u << k;
+				}
+			}
+			if (e.candidates){
+				//Single candidate: call it directly
+				e.index = (e.candidates & (e.candidates - 1)) ? -2 : 0;
+				if (e.index == 0)
+					while (!(e.candidates & (1u << e.index))) e.index++;
+			}
+			return e;
+		}
+
+		v8::Handle<v8::Value> noMatch(){
+			std::string msg = "No overload of " + m_name + " accepts these arguments";
+			return v8::ThrowException(v8::Exception::TypeError(v8::String::New(msg.c_str())));
+		}
+
+	public:
+		OverloadSet(const std::string& name): m_name(name), m_probes(0){
+#ifdef BEA_ENABLE_STATS
+			m_stats = Stats::get(name);
+#endif
+		}
+
+		//Overloads registered first win when several accept the arguments
+		OverloadSet& add(const Overload& overload){
+			m_overloads.push_back(overload);
+			m_table.clear();
+			return *this;
+		}
+
+		v8::Handle<v8::Value> call(const v8::Arguments& args){
+			BEA_TRACE_SPAN("native", m_name.c_str());
+			BEA_STATS_CALL_SCOPE(Stats::enabled() ? m_stats : NULL);
+			int codes[Overload::MaxArgs];
+			unsigned int key;
+			unsigned int candidates = 0xffffffff;
+
+			if (makeKey(args, codes, key)){
+				DispatchTable::iterator iter = m_table.find(key);
+				if (iter == m_table.end())
+					iter = m_table.insert(std::make_pair(key, resolve(args.Length(), codes))).first;
+				const Entry& e = iter->second;
+				if (e.index >= 0)
+					return m_overloads[e.index].cb(args);
+				if (e.index == -1)
+					return noMatch();
+				candidates = e.candidates;
+			}
+
+			//Ambiguous (or too many arguments for a key): probe in registration order
+			m_probes++;
+			for (size_t k = 0; k < m_overloads.size(); k++){
+				if (k < 32 && !(candidates & (1u << k)))
+					continue;
+				if (m_overloads[k].probe(args))
+					return m_overloads[k].cb(args);
+			}
+			return noMatch();
+		}
+
+		static v8::Handle<v8::Value> Dispatch(const v8::Arguments& args){
+			v8::Local<v8::External> edata = v8::Local<v8::External>::Cast(args.Data());
+			return static_cast<OverloadSet*>(edata->Value())->call(args);
+		}
+
+		//The set must outlive the functions created from the template
+		v8::Handle<v8::FunctionTemplate> functionTemplate(){
+			v8::Handle<v8::FunctionTemplate> fn = v8::FunctionTemplate::New(Dispatch, v8::External::New(this));
+			fn->SetClassName(v8::String::New(m_name.c_str()));
+			return fn;
+		}
+
+		const std::string& name(){
+			return m_name;
+		}
+		//Calls that needed Convert<T>::Is probes
+		size_t probes(){
+			return m_probes;
+		}
+	};
+
+	//////////////////////////////////////////////////////////////////////////
+
+	//Wrapper counts of an exposed class.
+	//'live' only covers wrappers the garbage collector reports back: those of classes with a destructor,
+	//or all wrappers when WrapperCensus::setTrackAll(true) was called before they were created.
+	struct WrapperCount{
+		std::string name;
+		long created;
+		long live;
+	};
+
+	class WrapperCensus{
+		static inline std::vector<WrapperCount*>& entries(){
+			static std::vector<WrapperCount*> s_entries;
+			return s_entries;
+		}
+		static inline bool& trackAllFlag(){
+			static bool s_trackAll = false;
+			return s_trackAll;
+		}
+	public:
+		static inline WrapperCount* add(const char* name){
+			WrapperCount* c = new WrapperCount();
+			c->name = name;
+			c->created = 0;
+			c->live = 0;
+			entries().push_back(c);
+			return c;
+		}
+
+		static inline void remove(WrapperCount* c){
+			std::vector<WrapperCount*>& e = entries();
+			for (size_t k = 0; k < e.size(); k++){
+				if (e[k] == c){
+					e.erase(e.begin() + k);
+					break;
+				}
+			}
+			delete c;
+		}
+
+		//Make every new wrapper weak, so that live counts also cover classes without a destructor
+		static inline void setTrackAll(bool track){
+			trackAllFlag() = track;
+		}
+		static inline bool trackAll(){
+			return trackAllFlag();
+		}
+
+		static inline void snapshot(std::vector<WrapperCount>& out){
+			out.clear();
+			std::vector<WrapperCount*>& e = entries();
+			for (size_t k = 0; k < e.size(); k++)
+				out.push_back(*e[k]);
+		}
+	};
 
 
 	template<class T>
@@ -529,6 +1229,9 @@ namespace bea{
 		typedef void (*DestructorCallback)(v8::Handle<v8::Value> val);
 
 		DestructorCallback m_destructor;
+		WrapperCount* m_census;
+		//Names of the prototype methods, labelled in exposeTo()
+		std::vector<std::string> m_methods;
 
 	public:
 		static ExposedClass<T> * Instance; 
@@ -545,15 +1248,39 @@ namespace bea{
 			m_constructor = NULL; 
 			m_postAlloc = NULL; 
 			m_destructor = NULL; 
+			m_census = WrapperCensus::add(objectName);
 		}
 		inline ~ExposedClass(){
+			WrapperCensus::remove(m_census);
 		}
 
 		//Expose a method to Javascript.
 		inline void exposeMethod( const char* name, v8::InvocationCallback cb ) {
 			v8::HandleScope scope;
+#ifdef BEA_ENABLE_STATS
+			v8::Handle<v8::FunctionTemplate> fn = bea::Stats::instrument(m_objectName + "." + name, cb);
+#elif defined(BEA_ENABLE_TRACE)
+			v8::Handle<v8::FunctionTemplate> fn = bea::Tracer::instrument(m_objectName + "." + name, cb);
+#else
 			v8::Local<v8::FunctionTemplate> fn = v8::FunctionTemplate::New(cb);
+#endif
+			function_template->PrototypeTemplate()->Set(v8::String::NewSymbol(name), fn);
+			m_methods.push_back(name);
+		}
+
+		//Expose overloaded methods under one name
+		inline void exposeMethod(const char* name, OverloadSet* overloads){
+			v8::HandleScope scope;
+			function_template->PrototypeTemplate()->Set(v8::String::NewSymbol(name), overloads->functionTemplate());
+			m_methods.push_back(name);
+		}
+
+		//Expose a pure method: results are cached by receiver and argument value (see beamemo.h)
+		inline void exposePureMethod(const char* name, v8::InvocationCallback cb, size_t maxEntries = 256, size_t maxBytes = 0){
+			v8::HandleScope scope;
+			v8::Handle<v8::FunctionTemplate> fn = bea::MemoCache::instrument(m_objectName + "." + name, cb, maxEntries, maxBytes, true);
 			function_template->PrototypeTemplate()->Set(v8::String::NewSymbol(name), fn);
+			m_methods.push_back(name);
 		}
 
 		//Expose a property to javascript
@@ -562,7 +1289,16 @@ namespace bea{
 		}
 
 		inline void exposeTo( v8::Handle<v8::Object> target ){
-			target->Set(v8::String::NewSymbol(m_objectName.c_str()), function_template->GetFunction());
+			v8::HandleScope scope;
+			v8::Handle<v8::Function> cons = function_template->GetFunction();
+			//Name the methods of this context's prototype "Class.method", the label of profiles and heap snapshots
+			v8::Handle<v8::Object> proto = cons->Get(v8::String::NewSymbol("prototype"))->ToObject();
+			for (size_t k = 0; k < m_methods.size(); k++){
+				v8::Handle<v8::Value> method = proto->Get(v8::String::NewSymbol(m_methods[k].c_str()));
+				if (method->IsFunction())
+					v8::Handle<v8::Function>::Cast(method)->SetName(v8::String::New((m_objectName + "." + m_methods[k]).c_str()));
+			}
+			target->Set(v8::String::NewSymbol(m_objectName.c_str()), cons);
 		}
 
 		//Called when the garbage collector decides to dispose of value
@@ -580,6 +1316,14 @@ namespace bea{
 				}
 
 			}
+			_this->m_census->live--;
+			value.Dispose();
+		}
+
+		//Weak callback of wrappers tracked only for the census: the native object is not owned by javascript
+		static inline void CensusCallback (v8::Persistent<v8::Value> value, void *data) {
+			ExposedClass<T>* _this = static_cast<ExposedClass<T>*>(data);
+			_this->m_census->live--;
 			value.Dispose();
 		}
 
@@ -597,7 +1341,11 @@ namespace bea{
 			{
 				assert(m_constructor != NULL && "Constructor not set!");
 
+				//Keep the constructor's own exception instead of replacing it below
+				v8::TryCatch tryCatch;
 				res = m_constructor(args);
+				if (tryCatch.HasCaught())
+					return scope.Close(tryCatch.ReThrow());
 
 				if (res->IsExternal())
 					ext = v8::Handle<v8::External>::Cast(res);
@@ -608,10 +1356,17 @@ namespace bea{
 
 			if (!ext.IsEmpty()){
 				args.This()->SetInternalField(0, ext);
+				m_census->created++;
 				
 				if (m_destructor){
 					v8::Persistent<v8::Object> persObj = v8::Persistent<v8::Object>::New(args.This()); 
 					persObj.MakeWeak(this, WeakCallback);
+					m_census->live++;
+				}
+				else if (WrapperCensus::trackAll()){
+					v8::Persistent<v8::Object> persObj = v8::Persistent<v8::Object>::New(args.This()); 
+					persObj.MakeWeak(this, CensusCallback);
+					m_census->live++;
 				}
 
 				if (m_postAlloc)
@@ -647,6 +1402,7 @@ namespace bea{
 		}
 
 		static inline v8::Handle<v8::Value> ToJS( T* value ){
+			BEA_STATS_CONVERT_SCOPE();
 			ExposedClass<T>* inst = ExposedClass<T>::Instance;
 			v8::HandleScope scope;
 			v8::Handle<v8::Function> cons = inst->function_template->GetFunction();
@@ -715,7 +1471,29 @@ namespace bea{
 		}
 
 		inline void exposeMethod(const char* name, v8::InvocationCallback cb){
-			m_obj->Set(v8::String::NewSymbol(name), v8::FunctionTemplate::New(cb)->GetFunction());
+#ifdef BEA_ENABLE_STATS
+			v8::Handle<v8::FunctionTemplate> fn = bea::Stats::instrument(m_objName + "." + name, cb);
+#elif defined(BEA_ENABLE_TRACE)
+			v8::Handle<v8::FunctionTemplate> fn = bea::Tracer::instrument(m_objName + "." + name, cb);
+#else
+			v8::Handle<v8::FunctionTemplate> fn = v8::FunctionTemplate::New(cb);
+#endif
+			//Label for profiles and heap snapshots
+			v8::Handle<v8::Function> f = fn->GetFunction();
+			f->SetName(v8::String::New((m_objName + "." + name).c_str()));
+			m_obj->Set(v8::String::NewSymbol(name), f);
+		}
+
+		inline void exposeMethod(const char* name, OverloadSet* overloads){
+			m_obj->Set(v8::String::NewSymbol(name), overloads->functionTemplate()->GetFunction());
+		}
+
+		//Expose a pure function: results are cached by argument value (see beamemo.h)
+		inline void exposePureMethod(const char* name, v8::InvocationCallback cb, size_t maxEntries = 256, size_t maxBytes = 0){
+			v8::Handle<v8::FunctionTemplate> fn = bea::MemoCache::instrument(m_objName + "." + name, cb, maxEntries, maxBytes);
+			v8::Handle<v8::Function> f = fn->GetFunction();
+			f->SetName(v8::String::New((m_objName + "." + name).c_str()));
+			m_obj->Set(v8::String::NewSymbol(name), f);
 		}
 
 		inline void exposeTo(v8::Handle<v8::Object> target){
@@ -733,6 +1511,24 @@ namespace bea{
 			__jsInstance.Dispose();
 		}
 
+#ifdef BEA_ENABLE_STATS
+		//Stats of the callbacks called so far; found by name without allocating
+		std::vector<bea::CallStats*> __callbackStats;
+
+		bea::CallStats* bea_derived_stats(const char* name){
+			static const size_t prefixLen = sizeof("callback:") - 1;
+			if (!bea::Stats::enabled())
+				return NULL;
+			for (size_t k = 0; k < __callbackStats.size(); k++){
+				if (__callbackStats[k]->name.compare(prefixLen, std::string::npos, name) == 0)
+					return __callbackStats[k];
+			}
+			bea::CallStats* stats = bea::Stats::get(std::string("callback:") + name);
+			__callbackStats.push_back(stats);
+			return stats;
+		}
+#endif
+
 		v8::Handle<v8::Value> bea_derived_callJS(const char* name, int nargs, v8::Handle<v8::Value> args[]){
 
 			//Enter the javascript context - this is a call from native code
@@ -745,6 +1541,10 @@ namespace bea{
 			v8::Handle<v8::Value> oFn = __jsInstance->Get(v8::String::New(name));
 
 			if (!oFn.IsEmpty() && oFn->IsFunction()){
+				BEA_TRACE_SPAN("callback", name);
+#ifdef BEA_ENABLE_STATS
+				BEA_STATS_CALL_SCOPE(bea_derived_stats(name));
+#endif
 				v8::Handle<v8::Function> fn	 = v8::Handle<v8::Function>::Cast(oFn);
 				v8::TryCatch try_catch; 
 				result = fn->Call(__jsInstance, nargs, args);
@@ -776,13 +1576,14 @@ namespace bea{
 //Throw if number of arguments is smaller than n
 #define REQUIRE_ARGS(args, n) if ((args).Length() < (n)) return v8::ThrowException(v8::Exception::TypeError(v8::String::NewSymbol("Wrong number of arguments")))
 
-//Every method accessible by javascript must start with this macro
-#define METHOD_BEGIN(nArgs) REQUIRE_ARGS(args, (nArgs)); try { 
+//Every method accessible by javascript must start with this macro.
+//Scratch memory used by the method's conversions is released when it returns.
+#define METHOD_BEGIN(nArgs) bea::ScratchScope __bea_scratch_scope; if ((args).Length() < (nArgs)) { BEA_STATS_FAILURE(); REQUIRE_ARGS(args, (nArgs)); } try { 
 #define DESTRUCTOR_BEGIN() try{
 #define DESTRUCTOR_END() } catch(bea::ArgConvertException& ){ }
 
 //Every method must end with this macro
-#define METHOD_END() } catch(bea::ArgConvertException& e){ return e.v8exception();}
+#define METHOD_END() } catch(bea::ArgConvertException& e){ BEA_STATS_FAILURE(); return e.v8exception();}
 
 //Copied from NODE_DEFINE_CONSTANT in node.js
 #define BEA_DEFINE_CONSTANT(target, constant)               \
@@ -0,0 +1,281 @@
+#include "beabufferops.h"
+#include "beasimd.h"
+#include <string.h>
+#include <limits>
+
+DECLARE_STATIC(bea::BufferOps);
+
+namespace bea{
+
+	//Converts to an element type: integers are rounded and clamped to their range
+	template<class T>
+	static inline T saturate(double v){
+		if (!std::numeric_limits<T>::is_integer)
+			return (T)v;
+		if (v != v)
+			return 0;
+		if (v <= (double)std::numeric_limits<T>::min())
+			return std::numeric_limits<T>::min();
+		if (v >= (double)std::numeric_limits<T>::max())
+			return std::numeric_limits<T>::max();
+		return (T)(v < 0 ? v - 0.5 : v + 0.5);
+	}
+
+	//Element access for mixed element types
+	static double loadAt(ExternalArray& a, int i){
+		switch (a.type){
+			case v8::kExternalByteArray: return a.ptr<signed char>()[i];
+			case v8::kExternalUnsignedByteArray:
+			case v8::kExternalPixelArray: return a.ptr<unsigned char>()[i];
+			case v8::kExternalShortArray: return a.ptr<short>()[i];
+			case v8::kExternalUnsignedShortArray: return a.ptr<unsigned short>()[i];
+			case v8::kExternalIntArray: return a.ptr<int>()[i];
+			case v8::kExternalUnsignedIntArray: return a.ptr<unsigned int>()[i];
+			case v8::kExternalFloatArray: return a.ptr<float>()[i];
+			case v8::kExternalDoubleArray: return a.ptr<double>()[i];
+		}
+		return 0;
+	}
+
+	static void storeAt(ExternalArray& a, int i, double v){
+		switch (a.type){
+			case v8::kExternalByteArray: a.ptr<signed char>()[i] = saturate<signed char>(v); break;
+			case v8::kExternalUnsignedByteArray:
+			case v8::kExternalPixelArray: a.ptr<unsigned char>()[i] = saturate<unsigned char>(v); break;
+			case v8::kExternalShortArray: a.ptr<short>()[i] = saturate<short>(v); break;
+			case v8::kExternalUnsignedShortArray: a.ptr<unsigned short>()[i] = saturate<unsigned short>(v); break;
+			case v8::kExternalIntArray: a.ptr<int>()[i] = saturate<int>(v); break;
+			case v8::kExternalUnsignedIntArray: a.ptr<unsigned int>()[i] = saturate<unsigned int>(v); break;
+			case v8::kExternalFloatArray: a.ptr<float>()[i] = (float)v; break;
+			case v8::kExternalDoubleArray: a.ptr<double>()[i] = v; break;
+		}
+	}
+
+	//Calls fn<T> args for the element type of an external array
+#define BEA_DISPATCH_TYPE(type, fn, args)										\
+	switch (type){																\
+		case v8::kExternalByteArray: fn<signed char> args; break;				\
+		case v8::kExternalUnsignedByteArray:									\
+		case v8::kExternalPixelArray: fn<unsigned char> args; break;			\
+		case v8::kExternalShortArray: fn<short> args; break;					\
+		case v8::kExternalUnsignedShortArray: fn<unsigned short> args; break;	\
+		case v8::kExternalIntArray: fn<int> args; break;						\
+		case v8::kExternalUnsignedIntArray: fn<unsigned int> args; break;		\
+		case v8::kExternalFloatArray: fn<float> args; break;					\
+		case v8::kExternalDoubleArray: fn<double> args; break;					\
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+	//Kernels of a single element type. The float versions are vectorized.
+
+	template<class T> static void fillT(void* dst, int n, double value){
+		T v = saturate<T>(value);
+		for (int k = 0; k < n; k++)
+			((T*)dst)[k] = v;
+	}
+	template<> void fillT<float>(void* dst, int n, double value){
+		simd::fill((float*)dst, n, (float)value);
+	}
+
+	template<class T> static void scaleOffsetT(void* dst, void* src, int n, double scale, double offset){
+		for (int k = 0; k < n; k++)
+			((T*)dst)[k] = saturate<T>(((T*)src)[k] * scale + offset);
+	}
+	template<> void scaleOffsetT<float>(void* dst, void* src, int n, double scale, double offset){
+		simd::scaleOffset((float*)dst, (float*)src, n, (float)scale, (float)offset);
+	}
+
+	template<class T> static void addT(void* dst, void* a, void* b, int n){
+		for (int k = 0; k < n; k++)
+			((T*)dst)[k] = saturate<T>((double)((T*)a)[k] + (double)((T*)b)[k]);
+	}
+	template<> void addT<float>(void* dst, void* a, void* b, int n){
+		simd::add((float*)dst, (float*)a, (float*)b, n);
+	}
+
+	template<class T> static void mulT(void* dst, void* a, void* b, int n){
+		for (int k = 0; k < n; k++)
+			((T*)dst)[k] = saturate<T>((double)((T*)a)[k] * (double)((T*)b)[k]);
+	}
+	template<> void mulT<float>(void* dst, void* a, void* b, int n){
+		simd::mul((float*)dst, (float*)a, (float*)b, n);
+	}
+
+	enum ReduceOp{ReduceMin, ReduceMax, ReduceSum};
+
+	template<class T> static void reduceT(void* src, int n, int op, double& res){
+		T* p = (T*)src;
+		res = op == ReduceSum ? 0 : (double)p[0];
+		for (int k = 0; k < n; k++){
+			double v = (double)p[k];
+			if (op == ReduceSum) res += v;
+			else if (op == ReduceMin ? v < res : v > res) res = v;
+		}
+	}
+	template<> void reduceT<float>(void* src, int n, int op, double& res){
+		float* p = (float*)src;
+		res = op == ReduceSum ? simd::sum(p, n) : op == ReduceMin ? simd::min(p, n) : simd::max(p, n);
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+
+	static inline int commonLength(const ExternalArray& a, const ExternalArray& b){
+		return a.length < b.length ? a.length : b.length;
+	}
+
+	void BufferOps::expose(v8::Handle<v8::Object> target){
+		static BufferOps s_instance;
+		ExposedStatic<BufferOps>* obj = ExposedStatic<BufferOps>::Create(&s_instance, "BufferOps");
+		obj->exposeMethod("fill", fill);
+		obj->exposeMethod("copy", copy);
+		obj->exposeMethod("scaleOffset", scaleOffset);
+		obj->exposeMethod("toFloat", toFloat);
+		obj->exposeMethod("toUint8", toUint8);
+		obj->exposeMethod("min", min);
+		obj->exposeMethod("max", max);
+		obj->exposeMethod("sum", sum);
+		obj->exposeMethod("add", add);
+		obj->exposeMethod("mul", mul);
+		obj->exposeTo(target);
+		delete obj;
+
+		target->Get(v8::String::NewSymbol("BufferOps"))->ToObject()->Set(v8::String::NewSymbol("simd"), 
+			v8::String::New(simd::instructionSet()), static_cast<v8::PropertyAttribute>(v8::ReadOnly | v8::DontDelete));
+	}
+
+	v8::Handle<v8::Value> BufferOps::fill(const v8::Arguments& args){
+		METHOD_BEGIN(2);
+		ExternalArray dst = bea::Convert<ExternalArray>::FromJS(args[0], 0);
+		double value = bea::Convert<double>::FromJS(args[1], 1);
+		BEA_DISPATCH_TYPE(dst.type, fillT, (dst.data, dst.length, value));
+		return args[0];
+		METHOD_END();
+		return v8::Undefined();
+	}
+
+	v8::Handle<v8::Value> BufferOps::copy(const v8::Arguments& args){
+		METHOD_BEGIN(2);
+		ExternalArray dst = bea::Convert<ExternalArray>::FromJS(args[0], 0);
+		ExternalArray src = bea::Convert<ExternalArray>::FromJS(args[1], 1);
+		int n = commonLength(dst, src);
+		if (dst.type == src.type)
+			memmove(dst.data, src.data, n * externalArrayElementSize(dst.type));
+		else if (dst.type == v8::kExternalFloatArray && src.type == v8::kExternalUnsignedByteArray)
+			simd::u8ToFloat(dst.ptr<float>(), src.ptr<unsigned char>(), n, 1.0f);
+		else if (dst.type == v8::kExternalUnsignedByteArray && src.type == v8::kExternalFloatArray)
+			simd::floatToU8(dst.ptr<unsigned char>(), src.ptr<float>(), n, 1.0f);
+		else {
+			for (int k = 0; k < n; k++)
+				storeAt(dst, k, loadAt(src, k));
+		}
+		return args[0];
+		METHOD_END();
+		return v8::Undefined();
+	}
+
+	v8::Handle<v8::Value> BufferOps::scaleOffset(const v8::Arguments& args){
+		METHOD_BEGIN(4);
+		ExternalArray dst = bea::Convert<ExternalArray>::FromJS(args[0], 0);
+		ExternalArray src = bea::Convert<ExternalArray>::FromJS(args[1], 1);
+		double scale = bea::Convert<double>::FromJS(args[2], 2);
+		double offset = bea::Convert<double>::FromJS(args[3], 3);
+		int n = commonLength(dst, src);
+		if (dst.type == src.type){
+			BEA_DISPATCH_TYPE(dst.type, scaleOffsetT, (dst.data, src.data, n, scale, offset));
+		}
+		else {
+			for (int k = 0; k < n; k++)
+				storeAt(dst, k, loadAt(src, k) * scale + offset);
+		}
+		return args[0];
+		METHOD_END();
+		return v8::Undefined();
+	}
+
+	v8::Handle<v8::Value> BufferOps::toFloat(const v8::Arguments& args){
+		METHOD_BEGIN(2);
+		ExternalArray dst = bea::Convert<ExternalArray>::FromJS(args[0], 0);
+		ExternalArray src = bea::Convert<ExternalArray>::FromJS(args[1], 1);
+		bool normalize = bea::Optional<bool>::FromJS(args, 2, true);
+		if (dst.type != v8::kExternalFloatArray)
+			throw bea::ArgConvertException(0, "Float array expected");
+		if (src.type != v8::kExternalUnsignedByteArray && src.type != v8::kExternalPixelArray)
+			throw bea::ArgConvertException(1, "Unsigned byte array expected");
+		simd::u8ToFloat(dst.ptr<float>(), src.ptr<unsigned char>(), commonLength(dst, src), normalize ? 1.0f / 255.0f : 1.0f);
+		return args[0];
+		METHOD_END();
+		return v8::Undefined();
+	}
+
+	v8::Handle<v8::Value> BufferOps::toUint8(const v8::Arguments& args){
+		METHOD_BEGIN(2);
+		ExternalArray dst = bea::Convert<ExternalArray>::FromJS(args[0], 0);
+		ExternalArray src = bea::Convert<ExternalArray>::FromJS(args[1], 1);
+		bool normalize = bea::Optional<bool>::FromJS(args, 2, true);
+		if (dst.type != v8::kExternalUnsignedByteArray && dst.type != v8::kExternalPixelArray)
+			throw bea::ArgConvertException(0, "Unsigned byte array expected");
+		if (src.type != v8::kExternalFloatArray)
+			throw bea::ArgConvertException(1, "Float array expected");
+		simd::floatToU8(dst.ptr<unsigned char>(), src.ptr<float>(), commonLength(dst, src), normalize ? 255.0f : 1.0f);
+		return args[0];
+		METHOD_END();
+		return v8::Undefined();
+	}
+
+	static v8::Handle<v8::Value> reduce(const v8::Arguments& args, int op){
+		METHOD_BEGIN(1);
+		ExternalArray src = bea::Convert<ExternalArray>::FromJS(args[0], 0);
+		if (src.length == 0)
+			return op == ReduceSum ? v8::Number::New(0) : v8::Undefined();
+		double res = 0;
+		BEA_DISPATCH_TYPE(src.type, reduceT, (src.data, src.length, op, res));
+		return v8::Number::New(res);
+		METHOD_END();
+		return v8::Undefined();
+	}
+
+	v8::Handle<v8::Value> BufferOps::min(const v8::Arguments& args){
+		return reduce(args, ReduceMin);
+	}
+
+	v8::Handle<v8::Value> BufferOps::max(const v8::Arguments& args){
+		return reduce(args, ReduceMax);
+	}
+
+	v8::Handle<v8::Value> BufferOps::sum(const v8::Arguments& args){
+		return reduce(args, ReduceSum);
+	}
+
+	static v8::Handle<v8::Value> binaryOp(const v8::Arguments& args, bool multiply){
+		METHOD_BEGIN(3);
+		ExternalArray dst = bea::Convert<ExternalArray>::FromJS(args[0], 0);
+		ExternalArray a = bea::Convert<ExternalArray>::FromJS(args[1], 1);
+		ExternalArray b = bea::Convert<ExternalArray>::FromJS(args[2], 2);
+		int n = commonLength(dst, a);
+		if (b.length < n)
+			n = b.length;
+		if (dst.type == a.type && dst.type == b.type){
+			if (multiply){
+				BEA_DISPATCH_TYPE(dst.type, mulT, (dst.data, a.data, b.data, n));
+			}
+			else {
+				BEA_DISPATCH_TYPE(dst.type, addT, (dst.data, a.data, b.data, n));
+			}
+		}
+		else {
+			for (int k = 0; k < n; k++)
+				storeAt(dst, k, multiply ? loadAt(a, k) * loadAt(b, k) : loadAt(a, k) + loadAt(b, k));
+		}
+		return args[0];
+		METHOD_END();
+		return v8::Undefined();
+	}
+
+	v8::Handle<v8::Value> BufferOps::add(const v8::Arguments& args){
+		return binaryOp(args, false);
+	}
+
+	v8::Handle<v8::Value> BufferOps::mul(const v8::Arguments& args){
+		return binaryOp(args, true);
+	}
+}
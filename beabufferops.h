@@ -0,0 +1,78 @@
+#ifndef __BEABUFFEROPS_H__
+#define __BEABUFFEROPS_H__
+
+//Bulk operations on external arrays, exposed to javascript as the BufferOps object.
+//Float buffers (and byte <-> float conversion) use the SIMD kernels in beasimd.h; other element types use plain loops.
+
+#include <v8.h>
+#include "bea.h"
+
+namespace bea{
+
+	//Any object with external array data (shared regions, cloned buffers, ...), viewed from C++
+	struct ExternalArray{
+		void* data;
+		int type;
+		int length;
+
+		ExternalArray(): data(NULL), type(0), length(0){}
+		ExternalArray(void* d, int t, int len): data(d), type(t), length(len){}
+
+		template<class T>
+		T* ptr(){
+			return static_cast<T*>(data);
+		}
+		int byteSize(){
+			return length * externalArrayElementSize(type);
+		}
+	};
+
+	template<> struct Convert<ExternalArray>{
+		static inline bool Is(v8::Handle<v8::Value> v){
+			return !v.IsEmpty() && v->IsObject() && v->ToObject()->HasIndexedPropertiesInExternalArrayData();
+		}
+
+		static inline ExternalArray FromJS(v8::Handle<v8::Value> v, int nArg){
+			static const char* msg = "External array expected";
+			if (!Is(v)) BEATHROW();
+			v8::Handle<v8::Object> obj = v->ToObject();
+			return ExternalArray(obj->GetIndexedPropertiesExternalArrayData(), 
+				obj->GetIndexedPropertiesExternalArrayDataType(), 
+				obj->GetIndexedPropertiesExternalArrayDataLength());
+		}
+
+		//The object does not own the memory
+		static inline v8::Handle<v8::Value> ToJS(const ExternalArray& val){
+			v8::HandleScope scope;
+			v8::Local<v8::Object> obj = v8::Object::New();
+			obj->SetIndexedPropertiesToExternalArrayData(val.data, (v8::ExternalArrayType)val.type, val.length);
+			return scope.Close(obj);
+		}
+	};
+
+	class BufferOps{
+	public:
+		//Adds the BufferOps object to target
+		static void expose(v8::Handle<v8::Object> target);
+
+		//BufferOps.fill(buf, value)
+		static v8::Handle<v8::Value> fill(const v8::Arguments& args);
+		//BufferOps.copy(dst, src): converts between element types (with saturation)
+		static v8::Handle<v8::Value> copy(const v8::Arguments& args);
+		//BufferOps.scaleOffset(dst, src, scale, offset): dst[i] = src[i] * scale + offset
+		static v8::Handle<v8::Value> scaleOffset(const v8::Arguments& args);
+		//BufferOps.toFloat(dstFloat, srcBytes, [normalize = true]): bytes to 0..1 floats
+		static v8::Handle<v8::Value> toFloat(const v8::Arguments& args);
+		//BufferOps.toUint8(dstBytes, srcFloat, [normalize = true]): 0..1 floats to bytes, rounded and clamped
+		static v8::Handle<v8::Value> toUint8(const v8::Arguments& args);
+		//BufferOps.min(buf), BufferOps.max(buf), BufferOps.sum(buf)
+		static v8::Handle<v8::Value> min(const v8::Arguments& args);
+		static v8::Handle<v8::Value> max(const v8::Arguments& args);
+		static v8::Handle<v8::Value> sum(const v8::Arguments& args);
+		//BufferOps.add(dst, a, b), BufferOps.mul(dst, a, b)
+		static v8::Handle<v8::Value> add(const v8::Arguments& args);
+		static v8::Handle<v8::Value> mul(const v8::Arguments& args);
+	};
+}
+
+#endif //__BEABUFFEROPS_H__
@@ -0,0 +1,274 @@
+#include "beabundle.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace bea{
+
+	static const char s_magic[8] = {'B', 'E', 'A', 'B', 'N', 'D', 'L', '\0'};
+	static const boost::uint32_t s_version = 1;
+
+	//Components of the absolute path, with "." and ".." resolved
+	static void splitPath(const std::string& path, std::vector<std::string>& parts){
+		boost::filesystem::path p = boost::filesystem::system_complete(path);
+		parts.clear();
+		for (boost::filesystem::path::iterator iter = p.begin(); iter != p.end(); iter++){
+			std::string s = iter->string();
+			if (s.empty() || s == ".")
+				continue;
+			if (s == ".."){
+				if (!parts.empty())
+					parts.pop_back();
+				continue;
+			}
+			parts.push_back(s);
+		}
+	}
+
+	//The part of path below root, '/' separated; empty if path is not below root
+	static std::string relativePath(const std::vector<std::string>& root, const std::string& path){
+		std::vector<std::string> parts;
+		splitPath(path, parts);
+		if (parts.size() <= root.size() || !std::equal(root.begin(), root.end(), parts.begin()))
+			return std::string();
+
+		std::string res;
+		for (size_t k = root.size(); k < parts.size(); k++){
+			if (!res.empty())
+				res += '/';
+			res += parts[k];
+		}
+		return res;
+	}
+
+	static bool readFile(const std::string& fileName, std::string& out){
+		FILE* file = fopen(fileName.c_str(), "rb");
+		if (!file)
+			return false;
+		fseek(file, 0, SEEK_END);
+		long size = ftell(file);
+		rewind(file);
+		out.resize(size > 0 ? (size_t)size : 0);
+		size_t read = size > 0 ? fread(&out[0], 1, (size_t)size, file) : 0;
+		fclose(file);
+		return read == out.size();
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+
+	ScriptBundle::ScriptBundle(): m_base(NULL), m_size(0){
+#if defined(_WIN32)
+		m_file = INVALID_HANDLE_VALUE;
+		m_mapping = NULL;
+#endif
+	}
+
+	ScriptBundle::~ScriptBundle(){
+		close();
+	}
+
+	bool ScriptBundle::open(const char* fileName, const char* root){
+		close();
+
+#if defined(_WIN32)
+		m_file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (m_file == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(m_file, &size) || size.QuadPart < (LONGLONG)sizeof(BundleHeader)){
+			close();
+			return false;
+		}
+		m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (m_mapping)
+			m_base = (const char*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+		if (!m_base){
+			close();
+			return false;
+		}
+		m_size = (size_t)size.QuadPart;
+#else
+		int fd = ::open(fileName, O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(BundleHeader)){
+			::close(fd);
+			return false;
+		}
+		void* p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (p == MAP_FAILED)
+			return false;
+		//Read the whole bundle ahead in one go instead of faulting it in script by script
+		madvise(p, (size_t)st.st_size, MADV_WILLNEED);
+		m_base = (const char*)p;
+		m_size = (size_t)st.st_size;
+#endif
+
+		//Validate the header and every entry before anything is served from the mapping
+		BundleHeader header;
+		memcpy(&header, m_base, sizeof(header));
+		boost::uint64_t indexEnd = sizeof(header) + (boost::uint64_t)header.count * sizeof(BundleEntry);
+		if (memcmp(header.magic, s_magic, sizeof(s_magic)) != 0 || header.version != s_version || indexEnd > m_size){
+			close();
+			return false;
+		}
+
+		const BundleEntry* entries = (const BundleEntry*)(m_base + sizeof(header));
+		for (boost::uint32_t k = 0; k < header.count; k++){
+			const BundleEntry& e = entries[k];
+			if ((boost::uint64_t)e.pathOffset + e.pathLength > m_size ||
+				(boost::uint64_t)e.sourceOffset + e.sourceLength > m_size ||
+				(boost::uint64_t)e.dataOffset + e.dataLength > m_size){
+				close();
+				return false;
+			}
+			m_entries[std::string(m_base + e.pathOffset, e.pathLength)] = &e;
+		}
+
+		if (root)
+			splitPath(root, m_root);
+		else
+			splitPath(boost::filesystem::system_complete(fileName).parent_path().string(), m_root);
+		return true;
+	}
+
+	void ScriptBundle::close(){
+#if defined(_WIN32)
+		if (m_base)
+			UnmapViewOfFile(m_base);
+		if (m_mapping)
+			CloseHandle(m_mapping);
+		if (m_file != INVALID_HANDLE_VALUE)
+			CloseHandle(m_file);
+		m_mapping = NULL;
+		m_file = INVALID_HANDLE_VALUE;
+#else
+		if (m_base)
+			munmap((void*)m_base, m_size);
+#endif
+		m_base = NULL;
+		m_size = 0;
+		m_entries.clear();
+		m_root.clear();
+	}
+
+	std::string ScriptBundle::key(const std::string& path) const{
+		return relativePath(m_root, path);
+	}
+
+	const BundleEntry* ScriptBundle::find(const std::string& path) const{
+		if (!m_base)
+			return NULL;
+		EntryMap::const_iterator iter = m_entries.find(key(path));
+		return iter != m_entries.end() ? iter->second : NULL;
+	}
+
+	v8::Handle<v8::String> ScriptBundle::source(const std::string& path) const{
+		const BundleEntry* e = find(path);
+		if (!e)
+			return v8::Handle<v8::String>();
+		return v8::String::New(m_base + e->sourceOffset, (int)e->sourceLength);
+	}
+
+	v8::ScriptData* ScriptBundle::preData(const std::string& path) const{
+		const BundleEntry* e = find(path);
+		if (!e || e->dataLength == 0)
+			return NULL;
+		return v8::ScriptData::New(m_base + e->dataOffset, (int)e->dataLength);
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+
+	BundleWriter::BundleWriter(const std::string& root, bool precompile): m_precompile(precompile){
+		splitPath(root, m_root);
+	}
+
+	void BundleWriter::add(const std::string& path, const std::string& source){
+		Item item;
+		item.path = path;
+		item.source = source;
+		if (m_precompile){
+			v8::ScriptData* data = v8::ScriptData::PreCompile(source.data(), (int)source.size());
+			if (data && !data->HasError())
+				item.data.assign(data->Data(), data->Length());
+			delete data;
+		}
+		m_items.push_back(item);
+	}
+
+	bool BundleWriter::addFile(const std::string& fileName){
+		std::string path = relativePath(m_root, fileName);
+		std::string source;
+		if (path.empty() || !readFile(fileName, source))
+			return false;
+		add(path, source);
+		return true;
+	}
+
+	size_t BundleWriter::addDirectory(const std::string& dir){
+		if (!boost::filesystem::is_directory(dir))
+			return 0;
+
+		size_t added = 0;
+		boost::filesystem::recursive_directory_iterator end;
+		for (boost::filesystem::recursive_directory_iterator iter(dir); iter != end; iter++){
+			const boost::filesystem::path& p = iter->path();
+			if (boost::filesystem::is_regular_file(p) && p.extension().string() == ".js" && addFile(p.string()))
+				added++;
+		}
+		return added;
+	}
+
+	bool BundleWriter::write(const char* fileName){
+		//Sorted, so the same tree always gives the same bundle
+		std::sort(m_items.begin(), m_items.end(), byPath);
+
+		BundleHeader header;
+		memcpy(header.magic, s_magic, sizeof(s_magic));
+		header.version = s_version;
+		header.count = (boost::uint32_t)m_items.size();
+
+		std::vector<BundleEntry> entries(m_items.size());
+		boost::uint64_t offset = sizeof(header) + m_items.size() * sizeof(BundleEntry);
+		for (size_t k = 0; k < m_items.size(); k++){
+			const Item& item = m_items[k];
+			BundleEntry& e = entries[k];
+			e.pathOffset = (boost::uint32_t)offset;
+			e.pathLength = (boost::uint32_t)item.path.size();
+			offset += item.path.size();
+			e.sourceOffset = (boost::uint32_t)offset;
+			e.sourceLength = (boost::uint32_t)item.source.size();
+			offset += item.source.size();
+			e.dataOffset = (boost::uint32_t)offset;
+			e.dataLength = (boost::uint32_t)item.data.size();
+			offset += item.data.size();
+		}
+		if (offset > 0xffffffffULL)
+			return false;
+
+		FILE* file = fopen(fileName, "wb");
+		if (!file)
+			return false;
+		bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+		if (ok && !entries.empty())
+			ok = fwrite(&entries[0], sizeof(BundleEntry), entries.size(), file) == entries.size();
+		for (size_t k = 0; ok && k < m_items.size(); k++){
+			const Item& item = m_items[k];
+			ok = fwrite(item.path.data(), 1, item.path.size(), file) == item.path.size() &&
+				fwrite(item.source.data(), 1, item.source.size(), file) == item.source.size() &&
+				fwrite(item.data.data(), 1, item.data.size(), file) == item.data.size();
+		}
+		ok = fclose(file) == 0 && ok;
+		return ok;
+	}
+}
@@ -0,0 +1,114 @@
+#ifndef __BEABUNDLE_H__
+#define __BEABUNDLE_H__
+
+//Single-file script bundles.
+//A bundle holds the sources of a script tree (main script, ./lib/loader.js, modules) and optionally their
+//precompiled data, indexed by path relative to a root directory. The runtime maps the bundle once and serves
+//loadScript, loadScriptSource and loadCommonJSModule from it; paths missing from the bundle still go to disk.
+
+#include <string>
+#include <vector>
+#include <map>
+#include <v8.h>
+#include <boost/cstdint.hpp>
+
+#if defined(_WIN32)
+#include <windows.h>
+#endif
+
+namespace bea{
+
+	//File layout, in host byte order: BundleHeader, BundleEntry[count], then the paths, sources and
+	//precompiled data the entries point to. Offsets are from the start of the file.
+	struct BundleHeader{
+		char magic[8];
+		boost::uint32_t version;
+		boost::uint32_t count;
+	};
+
+	struct BundleEntry{
+		boost::uint32_t pathOffset, pathLength;
+		boost::uint32_t sourceOffset, sourceLength;
+		boost::uint32_t dataOffset, dataLength;		//dataLength is 0 when the script was not precompiled
+	};
+
+	//A bundle mapped read-only into memory
+	class ScriptBundle{
+		const char* m_base;
+		size_t m_size;
+#if defined(_WIN32)
+		HANDLE m_file;
+		HANDLE m_mapping;
+#endif
+		std::vector<std::string> m_root;
+		typedef std::map<std::string, const BundleEntry*> EntryMap;
+		EntryMap m_entries;
+
+		const BundleEntry* find(const std::string& path) const;
+
+	public:
+		ScriptBundle();
+		~ScriptBundle();
+
+		//Map a bundle. Bundled paths are relative to root; by default, the directory of the bundle.
+		bool open(const char* fileName, const char* root = NULL);
+		void close();
+
+		bool isOpen() const{
+			return m_base != NULL;
+		}
+		size_t count() const{
+			return m_entries.size();
+		}
+
+		//Path of a script inside the bundle: relative to the root, '/' separated. Empty if outside the root.
+		std::string key(const std::string& path) const;
+
+		bool contains(const std::string& path) const{
+			return find(path) != NULL;
+		}
+
+		//Source of a bundled script; an empty handle if the path is not in the bundle
+		v8::Handle<v8::String> source(const std::string& path) const;
+
+		//Precompiled data of a bundled script, or NULL. The caller deletes it.
+		v8::ScriptData* preData(const std::string& path) const;
+	};
+
+	//Builds bundles. Files are added under their path relative to root, which is where the runtime
+	//will look for them. precompile needs V8 to be initialized.
+	class BundleWriter{
+		struct Item{
+			std::string path;
+			std::string source;
+			std::string data;
+		};
+		std::vector<Item> m_items;
+		std::vector<std::string> m_root;
+		bool m_precompile;
+
+		static bool byPath(const Item& a, const Item& b){
+			return a.path < b.path;
+		}
+
+	public:
+		BundleWriter(const std::string& root = ".", bool precompile = false);
+
+		//Add a script under its bundle path (relative to the root, '/' separated)
+		void add(const std::string& path, const std::string& source);
+
+		//Add a file from disk. Fails if it cannot be read or is not below the root.
+		bool addFile(const std::string& fileName);
+
+		//Add the .js files under dir. Returns the number of files added.
+		size_t addDirectory(const std::string& dir);
+
+		size_t count() const{
+			return m_items.size();
+		}
+
+		bool write(const char* fileName);
+	};
+}
+
+#endif //__BEABUNDLE_H__
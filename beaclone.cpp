@@ -0,0 +1,436 @@
+#include "beaclone.h"
+#include "bea.h"
+#include <string.h>
+
+namespace bea{
+
+	enum CloneTag{
+		TagUndefined = 'u',
+		TagNull = 'n',
+		TagTrue = 't',
+		TagFalse = 'f',
+		TagInt32 = 'i',
+		TagDouble = 'd',
+		TagString = 's',
+		TagDate = 'D',
+		TagArray = 'a',
+		TagObject = 'o',
+		TagKey = 'k',		//new property name: length + utf8 bytes
+		TagKeyRef = 'K',	//property name already seen: index
+		TagBackRef = 'r',	//object already seen: index
+		TagBuffer = 'b'		//external array: type, byte length, bytes
+	};
+
+	static const char cloneMagic[4] = {'B', 'E', 'A', 1};
+
+	static inline unsigned int hashBytes(const char* p, size_t n){
+		unsigned int h = 2166136261u;
+		for (size_t k = 0; k < n; k++){
+			h ^= (unsigned char)p[k];
+			h *= 16777619u;
+		}
+		return h;
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+
+	ValueSerializer::ValueSerializer(size_t reserve): m_size(0), m_objectCount(0), m_maxDepth(1000){
+		m_buf.resize(reserve > 16 ? reserve : 16);
+	}
+
+	void ValueSerializer::resetTable(std::vector<HashSlot>& table, size_t minSize){
+		size_t n = 64;
+		while (n < minSize * 2)
+			n <<= 1;
+		HashSlot empty = {0, 0};
+		table.assign(n, empty);
+	}
+
+	void ValueSerializer::writeVarint(unsigned int v){
+		ensure(5);
+		while (v >= 0x80){
+			m_buf[m_size++] = (char)(v | 0x80);
+			v >>= 7;
+		}
+		m_buf[m_size++] = (char)v;
+	}
+
+	void ValueSerializer::writeRaw(const void* p, size_t n){
+		ensure(n);
+		memcpy(&m_buf[m_size], p, n);
+		m_size += n;
+	}
+
+	//Length-prefixed UTF-8, written straight into the arena
+	void ValueSerializer::writeUtf8(v8::Handle<v8::String> str){
+		int len = str->Utf8Length();
+		writeVarint((unsigned int)len);
+		ensure(len);
+		if (len > 0)
+			str->WriteUtf8(&m_buf[m_size], len, NULL, v8::String::NO_NULL_TERMINATION);
+		m_size += len;
+	}
+
+	//Property names are written once; later occurrences refer to the first one
+	void ValueSerializer::writeKey(v8::Handle<v8::String> key){
+		size_t start = m_size;
+		writeByte(TagKey);
+		writeUtf8(key);
+
+		size_t bytesStart = m_size - (size_t)key->Utf8Length();
+		size_t bytesLen = m_size - bytesStart;
+		unsigned int h = hashBytes(&m_buf[bytesStart], bytesLen);
+
+		if (m_keyOffsets.size() * 2 >= m_keySlots.size()){
+			//Grow and rehash
+			std::vector<HashSlot> old;
+			old.swap(m_keySlots);
+			resetTable(m_keySlots, m_keyOffsets.size() * 2);
+			for (size_t k = 0; k < old.size(); k++){
+				if (!old[k].index) continue;
+				size_t i = old[k].hash & (m_keySlots.size() - 1);
+				while (m_keySlots[i].index) i = (i + 1) & (m_keySlots.size() - 1);
+				m_keySlots[i] = old[k];
+			}
+		}
+
+		size_t mask = m_keySlots.size() - 1;
+		size_t i = h & mask;
+		for (; m_keySlots[i].index; i = (i + 1) & mask){
+			HashSlot& slot = m_keySlots[i];
+			unsigned int idx = slot.index - 1;
+			if (slot.hash == h && m_keyLengths[idx] == bytesLen && 
+				memcmp(&m_buf[m_keyOffsets[idx]], &m_buf[bytesStart], bytesLen) == 0){
+				//Seen before: replace the bytes with a reference
+				m_size = start;
+				writeByte(TagKeyRef);
+				writeVarint(idx);
+				return;
+			}
+		}
+
+		m_keySlots[i].hash = h;
+		m_keySlots[i].index = (unsigned int)m_keyOffsets.size() + 1;
+		m_keyOffsets.push_back(bytesStart);
+		m_keyLengths.push_back((unsigned int)bytesLen);
+	}
+
+	int ValueSerializer::findOrAddObject(v8::Handle<v8::Object> obj){
+		unsigned int h = (unsigned int)obj->GetIdentityHash();
+
+		if (m_objectCount * 2 >= m_objSlots.size()){
+			std::vector<HashSlot> old;
+			old.swap(m_objSlots);
+			resetTable(m_objSlots, m_objectCount * 2);
+			for (size_t k = 0; k < old.size(); k++){
+				if (!old[k].index) continue;
+				size_t i = old[k].hash & (m_objSlots.size() - 1);
+				while (m_objSlots[i].index) i = (i + 1) & (m_objSlots.size() - 1);
+				m_objSlots[i] = old[k];
+			}
+		}
+
+		size_t mask = m_objSlots.size() - 1;
+		size_t i = h & mask;
+		for (; m_objSlots[i].index; i = (i + 1) & mask){
+			HashSlot& slot = m_objSlots[i];
+			if (slot.hash == h && m_objects->Get(slot.index - 1)->StrictEquals(obj))
+				return (int)slot.index - 1;
+		}
+
+		m_objSlots[i].hash = h;
+		m_objects->Set(m_objectCount, obj);
+		m_objSlots[i].index = ++m_objectCount;
+		return -1;
+	}
+
+	bool ValueSerializer::write(v8::Handle<v8::Value> v){
+		v8::HandleScope scope;
+		m_size = 0;
+		m_error.clear();
+		m_keyOffsets.clear();
+		m_keyLengths.clear();
+		m_objects = v8::Array::New();
+		m_objectCount = 0;
+		resetTable(m_keySlots, 32);
+		resetTable(m_objSlots, 32);
+
+		writeRaw(cloneMagic, sizeof(cloneMagic));
+		bool ok = writeValue(v, 0);
+		m_objects.Clear();
+		if (!ok)
+			m_size = 0;
+		return ok;
+	}
+
+	bool ValueSerializer::writeValue(v8::Handle<v8::Value> v, int depth){
+		if (depth > m_maxDepth){
+			m_error = "Value is nested too deeply";
+			return false;
+		}
+
+		if (v.IsEmpty() || v->IsUndefined())
+			writeByte(TagUndefined);
+		else if (v->IsNull())
+			writeByte(TagNull);
+		else if (v->IsTrue())
+			writeByte(TagTrue);
+		else if (v->IsFalse())
+			writeByte(TagFalse);
+		else if (v->IsInt32()){
+			int i = v->Int32Value();
+			writeByte(TagInt32);
+			writeRaw(&i, sizeof(i));
+		}
+		else if (v->IsNumber()){
+			double d = v->NumberValue();
+			writeByte(TagDouble);
+			writeRaw(&d, sizeof(d));
+		}
+		else if (v->IsString()){
+			writeByte(TagString);
+			writeUtf8(v->ToString());
+		}
+		else if (v->IsDate()){
+			double d = v->NumberValue();
+			writeByte(TagDate);
+			writeRaw(&d, sizeof(d));
+		}
+		else if (v->IsFunction()){
+			m_error = "Functions cannot be serialized";
+			return false;
+		}
+		else if (v->IsRegExp()){
+			m_error = "Regular expressions cannot be serialized";
+			return false;
+		}
+		else if (v->IsObject())
+			return writeObject(v->ToObject(), depth);
+		else {
+			m_error = "Unsupported value";
+			return false;
+		}
+		return true;
+	}
+
+	bool ValueSerializer::writeObject(v8::Handle<v8::Object> obj, int depth){
+		int ref = findOrAddObject(obj);
+		if (ref >= 0){
+			writeByte(TagBackRef);
+			writeVarint((unsigned int)ref);
+			return true;
+		}
+
+		if (obj->HasIndexedPropertiesInExternalArrayData()){
+			int type = obj->GetIndexedPropertiesExternalArrayDataType();
+			size_t bytes = (size_t)obj->GetIndexedPropertiesExternalArrayDataLength() * externalArrayElementSize(type);
+			writeByte(TagBuffer);
+			writeByte((unsigned char)type);
+			writeVarint((unsigned int)bytes);
+			writeRaw(obj->GetIndexedPropertiesExternalArrayData(), bytes);
+			return true;
+		}
+
+		if (obj->InternalFieldCount() > 0){
+			m_error = "Wrapped native objects cannot be serialized";
+			return false;
+		}
+
+		if (obj->IsArray()){
+			v8::Handle<v8::Array> arr = v8::Handle<v8::Array>::Cast(obj);
+			unsigned int len = arr->Length();
+			writeByte(TagArray);
+			writeVarint(len);
+			for (unsigned int k = 0; k < len; k++){
+				v8::HandleScope scope;
+				if (!writeValue(arr->Get(k), depth + 1))
+					return false;
+			}
+			return true;
+		}
+
+		v8::Local<v8::Array> keys = obj->GetOwnPropertyNames();
+		unsigned int count = keys->Length();
+		writeByte(TagObject);
+		writeVarint(count);
+		for (unsigned int k = 0; k < count; k++){
+			v8::HandleScope scope;
+			v8::Local<v8::String> key = keys->Get(k)->ToString();
+			writeKey(key);
+			if (!writeValue(obj->Get(key), depth + 1))
+				return false;
+		}
+		return true;
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+
+	//Frees the copy of an external array when its javascript object is collected
+	static void FreeCloneBuffer(v8::Persistent<v8::Value> value, void* data){
+		BeaBuffer* buffer = static_cast<BeaBuffer*>(data);
+		v8::V8::AdjustAmountOfExternalAllocatedMemory(-(intptr_t)buffer->size());
+		delete buffer;
+		value.Dispose();
+	}
+
+	ValueDeserializer::ValueDeserializer(const char* data, size_t size){
+		m_p = (const unsigned char*)data;
+		m_end = m_p + size;
+	}
+
+	v8::Handle<v8::Value> ValueDeserializer::fail(const char* msg){
+		if (m_error.empty())
+			m_error = msg;
+		return v8::Handle<v8::Value>();
+	}
+
+	bool ValueDeserializer::readVarint(unsigned int& v){
+		v = 0;
+		for (int shift = 0; shift < 35 && m_p < m_end; shift += 7){
+			unsigned char b = *m_p++;
+			v |= (unsigned int)(b & 0x7f) << shift;
+			if (!(b & 0x80))
+				return true;
+		}
+		return false;
+	}
+
+	bool ValueDeserializer::readRaw(void* p, size_t n){
+		if ((size_t)(m_end - m_p) < n)
+			return false;
+		memcpy(p, m_p, n);
+		m_p += n;
+		return true;
+	}
+
+	v8::Handle<v8::String> ValueDeserializer::readKey(){
+		if (m_p >= m_end)
+			return v8::Handle<v8::String>();
+		unsigned char tag = *m_p++;
+		unsigned int n;
+		if (!readVarint(n))
+			return v8::Handle<v8::String>();
+
+		if (tag == TagKeyRef)
+			return n < m_keys.size() ? m_keys[n] : v8::Handle<v8::String>();
+
+		if (tag != TagKey || (size_t)(m_end - m_p) < n)
+			return v8::Handle<v8::String>();
+
+		//Property names are interned: repeated names across clones share one symbol
+		v8::Handle<v8::String> key = v8::String::NewSymbol((const char*)m_p, (int)n);
+		m_p += n;
+		m_keys.push_back(key);
+		return key;
+	}
+
+	v8::Handle<v8::Value> ValueDeserializer::read(){
+		v8::HandleScope scope;
+		m_error.clear();
+		m_keys.clear();
+		m_objects.clear();
+
+		char magic[sizeof(cloneMagic)];
+		if (!readRaw(magic, sizeof(magic)) || memcmp(magic, cloneMagic, sizeof(magic)) != 0)
+			return fail("Not a serialized value");
+
+		v8::Handle<v8::Value> res = readValue(0);
+		m_keys.clear();
+		m_objects.clear();
+		if (res.IsEmpty())
+			return res;
+		return scope.Close(res);
+	}
+
+	v8::Handle<v8::Value> ValueDeserializer::readValue(int depth){
+		if (m_p >= m_end)
+			return fail("Unexpected end of data");
+		if (depth > 10000)
+			return fail("Value is nested too deeply");
+
+		unsigned char tag = *m_p++;
+		switch (tag){
+			case TagUndefined: return v8::Undefined();
+			case TagNull: return v8::Null();
+			case TagTrue: return v8::True();
+			case TagFalse: return v8::False();
+			case TagInt32: {
+				int i;
+				if (!readRaw(&i, sizeof(i))) break;
+				return v8::Integer::New(i);
+			}
+			case TagDouble: {
+				double d;
+				if (!readRaw(&d, sizeof(d))) break;
+				return v8::Number::New(d);
+			}
+			case TagDate: {
+				double d;
+				if (!readRaw(&d, sizeof(d))) break;
+				return v8::Date::New(d);
+			}
+			case TagString: {
+				unsigned int n;
+				if (!readVarint(n) || (size_t)(m_end - m_p) < n) break;
+				v8::Handle<v8::String> str = v8::String::New((const char*)m_p, (int)n);
+				m_p += n;
+				return str;
+			}
+			case TagBackRef: {
+				unsigned int n;
+				if (!readVarint(n) || n >= m_objects.size()) break;
+				return m_objects[n];
+			}
+			case TagBuffer: {
+				unsigned int bytes;
+				if (m_p >= m_end) break;
+				int type = *m_p++;
+				int elemSize = externalArrayElementSize(type);
+				if (!elemSize || !readVarint(bytes) || (size_t)(m_end - m_p) < bytes) break;
+
+				BeaBuffer* buffer = new BeaBuffer((int)bytes, type);
+				memcpy(buffer->ptr(), m_p, bytes);
+				m_p += bytes;
+				v8::V8::AdjustAmountOfExternalAllocatedMemory((intptr_t)bytes);
+
+				v8::Handle<v8::Object> obj = v8::Object::New();
+				obj->SetIndexedPropertiesToExternalArrayData(buffer->ptr(), (v8::ExternalArrayType)type, (int)bytes / elemSize);
+				obj->Set(v8::String::NewSymbol("length"), v8::Integer::New((int)bytes / elemSize), 
+					static_cast<v8::PropertyAttribute>(v8::ReadOnly | v8::DontEnum));
+				v8::Persistent<v8::Object>::New(obj).MakeWeak(buffer, FreeCloneBuffer);
+				m_objects.push_back(obj);
+				return obj;
+			}
+			case TagArray: {
+				unsigned int len;
+				if (!readVarint(len) || (size_t)(m_end - m_p) < len) break;
+				v8::Handle<v8::Array> arr = v8::Array::New((int)len);
+				m_objects.push_back(arr);
+				for (unsigned int k = 0; k < len; k++){
+					v8::Handle<v8::Value> item = readValue(depth + 1);
+					if (item.IsEmpty())
+						return item;
+					arr->Set(k, item);
+				}
+				return arr;
+			}
+			case TagObject: {
+				unsigned int count;
+				if (!readVarint(count)) break;
+				v8::Handle<v8::Object> obj = v8::Object::New();
+				m_objects.push_back(obj);
+				for (unsigned int k = 0; k < count; k++){
+					v8::Handle<v8::String> key = readKey();
+					if (key.IsEmpty())
+						return fail("Invalid property name");
+					v8::Handle<v8::Value> item = readValue(depth + 1);
+					if (item.IsEmpty())
+						return item;
+					obj->Set(key, item);
+				}
+				return obj;
+			}
+		}
+		return fail("Malformed serialized value");
+	}
+}
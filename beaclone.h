@@ -0,0 +1,104 @@
+#ifndef __BEACLONE_H__
+#define __BEACLONE_H__
+
+//Binary structured clone of javascript values, to move values between contexts.
+//Supports undefined, null, booleans, numbers, strings, dates, arrays, plain objects (own enumerable
+//properties, shared and cyclic references preserved) and external arrays (copied into a new buffer).
+//Functions, regular expressions and wrapped native objects cannot be serialized.
+//The encoding uses the byte order of the host; it is meant for transfers inside a process.
+
+#include <v8.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+namespace bea{
+
+	class ValueSerializer{
+		struct HashSlot{
+			unsigned int hash;
+			unsigned int index;	//index + 1, 0 for an empty slot
+		};
+
+		//Output arena, reused between write() calls
+		std::vector<char> m_buf;
+		size_t m_size;
+
+		//Property names already written: offset/length of their bytes in the arena
+		std::vector<HashSlot> m_keySlots;
+		std::vector<size_t> m_keyOffsets;
+		std::vector<unsigned int> m_keyLengths;
+
+		//Objects already written, for back references. Kept in an array of write()'s handle scope:
+		//elements and properties are written in scopes of their own.
+		std::vector<HashSlot> m_objSlots;
+		v8::Handle<v8::Array> m_objects;
+		unsigned int m_objectCount;
+
+		std::string m_error;
+		int m_maxDepth;
+
+		inline void ensure(size_t n){
+			if (m_size + n > m_buf.size())
+				m_buf.resize(std::max(m_buf.size() * 2, m_size + n));
+		}
+		inline void writeByte(unsigned char b){
+			ensure(1);
+			m_buf[m_size++] = (char)b;
+		}
+		void writeVarint(unsigned int v);
+		void writeRaw(const void* p, size_t n);
+		void writeUtf8(v8::Handle<v8::String> str);
+		void writeKey(v8::Handle<v8::String> key);
+		bool writeValue(v8::Handle<v8::Value> v, int depth);
+		bool writeObject(v8::Handle<v8::Object> obj, int depth);
+		//Returns the back reference index of obj, or -1 after registering it
+		int findOrAddObject(v8::Handle<v8::Object> obj);
+		static void resetTable(std::vector<HashSlot>& table, size_t minSize);
+
+	public:
+		ValueSerializer(size_t reserve = 64 * 1024);
+
+		//Serialize a value, replacing the previous output. Returns false (see error()) if the value is not supported.
+		bool write(v8::Handle<v8::Value> v);
+
+		const char* data() const{
+			return m_size ? &m_buf[0] : NULL;
+		}
+		size_t size() const{
+			return m_size;
+		}
+		const std::string& error() const{
+			return m_error;
+		}
+		void setMaxDepth(int depth){
+			m_maxDepth = depth;
+		}
+	};
+
+	class ValueDeserializer{
+		const unsigned char* m_p;
+		const unsigned char* m_end;
+		std::vector<v8::Handle<v8::String> > m_keys;
+		std::vector<v8::Handle<v8::Object> > m_objects;
+		std::string m_error;
+
+		bool readVarint(unsigned int& v);
+		bool readRaw(void* p, size_t n);
+		v8::Handle<v8::String> readKey();
+		v8::Handle<v8::Value> readValue(int depth);
+		v8::Handle<v8::Value> fail(const char* msg);
+
+	public:
+		ValueDeserializer(const char* data, size_t size);
+
+		//Rebuild the value in the current context. Returns an empty handle (see error()) on malformed input.
+		v8::Handle<v8::Value> read();
+
+		const std::string& error() const{
+			return m_error;
+		}
+	};
+}
+
+#endif //__BEACLONE_H__
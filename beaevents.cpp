@@ -0,0 +1,231 @@
+#include "beaevents.h"
+#include <string.h>
+#include <boost/thread/locks.hpp>
+
+namespace bea{
+
+	static inline uint64 doubleBits(double d){
+		uint64 bits;
+		memcpy(&bits, &d, sizeof(bits));
+		return bits;
+	}
+
+	static inline double bitsDouble(uint64 bits){
+		double d;
+		memcpy(&d, &bits, sizeof(d));
+		return d;
+	}
+
+	EventKey::EventKey(EventQueue* queue, const std::string& name, CoalescePolicy policy, size_t maxPending):
+		EventNode(true), m_queue(queue), m_name(name), m_policy(policy), m_maxPending(maxPending){
+		m_dirty = false;
+		m_latest = NULL;
+		m_sumBits = doubleBits(0);
+		m_count = 0;
+		m_pending = 0;
+		m_posted = 0;
+		m_delivered = 0;
+		m_merged = 0;
+		m_dropped = 0;
+	}
+
+	EventKey::~EventKey(){
+		delete m_latest.load();
+	}
+
+	void EventKey::markDirty(){
+		if (!m_dirty.exchange(true, boost::memory_order_acq_rel))
+			m_queue->push(this);
+	}
+
+	bool EventKey::postValue(EventValue* value){
+		m_posted.fetch_add(1, boost::memory_order_relaxed);
+
+		if (m_policy == KeepLatest){
+			m_count.fetch_add(1, boost::memory_order_relaxed);
+			//Whoever exchanges a value out of m_latest owns it
+			EventValue* prev = m_latest.exchange(value, boost::memory_order_acq_rel);
+			if (prev){
+				m_merged.fetch_add(1, boost::memory_order_relaxed);
+				delete prev;
+			}
+			markDirty();
+			return true;
+		}
+
+		if (m_maxPending && m_pending.load(boost::memory_order_relaxed) >= m_maxPending){
+			m_dropped.fetch_add(1, boost::memory_order_relaxed);
+			delete value;
+			return false;
+		}
+		m_pending.fetch_add(1, boost::memory_order_relaxed);
+		m_queue->push(value);
+		return true;
+	}
+
+	bool EventKey::add(double amount){
+		m_posted.fetch_add(1, boost::memory_order_relaxed);
+		uint64 prev = m_sumBits.load(boost::memory_order_relaxed);
+		while (!m_sumBits.compare_exchange_weak(prev, doubleBits(bitsDouble(prev) + amount), boost::memory_order_acq_rel)) {}
+		if (m_count.fetch_add(1, boost::memory_order_relaxed) > 0)
+			m_merged.fetch_add(1, boost::memory_order_relaxed);
+		markDirty();
+		return true;
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+
+	EventQueue::EventQueue(int intervalMs, size_t maxBatch): m_intervalMs(intervalMs), m_maxBatch(maxBatch > 0 ? maxBatch : 1),
+		m_lastBatchNs(0){
+		m_head = &m_stub;
+		m_tail = &m_stub;
+		m_batches = 0;
+		m_delivered = 0;
+	}
+
+	EventQueue::~EventQueue(){
+		EventNode* node;
+		while ((node = pop()) != NULL){
+			if (!node->isKey)
+				delete node;
+		}
+		for (size_t k = 0; k < m_keys.size(); k++)
+			delete m_keys[k];
+	}
+
+	EventKey* EventQueue::key(const std::string& name, CoalescePolicy policy, size_t maxPending){
+		boost::lock_guard<boost::mutex> guard(m_keysLock);
+		for (size_t k = 0; k < m_keys.size(); k++){
+			if (m_keys[k]->m_name == name)
+				return m_keys[k];
+		}
+		EventKey* key = new EventKey(this, name, policy, maxPending);
+		m_keys.push_back(key);
+		return key;
+	}
+
+	void EventQueue::push(EventNode* node){
+		node->next.store(NULL, boost::memory_order_relaxed);
+		EventNode* prev = m_head.exchange(node, boost::memory_order_acq_rel);
+		prev->next.store(node, boost::memory_order_release);
+	}
+
+	EventNode* EventQueue::pop(){
+		EventNode* tail = m_tail;
+		EventNode* next = tail->next.load(boost::memory_order_acquire);
+		if (tail == &m_stub){
+			if (!next)
+				return NULL;
+			m_tail = next;
+			tail = next;
+			next = next->next.load(boost::memory_order_acquire);
+		}
+		if (next){
+			m_tail = next;
+			return tail;
+		}
+		//tail is the last node; a producer may be half way through push()
+		if (tail != m_head.load(boost::memory_order_acquire))
+			return NULL;
+		push(&m_stub);
+		next = tail->next.load(boost::memory_order_acquire);
+		if (next){
+			m_tail = next;
+			return tail;
+		}
+		return NULL;
+	}
+
+	size_t EventQueue::dispatch(BeaContext* ctx, const char* fnName){
+		uint64 now = nowNs();
+		if (m_intervalMs > 0 && m_lastBatchNs && now - m_lastBatchNs < (uint64)m_intervalMs * 1000000)
+			return 0;
+
+		v8::HandleScope scope;
+		v8::Local<v8::Array> batch = v8::Array::New();
+		v8::Handle<v8::String> typeSym = v8::String::NewSymbol("type");
+		v8::Handle<v8::String> dataSym = v8::String::NewSymbol("data");
+		v8::Handle<v8::String> countSym = v8::String::NewSymbol("count");
+
+		uint32_t n = 0;
+		while (n < m_maxBatch){
+			EventNode* node = pop();
+			if (!node)
+				break;
+
+			EventKey* key;
+			v8::Handle<v8::Value> data;
+			uint64 count = 1;
+			if (node->isKey){
+				key = static_cast<EventKey*>(node);
+				//Cleared first: a post from now on queues the key again
+				key->m_dirty.store(false, boost::memory_order_release);
+				//A post racing with this read may land in the next event; the totals of sum and count are kept
+				if (key->m_policy == Accumulate){
+					count = key->m_count.exchange(0, boost::memory_order_acq_rel);
+					double sum = bitsDouble(key->m_sumBits.exchange(doubleBits(0), boost::memory_order_acq_rel));
+					if (count == 0 && sum == 0)
+						continue;
+					data = v8::Number::New(sum);
+				}
+				else {
+					EventValue* value = key->m_latest.exchange(NULL, boost::memory_order_acq_rel);
+					count = key->m_count.exchange(0, boost::memory_order_acq_rel);
+					//Already delivered with an earlier batch
+					if (!value)
+						continue;
+					if (count == 0)
+						count = 1;
+					data = value->toJS();
+					delete value;
+				}
+			}
+			else {
+				EventValue* value = static_cast<EventValue*>(node);
+				key = value->key;
+				key->m_pending.fetch_sub(1, boost::memory_order_relaxed);
+				data = value->toJS();
+				delete value;
+			}
+
+			v8::Local<v8::Object> e = v8::Object::New();
+			e->Set(typeSym, v8::String::New(key->m_name.c_str()));
+			e->Set(dataSym, data);
+			e->Set(countSym, v8::Number::New((double)count));
+			batch->Set(n++, e);
+			key->m_delivered.fetch_add(1, boost::memory_order_relaxed);
+		}
+
+		if (n == 0)
+			return 0;
+		m_lastBatchNs = now;
+		m_batches.fetch_add(1, boost::memory_order_relaxed);
+		m_delivered.fetch_add(n, boost::memory_order_relaxed);
+
+		v8::Handle<v8::Value> argv[1] = {batch};
+		ctx->call(fnName, 1, argv);
+		return n;
+	}
+
+	void EventQueue::getStats(EventQueueStats& stats){
+		stats.batches = m_batches.load();
+		stats.delivered = m_delivered.load();
+		stats.keys.clear();
+		boost::lock_guard<boost::mutex> guard(m_keysLock);
+		for (size_t k = 0; k < m_keys.size(); k++){
+			EventKey* key = m_keys[k];
+			EventKeyStats s;
+			s.name = key->m_name;
+			s.policy = key->m_policy;
+			s.posted = key->m_posted.load();
+			s.delivered = key->m_delivered.load();
+			s.merged = key->m_merged.load();
+			s.dropped = key->m_dropped.load();
+			if (key->m_policy == KeepAll)
+				s.pending = key->m_pending.load();
+			else
+				s.pending = key->m_dirty.load() ? 1 : 0;
+			stats.keys.push_back(s);
+		}
+	}
+}
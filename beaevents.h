@@ -0,0 +1,173 @@
+#ifndef __BEAEVENTS_H__
+#define __BEAEVENTS_H__
+
+//Coalescing event queue from native code to a script.
+//Native threads post events through keys registered on the queue; posting is lock-free. Each key has a policy:
+//	KeepAll: every event is delivered, up to maxPending queued events (the rest are dropped)
+//	KeepLatest: only the last value posted since the previous batch is delivered
+//	Accumulate: the values posted since the previous batch are summed
+//The script thread calls dispatch(), which hands everything posted since the last batch to a javascript function
+//in one call, no more often than the queue's interval.
+
+#include <v8.h>
+#include <string>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/bind/bind.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/type_traits/is_arithmetic.hpp>
+#include "beascript.h"
+
+namespace bea{
+
+	enum CoalescePolicy{
+		KeepAll,
+		KeepLatest,
+		Accumulate
+	};
+
+	//Node of the queue: a KeepAll event, or a coalescing key with something to deliver
+	struct EventNode{
+		boost::atomic<EventNode*> next;
+		bool isKey;
+
+		EventNode(bool key = false): next(NULL), isKey(key){}
+		virtual ~EventNode(){}
+	};
+
+	class EventKey;
+
+	//A posted value, converted to javascript on the script thread
+	struct EventValue : public EventNode{
+		EventKey* key;
+		boost::function<v8::Handle<v8::Value> ()> toJS;
+	};
+
+	namespace detail{
+		template<class T> v8::Handle<v8::Value> eventToJS(const T& v){
+			return Convert<T>::ToJS(v);
+		}
+
+		//Value added by an Accumulate key; non-numeric values count as 0
+		template<class T, bool = boost::is_arithmetic<T>::value> struct EventNumber{
+			static double get(const T&){
+				return 0;
+			}
+		};
+		template<class T> struct EventNumber<T, true>{
+			static double get(const T& v){
+				return (double)v;
+			}
+		};
+	}
+
+	struct EventKeyStats{
+		std::string name;
+		CoalescePolicy policy;
+		uint64 posted;
+		uint64 delivered;	//Events handed to the script (a coalesced event counts once)
+		uint64 merged;		//Posts folded into another event
+		uint64 dropped;		//KeepAll posts over maxPending
+		uint64 pending;
+	};
+
+	struct EventQueueStats{
+		uint64 batches;
+		uint64 delivered;
+		std::vector<EventKeyStats> keys;
+	};
+
+	class EventQueue;
+
+	//Posting end of one event type. Keys belong to their queue; post() can be called from any thread.
+	class EventKey : public EventNode{
+		friend class EventQueue;
+
+		EventQueue* m_queue;
+		std::string m_name;
+		CoalescePolicy m_policy;
+		size_t m_maxPending;
+
+		boost::atomic<bool> m_dirty;			//Queued for delivery (coalescing keys)
+		boost::atomic<EventValue*> m_latest;	//KeepLatest
+		boost::atomic<uint64> m_sumBits;		//Accumulate: the sum, as the bits of a double
+		boost::atomic<uint64> m_count;			//Posts since the last delivery (coalescing keys)
+		boost::atomic<uint64> m_pending;		//Queued events (KeepAll)
+
+		boost::atomic<uint64> m_posted;
+		boost::atomic<uint64> m_delivered;
+		boost::atomic<uint64> m_merged;
+		boost::atomic<uint64> m_dropped;
+
+		EventKey(EventQueue* queue, const std::string& name, CoalescePolicy policy, size_t maxPending);
+		~EventKey();
+
+		bool postValue(EventValue* value);
+		//Queue the key for delivery unless it is already queued
+		void markDirty();
+
+	public:
+		//Post an event. Returns false if it was dropped.
+		template<class T>
+		bool post(const T& value){
+			if (m_policy == Accumulate)
+				return add(detail::EventNumber<T>::get(value));
+			EventValue* v = new EventValue();
+			v->key = this;
+			v->toJS = boost::bind(&detail::eventToJS<T>, value);
+			return postValue(v);
+		}
+
+		//Accumulate keys: add amount to the pending sum
+		bool add(double amount);
+
+		const std::string& name(){
+			return m_name;
+		}
+		CoalescePolicy policy(){
+			return m_policy;
+		}
+	};
+
+	class EventQueue{
+		friend class EventKey;
+
+		//Intrusive MPSC queue (Vyukov), as in ContextExecutor: producers exchange m_head, dispatch() owns m_tail
+		boost::atomic<EventNode*> m_head;
+		EventNode* m_tail;
+		EventNode m_stub;
+
+		boost::mutex m_keysLock;
+		std::vector<EventKey*> m_keys;
+
+		int m_intervalMs;
+		size_t m_maxBatch;
+		uint64 m_lastBatchNs;
+		boost::atomic<uint64> m_batches;
+		boost::atomic<uint64> m_delivered;
+
+		void push(EventNode* node);
+		EventNode* pop();
+
+	public:
+		//intervalMs: minimum time between two batches; maxBatch: events per batch, the rest waits for the next one
+		EventQueue(int intervalMs = 0, size_t maxBatch = 1024);
+		//Undelivered events are discarded
+		~EventQueue();
+
+		//Register an event type, or return the key already registered under name.
+		//maxPending bounds the queued events of a KeepAll key (0: no bound).
+		EventKey* key(const std::string& name, CoalescePolicy policy = KeepAll, size_t maxPending = 1024);
+
+		//Call the global function fnName with the events posted since the last batch:
+		//	[{type: name, data: value, count: posts folded into this event}, ...]
+		//Run on the context's thread, with the locker held. Returns the number of events delivered; nothing is
+		//delivered before intervalMs have passed since the previous batch.
+		size_t dispatch(BeaContext* ctx, const char* fnName);
+
+		void getStats(EventQueueStats& stats);
+	};
+}
+
+#endif //__BEAEVENTS_H__
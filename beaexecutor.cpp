@@ -0,0 +1,148 @@
+#include "beaexecutor.h"
+
+namespace bea{
+
+	ContextExecutor::ContextExecutor(BeaContext* ctx, int batchSize): m_ctx(ctx), m_batchSize(batchSize){
+		m_head = &m_stub;
+		m_tail = &m_stub;
+		m_sleeping = false;
+		m_stop = false;
+		m_submitted = 0;
+		m_completed = 0;
+		m_batches = 0;
+		m_queueNs = 0;
+		m_maxQueueNs = 0;
+		m_runNs = 0;
+		m_thread = boost::thread(&ContextExecutor::run, this);
+	}
+
+	ContextExecutor::~ContextExecutor(){
+		{
+			boost::lock_guard<boost::mutex> guard(m_lock);
+			m_stop = true;
+		}
+		m_wake.notify_one();
+
+		//The executor needs the locker to finish its tasks
+		if (v8::Locker::IsLocked()){
+			v8::Unlocker unlocker;
+			m_thread.join();
+		}
+		else
+			m_thread.join();
+	}
+
+	void ContextExecutor::push(ExecutorTask* task){
+		task->next.store(NULL, boost::memory_order_relaxed);
+		ExecutorTask* prev = m_head.exchange(task, boost::memory_order_acq_rel);
+		prev->next.store(task, boost::memory_order_release);
+	}
+
+	ExecutorTask* ContextExecutor::pop(){
+		ExecutorTask* tail = m_tail;
+		ExecutorTask* next = tail->next.load(boost::memory_order_acquire);
+		if (tail == &m_stub){
+			if (!next)
+				return NULL;
+			m_tail = next;
+			tail = next;
+			next = next->next.load(boost::memory_order_acquire);
+		}
+		if (next){
+			m_tail = next;
+			return tail;
+		}
+		//tail is the last task; a producer may be half way through push()
+		if (tail != m_head.load(boost::memory_order_acquire))
+			return NULL;
+		push(&m_stub);
+		next = tail->next.load(boost::memory_order_acquire);
+		if (next){
+			m_tail = next;
+			return tail;
+		}
+		return NULL;
+	}
+
+	bool ContextExecutor::empty(){
+		return m_tail == &m_stub && m_stub.next.load(boost::memory_order_acquire) == NULL;
+	}
+
+	void ContextExecutor::submit(ExecutorTask* task){
+		task->enqueuedNs = nowNs();
+		m_submitted.fetch_add(1, boost::memory_order_relaxed);
+		push(task);
+		//Pairs with the fence in waitForWork(): either the executor sees the task, or we see it sleeping
+		boost::atomic_thread_fence(boost::memory_order_seq_cst);
+		if (m_sleeping.load(boost::memory_order_relaxed)){
+			boost::lock_guard<boost::mutex> guard(m_lock);
+			m_wake.notify_one();
+		}
+	}
+
+	//Returns false when the executor is stopped and the queue is empty
+	bool ContextExecutor::waitForWork(){
+		if (!empty())
+			return true;
+		boost::unique_lock<boost::mutex> lock(m_lock);
+		m_sleeping.store(true, boost::memory_order_relaxed);
+		boost::atomic_thread_fence(boost::memory_order_seq_cst);
+		while (empty() && !m_stop)
+			m_wake.wait(lock);
+		m_sleeping = false;
+		return !empty();
+	}
+
+	void ContextExecutor::runTask(ExecutorTask* task){
+		uint64 start = nowNs();
+		uint64 queued = start - task->enqueuedNs;
+		m_queueLatency.record(queued);
+		m_queueNs.fetch_add(queued, boost::memory_order_relaxed);
+		uint64 prev = m_maxQueueNs.load(boost::memory_order_relaxed);
+		while (queued > prev && !m_maxQueueNs.compare_exchange_weak(prev, queued, boost::memory_order_relaxed)) {}
+
+		{
+			v8::HandleScope scope;
+			v8::TryCatch tryCatch;
+			task->run(m_ctx);
+		}
+		delete task;
+
+		m_runNs.fetch_add(nowNs() - start, boost::memory_order_relaxed);
+		m_completed.fetch_add(1, boost::memory_order_relaxed);
+	}
+
+	void ContextExecutor::run(){
+		BEA_TRACE_THREAD_NAME("executor");
+		//Spurious empty pops (a push in progress) are retried after yielding
+		while (waitForWork()){
+			v8::Locker locker;
+			v8::HandleScope scope;
+			v8::Context::Scope contextScope(m_ctx->context());
+			m_batches.fetch_add(1, boost::memory_order_relaxed);
+
+			int n = 0;
+			for (; n < m_batchSize; n++){
+				ExecutorTask* task = pop();
+				if (!task)
+					break;
+				runTask(task);
+			}
+			if (n == 0)
+				boost::this_thread::yield();
+		}
+	}
+
+	void ContextExecutor::getStats(ExecutorStats& stats){
+		stats.submitted = m_submitted.load();
+		stats.completed = m_completed.load();
+		stats.pending = stats.submitted - stats.completed;
+		stats.batches = m_batches.load();
+		double n = stats.completed ? (double)stats.completed : 1.0;
+		stats.avgQueueMs = (double)m_queueNs.load() / n / 1e6;
+		stats.maxQueueMs = (double)m_maxQueueNs.load() / 1e6;
+		stats.p50QueueMs = (double)m_queueLatency.percentile(50) / 1e6;
+		stats.p99QueueMs = (double)m_queueLatency.percentile(99) / 1e6;
+		stats.avgRunMs = (double)m_runNs.load() / n / 1e6;
+	}
+}
@@ -0,0 +1,227 @@
+#ifndef __BEAEXECUTOR_H__
+#define __BEAEXECUTOR_H__
+
+//Runs the calls into a context on a thread owned by the context.
+//Host threads push tasks into a lock-free queue and get a future back; the executor thread takes the
+//v8::Locker once per batch of tasks instead of every host thread taking it for every call.
+//Arguments and results cross threads as C++ values and are converted with Convert<T> on the executor thread.
+
+#include <v8.h>
+#include <string>
+#include <stdexcept>
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/bind/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/future.hpp>
+#include "beascript.h"
+#include "beastats.h"
+
+namespace bea{
+
+	//Failed script call: the value of BeaContext::lastError on the executor thread
+	class ScriptError : public std::runtime_error{
+	public:
+		ScriptError(const std::string& message): std::runtime_error(message){}
+	};
+
+	struct ExecutorTask{
+		boost::atomic<ExecutorTask*> next;
+		uint64 enqueuedNs;
+
+		ExecutorTask(): next(NULL), enqueuedNs(0){}
+		virtual ~ExecutorTask(){}
+		//Called on the executor thread, inside the context, with the locker held
+		virtual void run(BeaContext* ctx) = 0;
+	};
+
+	struct ExecutorStats{
+		uint64 submitted;
+		uint64 completed;
+		uint64 pending;
+		uint64 batches;
+		//Time between submit and the start of the task
+		double avgQueueMs, maxQueueMs, p50QueueMs, p99QueueMs;
+		//Time the tasks took to run
+		double avgRunMs;
+	};
+
+	namespace detail{
+		template<class R> struct SetResult{
+			static void fromJS(boost::promise<R>& p, v8::Handle<v8::Value> v){
+				p.set_value(Convert<R>::FromJS(v, 0));
+			}
+			static void invoke(boost::promise<R>& p, const boost::function<R (BeaContext*)>& fn, BeaContext* ctx){
+				p.set_value(fn(ctx));
+			}
+		};
+
+		template<> struct SetResult<void>{
+			static void fromJS(boost::promise<void>& p, v8::Handle<v8::Value>){
+				p.set_value();
+			}
+			static void invoke(boost::promise<void>& p, const boost::function<void (BeaContext*)>& fn, BeaContext* ctx){
+				fn(ctx);
+				p.set_value();
+			}
+		};
+
+		typedef boost::function<int (v8::Handle<v8::Value>* argv)> ArgsFn;
+
+		template<class A1> int args1(const A1& a1, v8::Handle<v8::Value>* argv){
+			argv[0] = Convert<A1>::ToJS(a1);
+			return 1;
+		}
+		template<class A1, class A2> int args2(const A1& a1, const A2& a2, v8::Handle<v8::Value>* argv){
+			argv[0] = Convert<A1>::ToJS(a1);
+			argv[1] = Convert<A2>::ToJS(a2);
+			return 2;
+		}
+		template<class A1, class A2, class A3> int args3(const A1& a1, const A2& a2, const A3& a3, v8::Handle<v8::Value>* argv){
+			argv[0] = Convert<A1>::ToJS(a1);
+			argv[1] = Convert<A2>::ToJS(a2);
+			argv[2] = Convert<A3>::ToJS(a3);
+			return 3;
+		}
+		template<class A1, class A2, class A3, class A4> int args4(const A1& a1, const A2& a2, const A3& a3, const A4& a4, v8::Handle<v8::Value>* argv){
+			argv[0] = Convert<A1>::ToJS(a1);
+			argv[1] = Convert<A2>::ToJS(a2);
+			argv[2] = Convert<A3>::ToJS(a3);
+			argv[3] = Convert<A4>::ToJS(a4);
+			return 4;
+		}
+
+		//Calls a global javascript function and converts its result to R
+		template<class R> struct CallTask : public ExecutorTask{
+			std::string fnName;
+			ArgsFn args;
+			boost::promise<R> promise;
+
+			void run(BeaContext* ctx){
+				v8::HandleScope scope;
+				v8::Handle<v8::Value> argv[4];
+				try {
+					int argc = args ? args(argv) : 0;
+					v8::Handle<v8::Value> res = ctx->call(fnName.c_str(), argc, argv);
+					if (res.IsEmpty())
+						promise.set_exception(boost::copy_exception(ScriptError(BeaContext::lastError)));
+					else
+						SetResult<R>::fromJS(promise, res);
+				}
+				catch (bea::ArgConvertException&){
+					promise.set_exception(boost::copy_exception(ScriptError("Cannot convert the arguments or the result of " + fnName)));
+				}
+			}
+		};
+
+		//Runs a C++ function on the executor thread
+		template<class R> struct FunctionTask : public ExecutorTask{
+			boost::function<R (BeaContext*)> fn;
+			boost::promise<R> promise;
+
+			void run(BeaContext* ctx){
+				try {
+					SetResult<R>::invoke(promise, fn, ctx);
+				}
+				catch (...){
+					promise.set_exception(boost::current_exception());
+				}
+			}
+		};
+	}
+
+	class ContextExecutor{
+		BeaContext* m_ctx;
+
+		//Intrusive MPSC queue (Vyukov): producers exchange m_head, the executor thread owns m_tail
+		boost::atomic<ExecutorTask*> m_head;
+		ExecutorTask* m_tail;
+		struct Stub : public ExecutorTask{
+			void run(BeaContext*){}
+		} m_stub;
+
+		boost::atomic<bool> m_sleeping;
+		boost::atomic<bool> m_stop;
+		boost::mutex m_lock;
+		boost::condition_variable m_wake;
+		int m_batchSize;
+		boost::thread m_thread;
+
+		boost::atomic<uint64> m_submitted;
+		boost::atomic<uint64> m_completed;
+		boost::atomic<uint64> m_batches;
+		boost::atomic<uint64> m_queueNs;
+		boost::atomic<uint64> m_maxQueueNs;
+		boost::atomic<uint64> m_runNs;
+		LatencyHistogram m_queueLatency;
+
+		void push(ExecutorTask* task);
+		ExecutorTask* pop();
+		bool empty();
+		bool waitForWork();
+		void runTask(ExecutorTask* task);
+		void run();
+
+	public:
+		//batchSize: tasks run under one acquisition of the v8::Locker
+		ContextExecutor(BeaContext* ctx, int batchSize = 64);
+		//Runs the tasks already submitted, then stops the thread
+		~ContextExecutor();
+
+		//The executor takes ownership of the task
+		void submit(ExecutorTask* task);
+
+		//Run fn on the executor thread
+		template<class R>
+		boost::shared_future<R> submit(const boost::function<R (BeaContext*)>& fn){
+			detail::FunctionTask<R>* task = new detail::FunctionTask<R>();
+			task->fn = fn;
+			boost::shared_future<R> res(task->promise.get_future());
+			submit(task);
+			return res;
+		}
+
+		//Call a global javascript function. The future throws ScriptError if the call fails.
+		template<class R>
+		boost::shared_future<R> call(const std::string& fnName){
+			return call<R>(fnName, detail::ArgsFn());
+		}
+		template<class R, class A1>
+		boost::shared_future<R> call(const std::string& fnName, const A1& a1){
+			return call<R>(fnName, detail::ArgsFn(boost::bind(&detail::args1<A1>, a1, boost::placeholders::_1)));
+		}
+		template<class R, class A1, class A2>
+		boost::shared_future<R> call(const std::string& fnName, const A1& a1, const A2& a2){
+			return call<R>(fnName, detail::ArgsFn(boost::bind(&detail::args2<A1, A2>, a1, a2, boost::placeholders::_1)));
+		}
+		template<class R, class A1, class A2, class A3>
+		boost::shared_future<R> call(const std::string& fnName, const A1& a1, const A2& a2, const A3& a3){
+			return call<R>(fnName, detail::ArgsFn(boost::bind(&detail::args3<A1, A2, A3>, a1, a2, a3, boost::placeholders::_1)));
+		}
+		template<class R, class A1, class A2, class A3, class A4>
+		boost::shared_future<R> call(const std::string& fnName, const A1& a1, const A2& a2, const A3& a3, const A4& a4){
+			return call<R>(fnName, detail::ArgsFn(boost::bind(&detail::args4<A1, A2, A3, A4>, a1, a2, a3, a4, boost::placeholders::_1)));
+		}
+
+		template<class R>
+		boost::shared_future<R> call(const std::string& fnName, const detail::ArgsFn& args){
+			detail::CallTask<R>* task = new detail::CallTask<R>();
+			task->fnName = fnName;
+			task->args = args;
+			boost::shared_future<R> res(task->promise.get_future());
+			submit(task);
+			return res;
+		}
+
+		//True on the executor thread
+		bool isExecutorThread(){
+			return boost::this_thread::get_id() == m_thread.get_id();
+		}
+
+		void getStats(ExecutorStats& stats);
+	};
+}
+
+#endif //__BEAEXECUTOR_H__
@@ -0,0 +1,298 @@
+#ifndef __BEAJSON_H__
+#define __BEAJSON_H__
+
+//Direct C++ to JSON serialization.
+//Building a large result with Convert<T>::ToJS costs one Object::Set per property; JSONConvert<T>::WriteJSON
+//writes the JSON text into a reusable buffer instead, and the result is created with a single JSON.parse
+//(or handed to javascript as a string). Return bea::json<T> from a binding to use this path.
+
+#include <v8.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "bea.h"
+#include "beaplatform.h"
+
+namespace bea{
+
+	class JSONWriter{
+		std::string m_buf;
+		bool m_needComma;
+
+		inline void separator(){
+			if (m_needComma)
+				m_buf += ',';
+		}
+
+		void writeString(const char* s, size_t len){
+			static const char hex[] = "0123456789abcdef";
+			m_buf += '"';
+			size_t run = 0;
+			for (size_t k = 0; k < len; k++){
+				unsigned char c = (unsigned char)s[k];
+				if (c >= 0x20 && c != '"' && c != '\\')
+					continue;
+				m_buf.append(s + run, k - run);
+				run = k + 1;
+				switch (c){
+					case '"': m_buf += "\\\""; break;
+					case '\\': m_buf += "\\\\"; break;
+					case '\n': m_buf += "\\n"; break;
+					case '\r': m_buf += "\\r"; break;
+					case '\t': m_buf += "\\t"; break;
+					default:
+						m_buf += "\\u00";
+						m_buf += hex[c >> 4];
+						m_buf += hex[c & 15];
+				}
+			}
+			m_buf.append(s + run, len - run);
+			m_buf += '"';
+		}
+
+		void writeUnsigned(unsigned long long v, bool negative){
+			char tmp[24];
+			char* p = tmp + sizeof(tmp);
+			do {
+				*--p = (char)('0' + v % 10);
+				v /= 10;
+			} while (v);
+			if (negative)
+				*--p = '-';
+			m_buf.append(p, tmp + sizeof(tmp) - p);
+		}
+
+	public:
+		JSONWriter(size_t reserve = 4096): m_needComma(false){
+			m_buf.reserve(reserve);
+		}
+
+		//Start over, keeping the allocated buffer
+		void clear(){
+			m_buf.clear();
+			m_needComma = false;
+		}
+
+		void beginObject(){
+			separator();
+			m_buf += '{';
+			m_needComma = false;
+		}
+		void endObject(){
+			m_buf += '}';
+			m_needComma = true;
+		}
+		void beginArray(){
+			separator();
+			m_buf += '[';
+			m_needComma = false;
+		}
+		void endArray(){
+			m_buf += ']';
+			m_needComma = true;
+		}
+		void key(const char* name){
+			separator();
+			writeString(name, strlen(name));
+			m_buf += ':';
+			m_needComma = false;
+		}
+		void key(const std::string& name){
+			separator();
+			writeString(name.data(), name.size());
+			m_buf += ':';
+			m_needComma = false;
+		}
+
+		void null(){
+			separator();
+			m_buf += "null";
+			m_needComma = true;
+		}
+		void value(bool v){
+			separator();
+			m_buf += v ? "true" : "false";
+			m_needComma = true;
+		}
+		void value(long long v){
+			separator();
+			writeUnsigned(v < 0 ? 0ULL - (unsigned long long)v : (unsigned long long)v, v < 0);
+			m_needComma = true;
+		}
+		void value(unsigned long long v){
+			separator();
+			writeUnsigned(v, false);
+			m_needComma = true;
+		}
+		//NaN and infinities have no JSON representation and are written as null
+		void value(double v){
+			if (v != v || v - v != 0){
+				null();
+				return;
+			}
+			separator();
+			//Shortest of 15 or 17 digits that reads back as the same double
+			char tmp[32];
+			int n = snprintf(tmp, sizeof(tmp), "%.15g", v);
+			if (strtod(tmp, NULL) != v)
+				n = snprintf(tmp, sizeof(tmp), "%.17g", v);
+			m_buf.append(tmp, n);
+			m_needComma = true;
+		}
+		void value(const char* s, size_t len){
+			separator();
+			writeString(s, len);
+			m_needComma = true;
+		}
+		void value(const std::string& s){
+			value(s.data(), s.size());
+		}
+
+		const std::string& str() const{
+			return m_buf;
+		}
+		size_t size() const{
+			return m_buf.size();
+		}
+
+		//The JSON text as a javascript string
+		v8::Handle<v8::String> toString() const{
+			return v8::String::New(m_buf.data(), (int)m_buf.size());
+		}
+
+		//Parse the JSON text in the current context. Returns an empty handle if it throws.
+		v8::Handle<v8::Value> parse() const{
+			v8::HandleScope scope;
+			v8::Handle<v8::Object> global = v8::Context::GetCurrent()->Global();
+			v8::Handle<v8::Object> json = global->Get(v8::String::NewSymbol("JSON"))->ToObject();
+			v8::Handle<v8::Function> parseFn = v8::Handle<v8::Function>::Cast(json->Get(v8::String::NewSymbol("parse")));
+			v8::Handle<v8::Value> argv[1] = {toString()};
+			v8::Handle<v8::Value> res = parseFn->Call(json, 1, argv);
+			if (res.IsEmpty())
+				return res;
+			return scope.Close(res);
+		}
+
+		//Writer reused by the calls on this thread
+		static JSONWriter& threadWriter(){
+			static BEA_THREAD_LOCAL JSONWriter* s_writer = NULL;
+			if (!s_writer)
+				s_writer = new JSONWriter(64 * 1024);
+			s_writer->clear();
+			return *s_writer;
+		}
+	};
+
+	//JSONConvert<T>::WriteJSON(writer, value). Specialize it for your types, or use BEA_JSON_STRUCT.
+	template<class T> struct JSONConvert;
+
+#define BEA_JSON_VALUE(type, cast) \
+	template<> struct JSONConvert<type >{ \
+		static inline void WriteJSON(JSONWriter& w, const type& v){ w.value((cast)v); } \
+	}
+
+	BEA_JSON_VALUE(bool, bool);
+	BEA_JSON_VALUE(char, long long);
+	BEA_JSON_VALUE(short, long long);
+	BEA_JSON_VALUE(int, long long);
+	BEA_JSON_VALUE(long, long long);
+	BEA_JSON_VALUE(unsigned char, unsigned long long);
+	BEA_JSON_VALUE(unsigned short, unsigned long long);
+	BEA_JSON_VALUE(unsigned int, unsigned long long);
+	BEA_JSON_VALUE(unsigned long, unsigned long long);
+	BEA_JSON_VALUE(float, double);
+	BEA_JSON_VALUE(double, double);
+	BEA_JSON_VALUE(std::string, const std::string&);
+	BEA_JSON_VALUE(bea::string, const std::string&);
+
+	template<class T> struct JSONConvert<std::vector<T> >{
+		static inline void WriteJSON(JSONWriter& w, const std::vector<T>& v){
+			w.beginArray();
+			for (size_t k = 0; k < v.size(); k++)
+				JSONConvert<T>::WriteJSON(w, v[k]);
+			w.endArray();
+		}
+	};
+
+	template<class T> struct JSONConvert<bea::vector<T> >{
+		static inline void WriteJSON(JSONWriter& w, const bea::vector<T>& v){
+			JSONConvert<std::vector<T> >::WriteJSON(w, v);
+		}
+	};
+
+	template<class A, class B> struct JSONConvert<std::pair<A, B> >{
+		static inline void WriteJSON(JSONWriter& w, const std::pair<A, B>& v){
+			w.beginArray();
+			JSONConvert<A>::WriteJSON(w, v.first);
+			JSONConvert<B>::WriteJSON(w, v.second);
+			w.endArray();
+		}
+	};
+
+	template<class T> struct JSONConvert<std::map<std::string, T> >{
+		static inline void WriteJSON(JSONWriter& w, const std::map<std::string, T>& v){
+			w.beginObject();
+			for (typename std::map<std::string, T>::const_iterator iter = v.begin(); iter != v.end(); iter++){
+				w.key(iter->first);
+				JSONConvert<T>::WriteJSON(w, iter->second);
+			}
+			w.endObject();
+		}
+	};
+
+	//Used by BEA_JSON_FIELD to deduce the type of a member
+	template<class T>
+	inline void writeJSONField(JSONWriter& w, const char* name, const T& v){
+		w.key(name);
+		JSONConvert<T>::WriteJSON(w, v);
+	}
+
+	//Return type of bindings whose result is converted through JSON.
+	//Holds a reference to the value, not a copy: convert it within the full expression which built it,
+	//eg. Convert<json<T> >::ToJS(json<T>(f())), and don't keep it past the value's lifetime.
+	template<class T>
+	struct json{
+		const T& value;
+		json(const T& v): value(v){}
+	};
+
+	template<class T> struct Convert<json<T> >{
+		//Throws ResultConvertException if JSON.parse rejects the text
+		static inline v8::Handle<v8::Value> ToJS(const json<T>& v){
+			BEA_STATS_CONVERT_SCOPE();
+			JSONWriter& w = JSONWriter::threadWriter();
+			JSONConvert<T>::WriteJSON(w, v.value);
+			BEA_STATS_BYTES_OUT(w.size());
+
+			v8::Handle<v8::Value> res;
+			std::string error;
+			{
+				v8::TryCatch tryCatch;
+				res = w.parse();
+				if (res.IsEmpty())
+					error = std::string("Result is not valid JSON: ") + *v8::String::Utf8Value(tryCatch.Exception());
+			}
+			//Thrown outside the TryCatch, which would swallow the exception
+			if (res.IsEmpty())
+				throw ResultConvertException(error.c_str());
+			return res;
+		}
+	};
+}
+
+//Serialize the listed members of a struct as a JSON object. Use at global scope:
+//	BEA_JSON_STRUCT_BEGIN(Point)
+//		BEA_JSON_FIELD(x)
+//		BEA_JSON_FIELD(y)
+//	BEA_JSON_STRUCT_END()
+#define BEA_JSON_STRUCT_BEGIN(type) \
+	namespace bea{ template<> struct JSONConvert<type >{ \
+		static inline void WriteJSON(bea::JSONWriter& w, const type& v){ \
+			w.beginObject();
+#define BEA_JSON_FIELD(name) bea::writeJSONField(w, #name, v.name);
+#define BEA_JSON_STRUCT_END() w.endObject(); } }; }
+
+#endif //__BEAJSON_H__
@@ -0,0 +1,93 @@
+#include "bealazy.h"
+#include "bea.h"
+
+namespace bea{
+
+	//Exposers installed on an object, as a hidden array of externals
+	static v8::Handle<v8::String> exposersSym(){
+		return v8::String::NewSymbol("bea::lazyExposers");
+	}
+
+	LazyExposer::~LazyExposer(){
+		for (size_t k = 0; k < m_entries.size(); k++)
+			delete m_entries[k];
+	}
+
+	LazyExposer& LazyExposer::add(const char* name, ExposeFn fn){
+		Entry* e = new Entry();
+		e->name = name;
+		e->fn = fn;
+		e->exposed = 0;
+		m_entries.push_back(e);
+		return *this;
+	}
+
+	size_t LazyExposer::exposedCount(){
+		size_t n = 0;
+		for (size_t k = 0; k < m_entries.size(); k++)
+			n += m_entries[k]->exposed;
+		return n;
+	}
+
+	void LazyExposer::install(v8::Handle<v8::Object> target){
+		v8::HandleScope scope;
+		v8::Local<v8::Value> list = target->GetHiddenValue(exposersSym());
+		v8::Local<v8::Array> exposers;
+		if (!list.IsEmpty() && list->IsArray())
+			exposers = v8::Local<v8::Array>::Cast(list);
+		else {
+			exposers = v8::Array::New();
+			target->SetHiddenValue(exposersSym(), exposers);
+		}
+		bool recorded = false;
+		for (uint32_t k = 0; k < exposers->Length() && !recorded; k++)
+			recorded = v8::Local<v8::External>::Cast(exposers->Get(k))->Value() == this;
+		if (!recorded)
+			exposers->Set(exposers->Length(), v8::External::New(this));
+
+		for (size_t k = 0; k < m_entries.size(); k++){
+			v8::Handle<v8::String> name = v8::String::NewSymbol(m_entries[k]->name.c_str());
+			if (target->Has(name))
+				continue;
+			target->SetAccessor(name, Get, Set, v8::External::New(m_entries[k]), v8::DEFAULT, v8::DontEnum);
+		}
+	}
+
+	void LazyExposer::exposeAll(v8::Handle<v8::Object> target){
+		v8::HandleScope scope;
+		for (size_t k = 0; k < m_entries.size(); k++){
+			m_entries[k]->fn(target);
+			m_entries[k]->exposed++;
+		}
+	}
+
+	void LazyExposer::installFrom(v8::Handle<v8::Object> source, v8::Handle<v8::Object> target){
+		v8::HandleScope scope;
+		v8::Local<v8::Value> list = source->GetHiddenValue(exposersSym());
+		if (list.IsEmpty() || !list->IsArray())
+			return;
+		v8::Local<v8::Array> exposers = v8::Local<v8::Array>::Cast(list);
+		for (uint32_t k = 0; k < exposers->Length(); k++)
+			static_cast<LazyExposer*>(v8::Local<v8::External>::Cast(exposers->Get(k))->Value())->install(target);
+	}
+
+	//First access: replace the accessor with the exposed class
+	v8::Handle<v8::Value> LazyExposer::Get(v8::Local<v8::String> prop, const v8::AccessorInfo& info){
+		Entry* e = static_cast<Entry*>(v8::Local<v8::External>::Cast(info.Data())->Value());
+		BEA_TRACE_SPAN("expose", e->name.c_str());
+		v8::HandleScope scope;
+		v8::Local<v8::Object> holder = info.Holder();
+		holder->Delete(prop);
+		e->fn(holder);
+		e->exposed++;
+		return scope.Close(holder->Get(prop));
+	}
+
+	//Assigned before it was read: the script's value replaces the class
+	void LazyExposer::Set(v8::Local<v8::String> prop, v8::Local<v8::Value> value, const v8::AccessorInfo& info){
+		v8::HandleScope scope;
+		v8::Local<v8::Object> holder = info.Holder();
+		holder->Delete(prop);
+		holder->Set(prop, value);
+	}
+}
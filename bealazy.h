@@ -0,0 +1,59 @@
+#ifndef __BEALAZY_H__
+#define __BEALAZY_H__
+
+//Lazy class exposure.
+//Classes are registered by name with the function which exposes them; install() defines each name on the global
+//object as an accessor, and the class is exposed (templates created, methods registered) the first time a script
+//reads the name. Contexts which use a few classes of a large binding only pay for those.
+
+#include <v8.h>
+#include <string>
+#include <vector>
+
+namespace bea{
+
+	class LazyExposer{
+	public:
+		//Exposes one class (or any set of globals) on target, like TExposer::expose()
+		typedef void (*ExposeFn)(v8::Handle<v8::Object> target);
+
+	private:
+		struct Entry{
+			std::string name;
+			ExposeFn fn;
+			size_t exposed;		//Contexts the entry was materialized in
+		};
+		std::vector<Entry*> m_entries;
+
+		static v8::Handle<v8::Value> Get(v8::Local<v8::String> prop, const v8::AccessorInfo& info);
+		static void Set(v8::Local<v8::String> prop, v8::Local<v8::Value> value, const v8::AccessorInfo& info);
+
+	public:
+		LazyExposer(){}
+		~LazyExposer();
+
+		//Register a name. fn must define the name on its target.
+		LazyExposer& add(const char* name, ExposeFn fn);
+
+		bool empty(){
+			return m_entries.empty();
+		}
+		size_t size(){
+			return m_entries.size();
+		}
+		//Number of times a class was materialized, over all contexts
+		size_t exposedCount();
+
+		//Define the registered names missing from target as accessors which expose the class on first access.
+		//The accessors are not enumerable until the class is exposed. The exposer is recorded on target.
+		void install(v8::Handle<v8::Object> target);
+
+		//Expose everything now
+		void exposeAll(v8::Handle<v8::Object> target);
+
+		//Install the exposers recorded on source (the global of the context loading a module) on target
+		static void installFrom(v8::Handle<v8::Object> source, v8::Handle<v8::Object> target);
+	};
+}
+
+#endif //__BEALAZY_H__
@@ -0,0 +1,262 @@
+#include "bealog.h"
+#include <string.h>
+#include <sstream>
+
+namespace bea{
+
+	const char* logLevelName(int level){
+		switch (level){
+			case LogDebug: return "debug";
+			case LogInfo: return "info";
+			case LogWarning: return "warning";
+			case LogError: return "error";
+		}
+		return "log";
+	}
+
+	//Format the batch into one buffer so each sink does a single write
+	static void formatBatch(const std::vector<LogRecord>& batch, int minLevel, std::string& out){
+		out.clear();
+		for (size_t k = 0; k < batch.size(); k++){
+			if (batch[k].level < minLevel)
+				continue;
+			out += "[";
+			out += logLevelName(batch[k].level);
+			out += "] ";
+			out += batch[k].text;
+			out += "\n";
+		}
+	}
+
+	void ConsoleSink::write(const std::vector<LogRecord>& batch){
+		std::string buf;
+		formatBatch(batch, m_minLevel, buf);
+		if (!buf.empty()){
+			fwrite(buf.data(), 1, buf.size(), m_stream);
+			fflush(m_stream);
+		}
+	}
+
+	FileSink::FileSink(const char* fileName, int minLevel): LogSink(minLevel){
+		m_file = fopen(fileName, "ab");
+	}
+
+	FileSink::~FileSink(){
+		if (m_file)
+			fclose(m_file);
+	}
+
+	void FileSink::write(const std::vector<LogRecord>& batch){
+		if (!m_file)
+			return;
+		std::string buf;
+		formatBatch(batch, m_minLevel, buf);
+		if (!buf.empty()){
+			fwrite(buf.data(), 1, buf.size(), m_file);
+			fflush(m_file);
+		}
+	}
+
+	void CallbackSink::write(const std::vector<LogRecord>& batch){
+		for (size_t k = 0; k < batch.size(); k++){
+			if (batch[k].level >= m_minLevel)
+				m_cb(batch[k].text.c_str());
+		}
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+
+	Logger::Logger(size_t capacity, int flushIntervalMs){
+		m_capacity = 2;
+		while (m_capacity < capacity)
+			m_capacity <<= 1;
+		m_mask = m_capacity - 1;
+
+		m_ring = new Slot[m_capacity];
+		for (size_t k = 0; k < m_capacity; k++){
+			m_ring[k].seq.store(k, boost::memory_order_relaxed);
+			m_ring[k].heap = NULL;
+		}
+
+		m_tail = 0;
+		m_head = 0;
+		m_dropped = 0;
+		m_written = 0;
+		m_reportedDrops = 0;
+		m_level = LogDebug;
+		m_flushIntervalMs = flushIntervalMs;
+		m_stop = false;
+		//Error stack traces must not end up in the program's output
+		m_sinks.push_back(new ConsoleSink(stderr));
+
+		m_thread = boost::thread(&Logger::run, this);
+	}
+
+	Logger::~Logger(){
+		{
+			boost::lock_guard<boost::mutex> guard(m_lock);
+			m_stop = true;
+		}
+		m_wake.notify_one();
+		m_thread.join();
+
+		clearSinks();
+		for (size_t k = 0; k < m_capacity; k++)
+			delete[] m_ring[k].heap;
+		delete[] m_ring;
+	}
+
+	Logger& Logger::instance(){
+		static Logger s_logger;
+		return s_logger;
+	}
+
+	bool Logger::log(int level, const char* msg, int length){
+		if (level < m_level.load(boost::memory_order_relaxed))
+			return true;
+
+		if (length < 0)
+			length = (int)strlen(msg);
+
+		//Claim a slot (bounded MPMC queue, Vyukov style)
+		Slot* slot;
+		size_t pos = m_tail.load(boost::memory_order_relaxed);
+		for (;;){
+			slot = &m_ring[pos & m_mask];
+			size_t seq = slot->seq.load(boost::memory_order_acquire);
+			intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+			if (diff == 0){
+				if (m_tail.compare_exchange_weak(pos, pos + 1, boost::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0){
+				//Ring is full: drop rather than block the script
+				m_dropped.fetch_add(1, boost::memory_order_relaxed);
+				return false;
+			}
+			else
+				pos = m_tail.load(boost::memory_order_relaxed);
+		}
+
+		slot->level = level;
+		slot->length = length;
+		if (length <= InlineSize)
+			memcpy(slot->text, msg, length);
+		else {
+			slot->heap = new char[length];
+			memcpy(slot->heap, msg, length);
+		}
+		slot->seq.store(pos + 1, boost::memory_order_release);
+
+		//Wake the logger early when the ring is half full or an error was logged
+		if (level >= LogError || pos - m_head.load(boost::memory_order_relaxed) >= m_capacity / 2)
+			m_wake.notify_one();
+
+		return true;
+	}
+
+	size_t Logger::drain(std::vector<LogRecord>& batch){
+		size_t n = 0;
+		size_t pos = m_head.load(boost::memory_order_relaxed);
+		for (;;){
+			Slot* slot = &m_ring[pos & m_mask];
+			size_t seq = slot->seq.load(boost::memory_order_acquire);
+			if (seq != pos + 1)
+				break;
+
+			LogRecord rec;
+			rec.level = slot->level;
+			if (slot->heap){
+				rec.text.assign(slot->heap, slot->length);
+				delete[] slot->heap;
+				slot->heap = NULL;
+			}
+			else
+				rec.text.assign(slot->text, slot->length);
+			batch.push_back(rec);
+
+			slot->seq.store(pos + m_capacity, boost::memory_order_release);
+			pos++;
+			n++;
+			m_head.store(pos, boost::memory_order_release);
+		}
+		return n;
+	}
+
+	void Logger::writeBatch(const std::vector<LogRecord>& batch){
+		boost::lock_guard<boost::mutex> guard(m_sinkLock);
+		for (size_t k = 0; k < m_sinks.size(); k++)
+			m_sinks[k]->write(batch);
+		m_written.fetch_add(batch.size(), boost::memory_order_relaxed);
+	}
+
+	void Logger::run(){
+		std::vector<LogRecord> batch;
+		for (;;){
+			bool stop;
+			{
+				boost::unique_lock<boost::mutex> lock(m_lock);
+				if (!m_stop && m_head.load() == m_tail.load())
+					m_wake.timed_wait(lock, boost::posix_time::milliseconds(m_flushIntervalMs));
+				stop = m_stop;
+			}
+
+			batch.clear();
+			drain(batch);
+
+			size_t dropped = m_dropped.load(boost::memory_order_relaxed);
+			if (dropped != m_reportedDrops){
+				std::stringstream s;
+				s << (dropped - m_reportedDrops) << " log messages dropped";
+				LogRecord rec;
+				rec.level = LogWarning;
+				rec.text = s.str();
+				batch.push_back(rec);
+				m_reportedDrops = dropped;
+			}
+
+			if (!batch.empty())
+				writeBatch(batch);
+
+			{
+				boost::lock_guard<boost::mutex> guard(m_lock);
+				m_drained.notify_all();
+			}
+
+			if (stop && m_head.load() == m_tail.load())
+				break;
+		}
+	}
+
+	void Logger::flush(){
+		size_t target = m_tail.load();
+		boost::unique_lock<boost::mutex> lock(m_lock);
+		while (m_head.load() < target && !m_stop){
+			m_wake.notify_one();
+			m_drained.timed_wait(lock, boost::posix_time::milliseconds(m_flushIntervalMs));
+		}
+	}
+
+	void Logger::addSink(LogSink* sink){
+		boost::lock_guard<boost::mutex> guard(m_sinkLock);
+		m_sinks.push_back(sink);
+	}
+
+	void Logger::removeSink(LogSink* sink){
+		boost::lock_guard<boost::mutex> guard(m_sinkLock);
+		for (size_t k = 0; k < m_sinks.size(); k++){
+			if (m_sinks[k] == sink){
+				delete sink;
+				m_sinks.erase(m_sinks.begin() + k);
+				return;
+			}
+		}
+	}
+
+	void Logger::clearSinks(){
+		boost::lock_guard<boost::mutex> guard(m_sinkLock);
+		for (size_t k = 0; k < m_sinks.size(); k++)
+			delete m_sinks[k];
+		m_sinks.clear();
+	}
+}
@@ -0,0 +1,145 @@
+#ifndef __BEALOG_H__
+#define __BEALOG_H__
+
+//Asynchronous logger.
+//Script threads push messages into a lock-free ring buffer and return immediately;
+//a background thread drains the ring in batches and hands them to the sinks.
+//When the ring is full, messages are dropped and counted instead of blocking the script.
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <boost/atomic.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace bea{
+
+	enum LogLevel{
+		LogDebug = 0,
+		LogInfo,
+		LogWarning,
+		LogError
+	};
+
+	const char* logLevelName(int level);
+
+	struct LogRecord{
+		int level;
+		std::string text;
+	};
+
+	//Destination of log messages. write() is called on the logger thread, one batch at a time.
+	class LogSink{
+	protected:
+		int m_minLevel;
+	public:
+		LogSink(int minLevel = LogDebug): m_minLevel(minLevel){}
+		virtual ~LogSink(){}
+		virtual void write(const std::vector<LogRecord>& batch) = 0;
+	};
+
+	//Writes to stdout or stderr
+	class ConsoleSink : public LogSink{
+		FILE* m_stream;
+	public:
+		ConsoleSink(FILE* stream = stdout, int minLevel = LogDebug): LogSink(minLevel), m_stream(stream){}
+		void write(const std::vector<LogRecord>& batch);
+	};
+
+	//Appends to a file
+	class FileSink : public LogSink{
+		FILE* m_file;
+	public:
+		FileSink(const char* fileName, int minLevel = LogDebug);
+		~FileSink();
+		bool isOpen(){
+			return m_file != NULL;
+		}
+		void write(const std::vector<LogRecord>& batch);
+	};
+
+	//Calls a function for each message
+	typedef void (*logCallback)(const char* msg);
+	class CallbackSink : public LogSink{
+		logCallback m_cb;
+	public:
+		CallbackSink(logCallback cb, int minLevel = LogDebug): LogSink(minLevel), m_cb(cb){}
+		logCallback callback(){
+			return m_cb;
+		}
+		void write(const std::vector<LogRecord>& batch);
+	};
+
+	class Logger{
+		//Ring slot. Short messages are stored inline, longer ones in a heap block.
+		enum {InlineSize = 240};
+		struct Slot{
+			boost::atomic<size_t> seq;
+			int level;
+			int length;
+			char* heap;
+			char text[InlineSize];
+		};
+
+		Slot* m_ring;
+		size_t m_capacity;
+		size_t m_mask;
+		boost::atomic<size_t> m_tail;	//next slot to write (producers)
+		boost::atomic<size_t> m_head;	//next slot to read (logger thread)
+		boost::atomic<size_t> m_dropped;
+		boost::atomic<size_t> m_written;
+		size_t m_reportedDrops;
+
+		boost::atomic<int> m_level;		//Read by every producer
+		int m_flushIntervalMs;
+		bool m_stop;
+		boost::mutex m_lock;
+		boost::condition_variable m_wake;
+		boost::condition_variable m_drained;
+		boost::mutex m_sinkLock;
+		std::vector<LogSink*> m_sinks;
+		boost::thread m_thread;
+
+		void run();
+		size_t drain(std::vector<LogRecord>& batch);
+		void writeBatch(const std::vector<LogRecord>& batch);
+
+	public:
+		//capacity is rounded up to a power of two
+		Logger(size_t capacity = 4096, int flushIntervalMs = 50);
+		~Logger();
+
+		//Process-wide logger used by the script runtime. Its default sink writes to stderr.
+		static Logger& instance();
+
+		//Queue a message. Never blocks; returns false if the message was dropped.
+		bool log(int level, const char* msg, int length = -1);
+
+		//Block until every message queued so far has been handed to the sinks
+		void flush();
+
+		//Messages below level are discarded before they are queued
+		void setLevel(int level){
+			m_level.store(level, boost::memory_order_relaxed);
+		}
+		int level(){
+			return m_level.load(boost::memory_order_relaxed);
+		}
+
+		//The logger owns the sinks
+		void addSink(LogSink* sink);
+		void removeSink(LogSink* sink);
+		void clearSinks();
+
+		size_t dropped(){
+			return m_dropped.load();
+		}
+		size_t written(){
+			return m_written.load();
+		}
+	};
+}
+
+#endif //__BEALOG_H__
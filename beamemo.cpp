@@ -0,0 +1,273 @@
+#include "beamemo.h"
+#include "beaclone.h"
+#include "bea.h"
+#include <string.h>
+#include <boost/thread/locks.hpp>
+#include <boost/atomic.hpp>
+
+namespace bea{
+
+	enum {MaxKeyDepth = 8};
+
+	//Tagged encoding of one argument; arrays are written element by element
+	static bool appendKey(v8::Handle<v8::Value> v, std::string& key, int depth){
+		if (v->IsUndefined())
+			key += 'u';
+		else if (v->IsNull())
+			key += 'n';
+		else if (v->IsBoolean())
+			key += v->BooleanValue() ? 't' : 'f';
+		else if (v->IsNumber()){
+			double d = v->NumberValue();
+			if (d == 0)
+				d = 0;	//-0 becomes 0: both share an entry
+			key += 'd';
+			key.append((const char*)&d, sizeof(d));
+		}
+		else if (v->IsString()){
+			v8::Handle<v8::String> s = v->ToString();
+			int len = s->Utf8Length();
+			key += 's';
+			key.append((const char*)&len, sizeof(len));
+			size_t start = key.size();
+			key.resize(start + len);
+			if (len > 0)
+				s->WriteUtf8(&key[start], len);
+		}
+		else if (v->IsArray() && depth < MaxKeyDepth){
+			v8::Handle<v8::Array> a = v8::Handle<v8::Array>::Cast(v);
+			unsigned int len = a->Length();
+			key += 'a';
+			key.append((const char*)&len, sizeof(len));
+			for (unsigned int k = 0; k < len; k++){
+				if (!appendKey(a->Get(k), key, depth + 1))
+					return false;
+			}
+		}
+		else
+			return false;
+		return true;
+	}
+
+	//Process-wide id of obj, assigned on first use
+	static bool objectId(v8::Handle<v8::Object> obj, double& id){
+		static v8::Persistent<v8::String> s_idSym;
+		static boost::atomic<uint64> s_nextId(1);
+		if (s_idSym.IsEmpty())
+			s_idSym = v8::Persistent<v8::String>::New(v8::String::NewSymbol("bea::memoId"));
+
+		v8::Local<v8::Value> v = obj->GetHiddenValue(s_idSym);
+		if (!v.IsEmpty() && v->IsNumber()){
+			id = v->NumberValue();
+			return true;
+		}
+		id = (double)s_nextId.fetch_add(1, boost::memory_order_relaxed);
+		return obj->SetHiddenValue(s_idSym, v8::Number::New(id));
+	}
+
+	//The serializer of the calling thread, reused between calls
+	static ValueSerializer& serializer(){
+		static BEA_THREAD_LOCAL ValueSerializer* s_serializer = NULL;
+		if (!s_serializer)
+			s_serializer = new ValueSerializer(4096);
+		return *s_serializer;
+	}
+
+	std::vector<MemoCache*>& MemoCache::registry(){
+		static std::vector<MemoCache*> s_caches;
+		return s_caches;
+	}
+
+	boost::mutex& MemoCache::registryLock(){
+		static boost::mutex s_lock;
+		return s_lock;
+	}
+
+	MemoCache::MemoCache(const std::string& name, v8::InvocationCallback cb, size_t maxEntries, size_t maxBytes, bool keyThis):
+		m_name(name), m_cb(cb), m_maxEntries(maxEntries > 0 ? maxEntries : 1), m_maxBytes(maxBytes), m_keyThis(keyThis), m_bytes(0),
+		m_hits(0), m_misses(0), m_uncacheable(0), m_evictions(0){
+	}
+
+	v8::Handle<v8::FunctionTemplate> MemoCache::instrument(const std::string& name, v8::InvocationCallback cb,
+		size_t maxEntries, size_t maxBytes, bool keyThis){
+		MemoCache* cache = NULL;
+		{
+			boost::lock_guard<boost::mutex> guard(registryLock());
+			std::vector<MemoCache*>& caches = registry();
+			for (size_t k = 0; k < caches.size() && !cache; k++){
+				if (caches[k]->m_name == name && caches[k]->m_cb == cb)
+					cache = caches[k];
+			}
+			if (!cache){
+				cache = new MemoCache(name, cb, maxEntries, maxBytes, keyThis);
+				caches.push_back(cache);
+			}
+		}
+		return v8::FunctionTemplate::New(trampoline, v8::External::New(cache));
+	}
+
+	bool MemoCache::makeKey(const v8::Arguments& args, std::string& key, bool keyThis){
+		key.clear();
+		if (keyThis){
+			double id;
+			if (!objectId(args.This(), id))
+				return false;
+			key += 'o';
+			key.append((const char*)&id, sizeof(id));
+		}
+		for (int k = 0; k < args.Length(); k++){
+			if (!appendKey(args[k], key, 0))
+				return false;
+		}
+		return true;
+	}
+
+	v8::Handle<v8::Value> MemoCache::trampoline(const v8::Arguments& args){
+		v8::Local<v8::External> edata = v8::Local<v8::External>::Cast(args.Data());
+		MemoCache* cache = static_cast<MemoCache*>(edata->Value());
+		BEA_TRACE_SPAN("native", cache->m_name.c_str());
+		v8::HandleScope scope;
+
+		std::string key;
+		if (!makeKey(args, key, cache->m_keyThis) || (cache->m_maxBytes && key.size() > cache->m_maxBytes)){
+			{
+				boost::lock_guard<boost::mutex> guard(cache->m_lock);
+				cache->m_uncacheable++;
+			}
+			return scope.Close(cache->m_cb(args));
+		}
+
+		std::string value;
+		bool hit = false;
+		{
+			boost::lock_guard<boost::mutex> guard(cache->m_lock);
+			ItemMap::iterator iter = cache->m_map.find(key);
+			if (iter != cache->m_map.end()){
+				cache->m_items.splice(cache->m_items.begin(), cache->m_items, iter->second);
+				value = iter->second->value;
+				cache->m_hits++;
+				hit = true;
+			}
+			else
+				cache->m_misses++;
+		}
+
+		if (hit){
+			ValueDeserializer reader(value.data(), value.size());
+			v8::Handle<v8::Value> res = reader.read();
+			if (!res.IsEmpty())
+				return scope.Close(res);
+		}
+
+		v8::TryCatch tryCatch;
+		v8::Handle<v8::Value> res = cache->m_cb(args);
+		if (tryCatch.HasCaught())
+			return scope.Close(tryCatch.ReThrow());
+		if (res.IsEmpty())
+			return res;
+
+		ValueSerializer& writer = serializer();
+		if (writer.write(res))
+			cache->store(key, writer.data(), writer.size());
+		else {
+			boost::lock_guard<boost::mutex> guard(cache->m_lock);
+			cache->m_uncacheable++;
+		}
+		return scope.Close(res);
+	}
+
+	void MemoCache::store(const std::string& key, const char* data, size_t size){
+		boost::lock_guard<boost::mutex> guard(m_lock);
+		if (m_maxBytes && key.size() + size > m_maxBytes){
+			m_uncacheable++;
+			return;
+		}
+		ItemMap::iterator iter = m_map.find(key);
+		if (iter != m_map.end()){
+			//Stored by a nested call meanwhile
+			m_bytes -= iter->second->key.size() + iter->second->value.size();
+			m_items.erase(iter->second);
+			m_map.erase(iter);
+		}
+
+		m_items.push_front(Item());
+		Item& item = m_items.front();
+		item.key = key;
+		item.value.assign(data ? data : "", size);
+		m_map[key] = m_items.begin();
+		m_bytes += key.size() + size;
+		evict();
+	}
+
+	//Drop least recently used items until the cache fits its limits
+	void MemoCache::evict(){
+		while (!m_items.empty() && (m_items.size() > m_maxEntries || (m_maxBytes && m_bytes > m_maxBytes))){
+			Item& last = m_items.back();
+			m_bytes -= last.key.size() + last.value.size();
+			m_map.erase(last.key);
+			m_items.pop_back();
+			m_evictions++;
+		}
+	}
+
+	void MemoCache::clear(){
+		boost::lock_guard<boost::mutex> guard(m_lock);
+		m_items.clear();
+		m_map.clear();
+		m_bytes = 0;
+		m_hits = m_misses = m_uncacheable = m_evictions = 0;
+	}
+
+	MemoStats MemoCache::stats(){
+		boost::lock_guard<boost::mutex> guard(m_lock);
+		MemoStats s;
+		s.name = m_name;
+		s.hits = m_hits;
+		s.misses = m_misses;
+		s.uncacheable = m_uncacheable;
+		s.evictions = m_evictions;
+		s.entries = m_items.size();
+		s.bytes = m_bytes;
+		return s;
+	}
+
+	void MemoCache::clearAll(){
+		boost::lock_guard<boost::mutex> guard(registryLock());
+		for (size_t k = 0; k < registry().size(); k++)
+			registry()[k]->clear();
+	}
+
+	void MemoCache::snapshot(std::vector<MemoStats>& out){
+		boost::lock_guard<boost::mutex> guard(registryLock());
+		out.clear();
+		for (size_t k = 0; k < registry().size(); k++)
+			out.push_back(registry()[k]->stats());
+	}
+
+	v8::Handle<v8::Value> MemoCache::jsMemoStats(const v8::Arguments& args){
+		if (args.Length() > 0){
+			if (args[0]->IsString() && std::string(*v8::String::Utf8Value(args[0])) == "clear")
+				clearAll();
+			return v8::Undefined();
+		}
+
+		v8::HandleScope scope;
+		std::vector<MemoStats> snaps;
+		snapshot(snaps);
+		v8::Local<v8::Object> res = v8::Object::New();
+		for (size_t k = 0; k < snaps.size(); k++){
+			const MemoStats& s = snaps[k];
+			uint64 lookups = s.hits + s.misses;
+			v8::Local<v8::Object> o = v8::Object::New();
+			o->Set(v8::String::NewSymbol("hits"), v8::Number::New((double)s.hits));
+			o->Set(v8::String::NewSymbol("misses"), v8::Number::New((double)s.misses));
+			o->Set(v8::String::NewSymbol("hitRate"), v8::Number::New(lookups ? (double)s.hits / (double)lookups : 0.0));
+			o->Set(v8::String::NewSymbol("uncacheable"), v8::Number::New((double)s.uncacheable));
+			o->Set(v8::String::NewSymbol("evictions"), v8::Number::New((double)s.evictions));
+			o->Set(v8::String::NewSymbol("entries"), v8::Number::New((double)s.entries));
+			o->Set(v8::String::NewSymbol("bytes"), v8::Number::New((double)s.bytes));
+			res->Set(v8::String::New(s.name.c_str()), o);
+		}
+		return scope.Close(res);
+	}
+}
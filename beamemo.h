@@ -0,0 +1,80 @@
+#ifndef __BEAMEMO_H__
+#define __BEAMEMO_H__
+
+//Memoization of pure exposed methods.
+//A method exposed with exposePureMethod() gets a bounded LRU cache. The key is built from the arguments
+//(undefined, null, booleans, numbers, strings and arrays of these); the result is kept as a structured clone
+//(see beaclone.h) and rebuilt in the calling context on a hit, so each call still gets its own value.
+//Calls with other arguments, calls which throw and results which cannot be cloned are not cached.
+//Pure means the result depends on the arguments only. For prototype methods (ExposedClass) the receiver is part of
+//the key: each object gets an id, kept as a hidden value, so two objects never share entries. The object must not
+//change in a way that changes the method's result.
+
+#include <v8.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <boost/unordered_map.hpp>
+#include <boost/thread/mutex.hpp>
+#include "beaplatform.h"
+
+namespace bea{
+
+	struct MemoStats{
+		std::string name;
+		uint64 hits, misses, uncacheable, evictions;
+		size_t entries, bytes;
+	};
+
+	class MemoCache{
+		struct Item{
+			std::string key;
+			std::string value;	//Serialized result
+		};
+		typedef std::list<Item> ItemList;
+		typedef boost::unordered_map<std::string, ItemList::iterator> ItemMap;
+
+		std::string m_name;
+		v8::InvocationCallback m_cb;
+		size_t m_maxEntries;
+		size_t m_maxBytes;
+		bool m_keyThis;			//The receiver is part of the key
+		ItemList m_items;		//Most recently used first
+		ItemMap m_map;
+		size_t m_bytes;
+		uint64 m_hits, m_misses, m_uncacheable, m_evictions;
+		boost::mutex m_lock;
+
+		MemoCache(const std::string& name, v8::InvocationCallback cb, size_t maxEntries, size_t maxBytes, bool keyThis);
+
+		static std::vector<MemoCache*>& registry();
+		static boost::mutex& registryLock();
+
+		void store(const std::string& key, const char* data, size_t size);
+		void evict();
+
+	public:
+		//Wrap an exposed callback with a cache of at most maxEntries results and maxBytes of keys and results
+		//(0: no byte limit). keyThis: results also depend on the receiver. The cache lives for the life of the process;
+		//contexts exposing the same callback under the same name (a reload, a recycled context) share it.
+		static v8::Handle<v8::FunctionTemplate> instrument(const std::string& name, v8::InvocationCallback cb,
+			size_t maxEntries, size_t maxBytes, bool keyThis = false);
+		static v8::Handle<v8::Value> trampoline(const v8::Arguments& args);
+
+		//Cache key of the arguments (and of the receiver, with keyThis); false if an argument cannot be part of a key
+		static bool makeKey(const v8::Arguments& args, std::string& key, bool keyThis = false);
+
+		void clear();
+		MemoStats stats();
+
+		static void clearAll();
+		static void snapshot(std::vector<MemoStats>& out);
+
+		//Javascript: memoStats() returns { "Class.method": {hits, misses, hitRate, ...}, ... };
+		//memoStats('clear') empties every cache
+		static v8::Handle<v8::Value> jsMemoStats(const v8::Arguments& args);
+	};
+}
+
+#endif //__BEAMEMO_H__
@@ -0,0 +1,41 @@
+#ifndef __BEAPLATFORM_H__
+#define __BEAPLATFORM_H__
+
+//Small platform helpers shared by the bea runtime, instrumentation and benchmarks
+
+#include <boost/cstdint.hpp>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#if defined(_MSC_VER)
+#define BEA_THREAD_LOCAL __declspec(thread)
+#else
+#define BEA_THREAD_LOCAL __thread
+#endif
+
+namespace bea{
+
+	typedef boost::uint64_t uint64;
+
+	//Monotonic time in nanoseconds
+	inline uint64 nowNs(){
+#if defined(_WIN32)
+		static LARGE_INTEGER freq = {0};
+		if (freq.QuadPart == 0)
+			QueryPerformanceFrequency(&freq);
+		LARGE_INTEGER t;
+		QueryPerformanceCounter(&t);
+		return (uint64)((double)t.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64)ts.tv_sec * 1000000000ULL + (uint64)ts.tv_nsec;
+#endif
+	}
+}
+
+#endif //__BEAPLATFORM_H__
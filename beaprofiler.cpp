@@ -0,0 +1,176 @@
+#include "beaprofiler.h"
+#include "beajson.h"
+#include "beaplatform.h"
+#include <stdio.h>
+#include <map>
+#include <sstream>
+#include <v8-profiler.h>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+
+namespace bea{
+
+	//Start time of the running profiles, for the startTime/endTime of the .cpuprofile
+	static std::map<std::string, uint64>& profileStarts(){
+		static std::map<std::string, uint64> s_starts;
+		return s_starts;
+	}
+
+	static boost::mutex& profileLock(){
+		static boost::mutex s_lock;
+		return s_lock;
+	}
+
+	static std::string utf8(v8::Handle<v8::Value> v){
+		v8::String::Utf8Value s(v);
+		return *s ? std::string(*s, s.length()) : std::string();
+	}
+
+	//Writes heap snapshot chunks as V8 serializes them
+	class FileOutputStream : public v8::OutputStream{
+		FILE* m_file;
+		bool m_failed;
+	public:
+		FileOutputStream(FILE* file): m_file(file), m_failed(false){}
+		void EndOfStream(){}
+		int GetChunkSize(){
+			return 64 * 1024;
+		}
+		WriteResult WriteAsciiChunk(char* data, int size){
+			if (fwrite(data, 1, size, m_file) != (size_t)size){
+				m_failed = true;
+				return kAbort;
+			}
+			return kContinue;
+		}
+		bool failed(){
+			return m_failed;
+		}
+	};
+
+	//One node of the call tree, in the .cpuprofile layout
+	static void writeNode(JSONWriter& w, const v8::CpuProfileNode* node, int& nextId){
+		w.beginObject();
+		w.key("functionName"); w.value(utf8(node->GetFunctionName()));
+		w.key("scriptId"); w.value(std::string("0"));
+		w.key("url"); w.value(utf8(node->GetScriptResourceName()));
+		w.key("lineNumber"); w.value((long long)node->GetLineNumber());
+		w.key("columnNumber"); w.value(0LL);
+		w.key("hitCount"); w.value((long long)node->GetSelfSamplesCount());
+		w.key("selfTime"); w.value(node->GetSelfTime());
+		w.key("totalTime"); w.value(node->GetTotalTime());
+		w.key("callUID"); w.value((unsigned long long)node->GetCallUid());
+		w.key("id"); w.value((long long)nextId++);
+		w.key("children");
+		w.beginArray();
+		for (int k = 0; k < node->GetChildrenCount(); k++)
+			writeNode(w, node->GetChild(k), nextId);
+		w.endArray();
+		w.endObject();
+	}
+
+	void Profiler::startCpuProfile(const std::string& title, int samplingIntervalUs){
+		if (samplingIntervalUs > 0){
+			std::stringstream s;
+			s << "--cpu_profiler_sampling_interval=" << samplingIntervalUs;
+			std::string flags = s.str();
+			v8::V8::SetFlagsFromString(flags.c_str(), (int)flags.size());
+		}
+		{
+			boost::lock_guard<boost::mutex> guard(profileLock());
+			profileStarts()[title] = nowNs();
+		}
+		v8::HandleScope scope;
+		v8::CpuProfiler::StartProfiling(v8::String::New(title.c_str()));
+	}
+
+	bool Profiler::stopCpuProfile(const std::string& title, const char* fileName, v8::Handle<v8::Value> securityToken){
+		v8::HandleScope scope;
+		uint64 endNs = nowNs();
+		uint64 startNs = endNs;
+		{
+			boost::lock_guard<boost::mutex> guard(profileLock());
+			std::map<std::string, uint64>::iterator iter = profileStarts().find(title);
+			if (iter != profileStarts().end()){
+				startNs = iter->second;
+				profileStarts().erase(iter);
+			}
+		}
+
+		const v8::CpuProfile* profile = v8::CpuProfiler::StopProfiling(v8::String::New(title.c_str()), securityToken);
+		if (!profile)
+			return false;
+
+		JSONWriter w;
+		int nextId = 1;
+		w.beginObject();
+		w.key("head");
+		writeNode(w, profile->GetTopDownRoot(), nextId);
+		w.key("startTime"); w.value((double)startNs / 1e9);
+		w.key("endTime"); w.value((double)endNs / 1e9);
+		w.key("title"); w.value(title);
+		w.endObject();
+		const_cast<v8::CpuProfile*>(profile)->Delete();
+
+		FILE* file = fopen(fileName, "wb");
+		if (!file)
+			return false;
+		const std::string& json = w.str();
+		bool ok = fwrite(json.data(), 1, json.size(), file) == json.size();
+		return fclose(file) == 0 && ok;
+	}
+
+	bool Profiler::writeHeapSnapshot(const char* fileName, const std::string& title){
+		v8::HandleScope scope;
+		FILE* file = fopen(fileName, "wb");
+		if (!file)
+			return false;
+
+		const v8::HeapSnapshot* snapshot = v8::HeapProfiler::TakeSnapshot(v8::String::New(title.c_str()));
+		bool ok = snapshot != NULL;
+		if (ok){
+			FileOutputStream stream(file);
+			snapshot->Serialize(&stream, v8::HeapSnapshot::kJSON);
+			ok = !stream.failed();
+			const_cast<v8::HeapSnapshot*>(snapshot)->Delete();
+		}
+		return fclose(file) == 0 && ok;
+	}
+
+	v8::Handle<v8::ObjectTemplate> Profiler::objectTemplate(){
+		v8::HandleScope scope;
+		v8::Handle<v8::ObjectTemplate> tmpl = v8::ObjectTemplate::New();
+		tmpl->Set(v8::String::NewSymbol("start"), v8::FunctionTemplate::New(jsStart));
+		tmpl->Set(v8::String::NewSymbol("stop"), v8::FunctionTemplate::New(jsStop));
+		tmpl->Set(v8::String::NewSymbol("heapSnapshot"), v8::FunctionTemplate::New(jsHeapSnapshot));
+		return scope.Close(tmpl);
+	}
+
+	v8::Handle<v8::Value> Profiler::jsStart(const v8::Arguments& args){
+		METHOD_BEGIN(1);
+		std::string title = bea::Convert<std::string>::FromJS(args[0], 0);
+		int interval = bea::Optional<int>::FromJS(args, 1, 0);
+		startCpuProfile(title, interval);
+		METHOD_END();
+		return v8::Undefined();
+	}
+
+	//Only the calling context's functions are kept
+	v8::Handle<v8::Value> Profiler::jsStop(const v8::Arguments& args){
+		METHOD_BEGIN(2);
+		std::string title = bea::Convert<std::string>::FromJS(args[0], 0);
+		std::string fileName = bea::Convert<std::string>::FromJS(args[1], 1);
+		v8::Handle<v8::Value> token = v8::Context::GetCalling()->GetSecurityToken();
+		return v8::Boolean::New(stopCpuProfile(title, fileName.c_str(), token));
+		METHOD_END();
+		return v8::Undefined();
+	}
+
+	v8::Handle<v8::Value> Profiler::jsHeapSnapshot(const v8::Arguments& args){
+		METHOD_BEGIN(1);
+		std::string fileName = bea::Convert<std::string>::FromJS(args[0], 0);
+		return v8::Boolean::New(writeHeapSnapshot(fileName.c_str()));
+		METHOD_END();
+		return v8::Undefined();
+	}
+}
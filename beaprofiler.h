@@ -0,0 +1,35 @@
+#ifndef __BEAPROFILER_H__
+#define __BEAPROFILER_H__
+
+//CPU profiles and heap snapshots of running scripts, written in the formats Chrome DevTools loads
+//(.cpuprofile and .heapsnapshot). Exposed methods are labeled with their exposed names ("Class.method"),
+//so native time and retained objects can be attributed to the bindings.
+
+#include <string>
+#include <v8.h>
+
+namespace bea{
+
+	class Profiler{
+	public:
+		//Start a CPU profile. samplingIntervalUs > 0 sets V8's sampling interval first (the
+		//--cpu_profiler_sampling_interval flag; V8 builds without the flag keep their default).
+		static void startCpuProfile(const std::string& title, int samplingIntervalUs = 0);
+
+		//Stop a CPU profile and write it to fileName as a .cpuprofile. Only the functions of contexts with
+		//securityToken are kept, if one is given.
+		static bool stopCpuProfile(const std::string& title, const char* fileName, 
+			v8::Handle<v8::Value> securityToken = v8::Handle<v8::Value>());
+
+		//Take a heap snapshot and write it to fileName as a .heapsnapshot
+		static bool writeHeapSnapshot(const char* fileName, const std::string& title = "snapshot");
+
+		//Javascript: profiler.start(title, [intervalUs]), profiler.stop(title, fileName), profiler.heapSnapshot(fileName)
+		static v8::Handle<v8::ObjectTemplate> objectTemplate();
+		static v8::Handle<v8::Value> jsStart(const v8::Arguments& args);
+		static v8::Handle<v8::Value> jsStop(const v8::Arguments& args);
+		static v8::Handle<v8::Value> jsHeapSnapshot(const v8::Arguments& args);
+	};
+}
+
+#endif //__BEAPROFILER_H__
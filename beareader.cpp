@@ -0,0 +1,375 @@
+#include "beareader.h"
+#include <string.h>
+#include <boost/thread/locks.hpp>
+#include <boost/filesystem/operations.hpp>
+
+DECLARE_EXPOSED_CLASS(bea::FileReader);
+
+namespace bea{
+
+	ChunkPool::~ChunkPool(){
+		for (size_t k = 0; k < chunks.size(); k++){
+			delete[] chunks[k]->data;
+			delete chunks[k];
+		}
+	}
+
+	ChunkPool::Chunk* ChunkPool::add(size_t chunkSize){
+		Chunk* c = new Chunk();
+		c->data = new char[chunkSize];
+		c->size = 0;
+		c->views = 0;
+		c->released = false;
+		chunks.push_back(c);
+		return c;
+	}
+
+	void ChunkPool::release(Chunk* c){
+		if (c->views > 0)
+			c->released = true;
+		else
+			free.push_back(c);
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+
+	FileReader::FileReader(size_t chunkSize, size_t readAhead): m_file(NULL), m_pool(new ChunkPool()), m_current(NULL), m_pos(0),
+		m_base(0), m_size(0), m_done(true), m_failed(false), m_stop(false){
+		m_chunkSize = chunkSize > 0 ? chunkSize : (size_t)DefaultChunkSize;
+		//One chunk is held by the consumer, the reader needs at least one more
+		m_readAhead = readAhead > 1 ? readAhead : 2;
+	}
+
+	FileReader::~FileReader(){
+		close();
+	}
+
+	bool FileReader::open(const char* fileName){
+		close();
+
+		m_file = fopen(fileName, "rb");
+		if (!m_file)
+			return false;
+		//The chunks are the buffers
+		setvbuf(m_file, NULL, _IONBF, 0);
+
+		boost::system::error_code ec;
+		boost::uintmax_t size = boost::filesystem::file_size(fileName, ec);
+		m_size = ec ? 0 : (boost::uint64_t)size;
+		m_fileName = fileName;
+
+		{
+			boost::lock_guard<boost::mutex> guard(m_pool->lock);
+			while (m_pool->chunks.size() < m_readAhead)
+				m_pool->add(m_chunkSize);
+			//Chunks still viewed by the script of an earlier file are freed by their views
+			m_pool->free.clear();
+			for (size_t k = 0; k < m_pool->chunks.size(); k++)
+				m_pool->release(m_pool->chunks[k]);
+		}
+		m_ready.clear();
+		m_current = NULL;
+		m_pos = 0;
+		m_base = 0;
+		m_done = false;
+		m_failed = false;
+		m_stop = false;
+		m_thread = boost::thread(&FileReader::readAhead, this);
+		return true;
+	}
+
+	void FileReader::close(){
+		if (m_thread.joinable()){
+			{
+				boost::lock_guard<boost::mutex> guard(m_pool->lock);
+				m_stop = true;
+			}
+			m_pool->cond.notify_all();
+			m_thread.join();
+		}
+		if (m_file){
+			fclose(m_file);
+			m_file = NULL;
+		}
+		m_ready.clear();
+		m_current = NULL;
+		m_pos = 0;
+		m_done = true;
+		m_carry.clear();
+	}
+
+	void FileReader::readAhead(){
+		ChunkPool& pool = *m_pool;
+		for (;;){
+			Chunk* c;
+			{
+				boost::unique_lock<boost::mutex> lock(pool.lock);
+				while (pool.free.empty() && !m_stop)
+					pool.cond.wait(lock);
+				if (m_stop)
+					return;
+				c = pool.free.back();
+				pool.free.pop_back();
+				pool.filling = true;
+			}
+
+			c->size = fread(c->data, 1, m_chunkSize, m_file);
+			bool end = c->size < m_chunkSize;
+			{
+				boost::lock_guard<boost::mutex> guard(pool.lock);
+				pool.filling = false;
+				if (c->size > 0)
+					m_ready.push_back(c);
+				else
+					pool.free.push_back(c);
+				if (end){
+					m_done = true;
+					m_failed = ferror(m_file) != 0;
+				}
+			}
+			pool.cond.notify_all();
+			if (end)
+				return;
+		}
+	}
+
+	bool FileReader::nextChunk(){
+		ChunkPool& pool = *m_pool;
+		boost::unique_lock<boost::mutex> lock(pool.lock);
+		if (m_current){
+			m_base += m_current->size;
+			pool.release(m_current);
+			m_current = NULL;
+			m_pos = 0;
+			pool.cond.notify_all();
+		}
+
+		if (m_ready.empty() && !m_done){
+			//Every chunk is held by a view: add one rather than wait for the script to drop them
+			if (pool.free.empty() && !pool.filling){
+				pool.free.push_back(pool.add(m_chunkSize));
+				pool.cond.notify_all();
+			}
+
+			BEA_TRACE_SPAN("io", "FileReader.wait");
+			//Let other threads run script while this one waits for the disk
+			if (v8::Locker::IsLocked()){
+				lock.unlock();
+				{
+					v8::Unlocker unlocker;
+					boost::unique_lock<boost::mutex> wait(pool.lock);
+					while (m_ready.empty() && !m_done)
+						pool.cond.wait(wait);
+				}
+				lock.lock();
+			}
+			else {
+				while (m_ready.empty() && !m_done)
+					pool.cond.wait(lock);
+			}
+		}
+
+		if (m_ready.empty())
+			return false;
+		m_current = m_ready.front();
+		m_ready.pop_front();
+		return true;
+	}
+
+	bool FileReader::eof(){
+		if (m_current && m_pos < m_current->size)
+			return false;
+		boost::lock_guard<boost::mutex> guard(m_pool->lock);
+		return m_done && m_ready.empty();
+	}
+
+	bool FileReader::failed(){
+		boost::lock_guard<boost::mutex> guard(m_pool->lock);
+		return m_failed;
+	}
+
+	bool FileReader::readChunk(const char*& data, size_t& size){
+		if (!m_current || m_pos >= m_current->size){
+			if (!nextChunk())
+				return false;
+		}
+		data = m_current->data + m_pos;
+		size = m_current->size - m_pos;
+		m_pos = m_current->size;
+		return true;
+	}
+
+	bool FileReader::readLine(const char*& line, size_t& size){
+		bool carried = false;
+		m_carry.clear();
+		for (;;){
+			if (!m_current || m_pos >= m_current->size){
+				if (!nextChunk()){
+					//Last line without a line ending
+					if (!carried)
+						return false;
+					line = m_carry.data();
+					size = m_carry.size();
+					break;
+				}
+			}
+
+			const char* start = m_current->data + m_pos;
+			size_t avail = m_current->size - m_pos;
+			const char* nl = (const char*)memchr(start, '\n', avail);
+			if (nl){
+				size_t len = (size_t)(nl - start);
+				m_pos += len + 1;
+				if (carried){
+					m_carry.append(start, len);
+					line = m_carry.data();
+					size = m_carry.size();
+				}
+				else {
+					//Within the chunk: no copy
+					line = start;
+					size = len;
+				}
+				break;
+			}
+			m_carry.append(start, avail);
+			carried = true;
+			m_pos = m_current->size;
+		}
+
+		if (size > 0 && line[size - 1] == '\r')
+			size--;
+		return true;
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+
+	v8::Handle<v8::Value> FileReader::New(const v8::Arguments& args){
+		//ExposedClass<T>::ToJS() passes the wrapped pointer as an External
+		if (args.Length() == 1 && args[0]->IsExternal())
+			return args[0];
+
+		METHOD_BEGIN(1);
+		std::string fileName = bea::Convert<std::string>::FromJS(args[0], 0);
+		int chunkSize = bea::Optional<int>::FromJS(args, 1, DefaultChunkSize);
+		int readAhead = bea::Optional<int>::FromJS(args, 2, DefaultReadAhead);
+		FileReader* reader = new FileReader(chunkSize > 0 ? (size_t)chunkSize : 0, readAhead > 0 ? (size_t)readAhead : 0);
+		if (!reader->open(fileName.c_str())){
+			delete reader;
+			std::string msg = "Cannot open " + fileName;
+			return v8::ThrowException(v8::Exception::Error(v8::String::New(msg.c_str())));
+		}
+		return v8::External::New(reader);
+		METHOD_END();
+		return v8::Undefined();
+	}
+
+	void FileReader::Destroy(v8::Handle<v8::Value> val){
+		delete static_cast<FileReader*>(val->ToObject()->GetPointerFromInternalField(0));
+	}
+
+	//The view is gone: its chunk can be refilled once the consumer has moved past it
+	void FileReader::ReleaseView(v8::Persistent<v8::Value> value, void* data){
+		ChunkView* view = static_cast<ChunkView*>(data);
+		{
+			boost::lock_guard<boost::mutex> guard(view->pool->lock);
+			Chunk* c = view->chunk;
+			if (--c->views == 0 && c->released){
+				c->released = false;
+				view->pool->free.push_back(c);
+			}
+		}
+		view->pool->cond.notify_all();
+		delete view;
+		value.Dispose();
+	}
+
+	v8::Handle<v8::Value> FileReader::jsReadChunk(const v8::Arguments& args){
+		METHOD_BEGIN(0);
+		FileReader* _this = bea::ExposedClass<FileReader>::FromJS(args.This(), 0);
+		const char* data;
+		size_t size;
+		if (!_this->readChunk(data, size))
+			return v8::Null();
+
+		v8::HandleScope scope;
+		v8::Local<v8::Object> view = v8::Object::New();
+		view->SetIndexedPropertiesToExternalArrayData((void*)data, v8::kExternalUnsignedByteArray, (int)size);
+
+		//The chunk is not refilled, nor its pool freed, until the view is collected
+		ChunkView* ref = new ChunkView();
+		ref->pool = _this->m_pool;
+		ref->chunk = _this->m_current;
+		{
+			boost::lock_guard<boost::mutex> guard(_this->m_pool->lock);
+			ref->chunk->views++;
+		}
+		v8::Persistent<v8::Object>::New(view).MakeWeak(ref, ReleaseView);
+		return scope.Close(view);
+		METHOD_END();
+		return v8::Undefined();
+	}
+
+	v8::Handle<v8::Value> FileReader::jsReadLine(const v8::Arguments& args){
+		METHOD_BEGIN(0);
+		FileReader* _this = bea::ExposedClass<FileReader>::FromJS(args.This(), 0);
+		const char* line;
+		size_t size;
+		if (!_this->readLine(line, size))
+			return v8::Null();
+		return v8::String::New(line, (int)size);
+		METHOD_END();
+		return v8::Undefined();
+	}
+
+	v8::Handle<v8::Value> FileReader::jsReadLines(const v8::Arguments& args){
+		METHOD_BEGIN(0);
+		FileReader* _this = bea::ExposedClass<FileReader>::FromJS(args.This(), 0);
+		int max = bea::Optional<int>::FromJS(args, 0, 1024);
+
+		v8::HandleScope scope;
+		v8::Local<v8::Array> lines = v8::Array::New();
+		const char* line;
+		size_t size;
+		for (int k = 0; k < max && _this->readLine(line, size); k++)
+			lines->Set(k, v8::String::New(line, (int)size));
+		return scope.Close(lines);
+		METHOD_END();
+		return v8::Undefined();
+	}
+
+	v8::Handle<v8::Value> FileReader::jsClose(const v8::Arguments& args){
+		METHOD_BEGIN(0);
+		bea::ExposedClass<FileReader>::FromJS(args.This(), 0)->close();
+		METHOD_END();
+		return v8::Undefined();
+	}
+
+	v8::Handle<v8::Value> FileReader::GetEof(v8::Local<v8::String> prop, const v8::AccessorInfo& info){
+		return v8::Boolean::New(bea::ExposedClass<FileReader>::FromJS(info.Holder(), 0)->eof());
+	}
+
+	v8::Handle<v8::Value> FileReader::GetSize(v8::Local<v8::String> prop, const v8::AccessorInfo& info){
+		return v8::Number::New((double)bea::ExposedClass<FileReader>::FromJS(info.Holder(), 0)->size());
+	}
+
+	v8::Handle<v8::Value> FileReader::GetPosition(v8::Local<v8::String> prop, const v8::AccessorInfo& info){
+		return v8::Number::New((double)bea::ExposedClass<FileReader>::FromJS(info.Holder(), 0)->position());
+	}
+
+	void FileReader::expose(v8::Handle<v8::Object> target){
+		if (ExposedClass<FileReader>::Instance == NULL){
+			ExposedClass<FileReader>* obj = EXPOSE_CLASS(bea::FileReader, "FileReader");
+			obj->setConstructor(New);
+			obj->setDestructor(Destroy);
+			obj->exposeMethod("readChunk", jsReadChunk);
+			obj->exposeMethod("readLine", jsReadLine);
+			obj->exposeMethod("readLines", jsReadLines);
+			obj->exposeMethod("close", jsClose);
+			obj->exposeProperty("eof", GetEof, NULL);
+			obj->exposeProperty("size", GetSize, NULL);
+			obj->exposeProperty("position", GetPosition, NULL);
+		}
+		ExposedClass<FileReader>::Instance->exposeTo(target);
+	}
+}
@@ -0,0 +1,133 @@
+#ifndef __BEAREADER_H__
+#define __BEAREADER_H__
+
+//Streaming file reader.
+//A background thread reads the file ahead into a fixed number of fixed-size chunks; the consumer takes chunks
+//(or lines) in order and hands each chunk back when it moves on. The reader stalls when every chunk is waiting to
+//be consumed, so a file of any size is processed in chunkSize * readAhead bytes.
+//Exposed to javascript as the FileReader class. A chunk returned by readChunk() is not refilled while its view is
+//alive; if the script keeps views on every chunk, the next read adds a chunk rather than wait forever.
+
+#include <v8.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include "bea.h"
+
+namespace bea{
+
+	//The chunks of a reader and the lock guarding them. Chunk views share it with the reader, so a view can
+	//outlive the reader which filled it.
+	struct ChunkPool{
+		struct Chunk{
+			char* data;
+			size_t size;
+			int views;		//Live javascript views on the chunk
+			bool released;	//Handed back by the consumer; becomes free when the last view goes
+		};
+
+		std::vector<Chunk*> chunks;		//All chunks
+		std::vector<Chunk*> free;		//Ready to be filled by the reader thread
+		bool filling;					//The reader thread is filling a chunk
+		boost::mutex lock;
+		boost::condition_variable cond;
+
+		ChunkPool(): filling(false){}
+		~ChunkPool();
+
+		Chunk* add(size_t chunkSize);
+		//Hand a chunk back (lock held): free now, or when its views are gone
+		void release(Chunk* c);
+	};
+
+	class FileReader{
+		typedef ChunkPool::Chunk Chunk;
+
+		//Weak callback data of a readChunk() view
+		struct ChunkView{
+			boost::shared_ptr<ChunkPool> pool;
+			Chunk* chunk;
+		};
+
+		std::string m_fileName;
+		FILE* m_file;
+		size_t m_chunkSize;
+		size_t m_readAhead;
+		boost::shared_ptr<ChunkPool> m_pool;
+		std::deque<Chunk*> m_ready;		//Filled, in file order
+		Chunk* m_current;				//Being consumed
+		size_t m_pos;					//Consumed bytes of m_current
+		boost::uint64_t m_base;			//File offset of m_current
+		boost::uint64_t m_size;
+		bool m_done;					//The reader thread reached the end of the file (or failed)
+		bool m_failed;
+		bool m_stop;
+		std::string m_carry;			//Line spanning chunks
+		boost::thread m_thread;
+
+		void readAhead();
+		//Hand back the current chunk and take the next one; false at the end of the file
+		bool nextChunk();
+
+		static v8::Handle<v8::Value> New(const v8::Arguments& args);
+		static void Destroy(v8::Handle<v8::Value> val);
+		static void ReleaseView(v8::Persistent<v8::Value> value, void* data);
+		static v8::Handle<v8::Value> jsReadChunk(const v8::Arguments& args);
+		static v8::Handle<v8::Value> jsReadLine(const v8::Arguments& args);
+		static v8::Handle<v8::Value> jsReadLines(const v8::Arguments& args);
+		static v8::Handle<v8::Value> jsClose(const v8::Arguments& args);
+		static v8::Handle<v8::Value> GetEof(v8::Local<v8::String> prop, const v8::AccessorInfo& info);
+		static v8::Handle<v8::Value> GetSize(v8::Local<v8::String> prop, const v8::AccessorInfo& info);
+		static v8::Handle<v8::Value> GetPosition(v8::Local<v8::String> prop, const v8::AccessorInfo& info);
+
+	public:
+		enum {DefaultChunkSize = 1024 * 1024, DefaultReadAhead = 4};
+
+		FileReader(size_t chunkSize = DefaultChunkSize, size_t readAhead = DefaultReadAhead);
+		~FileReader();
+
+		//Open the file and start reading ahead
+		bool open(const char* fileName);
+		//Stop the reader thread and close the file. The chunk memory is kept until the reader and its views are gone.
+		void close();
+
+		bool isOpen(){
+			return m_file != NULL;
+		}
+		//Everything has been consumed
+		bool eof();
+		//A read error ended the file early
+		bool failed();
+		boost::uint64_t size(){
+			return m_size;
+		}
+		//Bytes consumed so far
+		boost::uint64_t position(){
+			return m_base + m_pos;
+		}
+		const std::string& fileName(){
+			return m_fileName;
+		}
+
+		//The rest of the current chunk, or the next chunk. data is valid until the next read.
+		bool readChunk(const char*& data, size_t& size);
+		//The next line, without the line ending. line is valid until the next read.
+		bool readLine(const char*& line, size_t& size);
+
+		//Adds the FileReader class to target:
+		//	new FileReader(fileName, [chunkSize], [readAhead])
+		//	readChunk(): Uint8 external array over the reader's chunk (not reused while the array is alive), or null at the end
+		//	readLine(): string, or null at the end
+		//	readLines([max = 1024]): array of up to max lines, empty at the end
+		//	close(), eof, size, position
+		static void expose(v8::Handle<v8::Object> target);
+	};
+}
+
+#endif //__BEAREADER_H__
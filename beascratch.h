@@ -0,0 +1,239 @@
+#ifndef __BEASCRATCH_H__
+#define __BEASCRATCH_H__
+
+//Per-call scratch memory.
+//Each thread has an arena; METHOD_BEGIN marks it and the end of the method releases everything allocated since,
+//in one step. bea::scratch_string and bea::scratch_vector<T> arguments are converted into the arena instead of
+//the heap, so a call with string and array arguments does no malloc/free once the arena has grown to size.
+//Scratch values are only valid until the method returns: copy them (str(), vec()) to keep them.
+
+#include <stddef.h>
+#include <new>
+#include <string>
+#include <vector>
+#include <boost/type_traits/alignment_of.hpp>
+#include <boost/type_traits/has_trivial_destructor.hpp>
+#include "beaplatform.h"
+
+namespace bea{
+
+	class ScratchArena{
+		enum {FirstBlockSize = 16 * 1024};
+
+		struct Block{
+			char* data;
+			size_t size;
+		};
+
+		//Destructors to run on release, newest first; the entries live in the arena
+		struct Cleanup{
+			void (*destroy)(void* p, size_t n);
+			void* p;
+			size_t n;
+			Cleanup* next;
+		};
+
+		std::vector<Block> m_blocks;	//Kept between calls
+		size_t m_block;
+		size_t m_offset;
+		Cleanup* m_cleanups;
+
+		template<class T>
+		static void destroyArray(void* p, size_t n){
+			T* items = static_cast<T*>(p);
+			for (size_t k = 0; k < n; k++)
+				items[k].~T();
+		}
+
+		void grow(size_t size){
+			size_t blockSize = m_blocks.empty() ? (size_t)FirstBlockSize : m_blocks.back().size * 2;
+			while (blockSize < size)
+				blockSize *= 2;
+			Block b;
+			b.data = new char[blockSize];
+			b.size = blockSize;
+			m_blocks.push_back(b);
+			m_block = m_blocks.size() - 1;
+			m_offset = 0;
+		}
+
+	public:
+		struct Mark{
+			size_t block;
+			size_t offset;
+			Cleanup* cleanups;
+		};
+
+		ScratchArena(): m_block(0), m_offset(0), m_cleanups(NULL){}
+		~ScratchArena(){
+			for (size_t k = 0; k < m_blocks.size(); k++)
+				delete[] m_blocks[k].data;
+		}
+
+		//Arena of the calling thread
+		static inline ScratchArena& current(){
+			static BEA_THREAD_LOCAL ScratchArena* s_arena = NULL;
+			if (!s_arena)
+				s_arena = new ScratchArena();
+			return *s_arena;
+		}
+
+		void* alloc(size_t size, size_t align = sizeof(double)){
+			for (;;){
+				if (m_block < m_blocks.size()){
+					size_t start = (m_offset + align - 1) & ~(align - 1);
+					if (start + size <= m_blocks[m_block].size){
+						m_offset = start + size;
+						return m_blocks[m_block].data + start;
+					}
+					//Try the next kept block before adding one
+					if (m_block + 1 < m_blocks.size()){
+						m_block++;
+						m_offset = 0;
+						continue;
+					}
+				}
+				grow(size + align);
+			}
+		}
+
+		//Uninitialized room for n items of T. Unless T is trivially destructible, constructed is set to a counter the
+		//caller bumps per item built, and that many items are destroyed on release.
+		template<class T>
+		T* allocArray(size_t n, size_t*& constructed){
+			T* p = static_cast<T*>(alloc(n * sizeof(T) + 1, boost::alignment_of<T>::value));
+			constructed = NULL;
+			if (!boost::has_trivial_destructor<T>::value){
+				Cleanup* c = static_cast<Cleanup*>(alloc(sizeof(Cleanup), boost::alignment_of<Cleanup>::value));
+				c->destroy = destroyArray<T>;
+				c->p = p;
+				c->n = 0;
+				c->next = m_cleanups;
+				m_cleanups = c;
+				constructed = &c->n;
+			}
+			return p;
+		}
+
+		char* allocChars(size_t n){
+			return static_cast<char*>(alloc(n, 1));
+		}
+
+		Mark mark() const{
+			Mark m = {m_block, m_offset, m_cleanups};
+			return m;
+		}
+
+		//Free everything allocated after m was taken
+		void release(const Mark& m){
+			while (m_cleanups != m.cleanups){
+				m_cleanups->destroy(m_cleanups->p, m_cleanups->n);
+				m_cleanups = m_cleanups->next;
+			}
+			m_block = m.block;
+			m_offset = m.offset;
+		}
+
+		//Bytes held by the arena
+		size_t capacity() const{
+			size_t n = 0;
+			for (size_t k = 0; k < m_blocks.size(); k++)
+				n += m_blocks[k].size;
+			return n;
+		}
+	};
+
+	//Releases the scratch memory of a call when the method returns. Declared by METHOD_BEGIN.
+	class ScratchScope{
+		ScratchArena& m_arena;
+		ScratchArena::Mark m_mark;
+	public:
+		inline ScratchScope(): m_arena(ScratchArena::current()), m_mark(m_arena.mark()){}
+		inline ~ScratchScope(){
+			m_arena.release(m_mark);
+		}
+	};
+
+	//String argument held in the scratch arena
+	class scratch_string{
+		const char* m_data;
+		size_t m_size;
+	public:
+		scratch_string(): m_data(""), m_size(0){}
+		scratch_string(const char* data, size_t size): m_data(data), m_size(size){}
+
+		const char* c_str() const{
+			return m_data;
+		}
+		const char* data() const{
+			return m_data;
+		}
+		size_t size() const{
+			return m_size;
+		}
+		size_t length() const{
+			return m_size;
+		}
+		bool empty() const{
+			return m_size == 0;
+		}
+		char operator[](size_t index) const{
+			return m_data[index];
+		}
+		operator const char* () const{
+			return m_data;
+		}
+		//A copy that outlives the call
+		std::string str() const{
+			return std::string(m_data, m_size);
+		}
+	};
+
+	//Array argument held in the scratch arena
+	template<class T>
+	class scratch_vector{
+		T* m_data;
+		size_t m_size;
+	public:
+		typedef T value_type;
+		typedef T* iterator;
+		typedef const T* const_iterator;
+
+		scratch_vector(): m_data(NULL), m_size(0){}
+		scratch_vector(T* data, size_t size): m_data(data), m_size(size){}
+
+		size_t size() const{
+			return m_size;
+		}
+		bool empty() const{
+			return m_size == 0;
+		}
+		T& operator[](size_t index){
+			return m_data[index];
+		}
+		const T& operator[](size_t index) const{
+			return m_data[index];
+		}
+		iterator begin(){
+			return m_data;
+		}
+		iterator end(){
+			return m_data + m_size;
+		}
+		const_iterator begin() const{
+			return m_data;
+		}
+		const_iterator end() const{
+			return m_data + m_size;
+		}
+		operator T* (){
+			return m_data;
+		}
+		//A copy that outlives the call
+		std::vector<T> vec() const{
+			return std::vector<T>(m_data, m_data + m_size);
+		}
+	};
+}
+
+#endif //__BEASCRATCH_H__
@@ -1,6 +1,14 @@
 #include "beascript.h"
+#include "beashared.h"
+#include "beabufferops.h"
+#include "beaexecutor.h"
+#include "beabundle.h"
+#include "beaprofiler.h"
+#include "beareader.h"
+#include "bealazy.h"
 #include <sstream>
 #include <iostream>
+#include <cstdlib>
 #include <boost/filesystem/path.hpp>
 #include <boost/filesystem/operations.hpp>
 #include <v8.h>
@@ -40,21 +48,25 @@ namespace bea{
 		return result;
 	}
 
-	//Logs a message to the console
+	//Logs a message: log(message, [level]). Queued to the asynchronous logger, never blocks the script.
 	static v8::Handle<v8::Value> Log(const Arguments& args) {
 		if (args.Length() < 1) return v8::Undefined();
 		HandleScope scope;
 		v8::Handle<v8::Value> arg = args[0];
 		v8::String::Utf8Value value(arg);
-		//printf("Logged: %s\n", *value);
-		std::cout << "Logged: " << *value << std::endl;
+		int level = (args.Length() > 1 && args[1]->IsInt32()) ? args[1]->Int32Value() : LogInfo;
+		Logger::instance().log(level, *value, value.length());
 		return v8::Undefined();
 	}
 
 	//////////////////////////////////////////////////////////////////////////
 
 	std::string BeaContext::lastError; 
+	BeaContext::ErrorKind BeaContext::lastErrorKind = BeaContext::NoError;
+	heapLimitCallback BeaContext::m_heapLimitCb = NULL;
+	BeaContext* BeaContext::s_running = NULL;
 	boost::filesystem::path _BeaScript::scriptPath;
+	ScriptBundle* _BeaScript::s_bundle = NULL;
 
 	
 	std::string toString(v8::Handle<v8::Value> v){
@@ -114,15 +126,15 @@ namespace bea{
 		//Add the script path to it
 		boost::filesystem::path absolutePath = parentPath / fileName; 
 
-		if (!absolutePath.has_extension() && !boost::filesystem::exists(absolutePath))
+		if (!absolutePath.has_extension() && !sourceExists(absolutePath.string()))
 			absolutePath.replace_extension(".js");
 
 		HandleScope scope; 
 		v8::Local<v8::Value> result;
 		v8::Handle<v8::String> source;
 
-		if (boost::filesystem::exists(absolutePath))
-			source = ReadFile(absolutePath.string().c_str());
+		if (sourceExists(absolutePath.string()))
+			source = readSource(absolutePath.string());
 
 		if (source.IsEmpty()){
 			std::stringstream s;
@@ -132,35 +144,105 @@ namespace bea{
 		return scope.Close(source); 
 	}
 
+	bool _BeaScript::useBundle(const char* fileName, const char* root){
+		delete s_bundle;
+		s_bundle = NULL;
+		if (!fileName)
+			return true;
+
+		ScriptBundle* bundle = new ScriptBundle();
+		if (!bundle->open(fileName, root)){
+			delete bundle;
+			return false;
+		}
+		s_bundle = bundle;
+		return true;
+	}
+
+	bool _BeaScript::sourceExists(const std::string& fileName){
+		return (s_bundle && s_bundle->contains(fileName)) || boost::filesystem::exists(fileName);
+	}
+
+	v8::Handle<v8::String> _BeaScript::readSource(const std::string& fileName){
+		if (s_bundle){
+			v8::Handle<v8::String> source = s_bundle->source(fileName);
+			if (!source.IsEmpty())
+				return source;
+		}
+		return ReadFile(fileName.c_str());
+	}
+
+	//Compile with the precompiled data of the bundle, if it has some for this file. 
+	//bind compiles for the current context (Script::Compile), otherwise for any context (Script::New).
+	v8::Handle<v8::Script> _BeaScript::compile(v8::Handle<v8::String> source, v8::Handle<v8::String> fileName, bool bind){
+		HandleScope scope;
+		v8::String::Utf8Value name(fileName);
+		BEA_TRACE_SPAN("compile", *name);
+		v8::ScriptData* pre = s_bundle ? s_bundle->preData(*name) : NULL;
+		v8::ScriptOrigin origin(fileName);
+		v8::Local<v8::Script> script = bind ? v8::Script::Compile(source, &origin, pre) : v8::Script::New(source, &origin, pre);
+		delete pre;
+		return scope.Close(script);
+	}
+
 
 	//Include a script file into current context
 	//Raise javascript exception if load failed 
 	v8::Handle<v8::Value> _BeaScript::include( const Arguments& args )
 	{
 		HandleScope scope; 
-		
+		v8::String::Utf8Value moduleName(args[0]);
+		BEA_TRACE_SPAN("module", *moduleName);
 
-		v8::Handle<v8::String> source = ReadFile(*v8::String::Utf8Value(args[0]));
+		v8::Handle<v8::String> source = readSource(*moduleName);
 
 		if (source.IsEmpty())
 			return v8::Null();
 
-		v8::Handle<v8::Value> result = v8::Null();
+		//Remember the module object, so the module can be re-evaluated in place when it changes
+		_BeaScript* self = dynamic_cast<_BeaScript*>(s_running);
+		if (self && self->m_watcher){
+			std::string key = FileWatcher::normalize(*v8::String::Utf8Value(args[0]));
+			//A replacement context being built must not touch the modules of the serving one
+			ModuleMap& modules = self->building() ? self->m_stagedModules : self->m_modules;
+			ModuleMap::iterator iter = modules.find(key);
+			if (iter != modules.end())
+				iter->second.Dispose();
+			modules[key] = v8::Persistent<v8::Object>::New(args[1]->ToObject());
+			self->m_watcher->addFile(key);
+		}
 
 		v8::Handle<v8::Context> context = v8::Context::GetCalling();
+		return scope.Close(runModule(source, args[0]->ToString(), args[1]->ToObject(), context));
+	}
+
+	v8::Handle<v8::Value> _BeaScript::runModule(v8::Handle<v8::String> source, v8::Handle<v8::String> fileName, 
+		v8::Handle<v8::Object> moduleArg, v8::Handle<v8::Context> parent)
+	{
+		HandleScope scope; 
+		v8::Handle<v8::Value> result = v8::Null();
+
 		v8::Handle<v8::Context> moduleContext = v8::Context::New(NULL, v8::ObjectTemplate::New());
-		moduleContext->SetSecurityToken(context->GetSecurityToken());
+		moduleContext->SetSecurityToken(parent->GetSecurityToken());
 		v8::Context::Scope context_scope(moduleContext);
 		v8::TryCatch try_catch;
-		v8::Handle<v8::Script> script = v8::Script::New(source, args[0]->ToString());
+		v8::Handle<v8::Script> script = compile(source, fileName, false);
 
 		if (script.IsEmpty()){
 			reportError(try_catch);
 		}
 		else {
 
-			CloneObject(globalSandbox, moduleContext->Global());
-			CloneObject(args[1]->ToObject(), moduleContext->Global());
+			//The sandbox of the context loading the module, which may be a replacement being built
+			v8::Handle<v8::String> sandboxKey = v8::String::NewSymbol("bea::sandbox");
+			v8::Handle<v8::Value> sandbox = parent->Global()->GetHiddenValue(sandboxKey);
+			if (sandbox.IsEmpty() || !sandbox->IsObject())
+				sandbox = globalSandbox;
+			moduleContext->Global()->SetHiddenValue(sandboxKey, sandbox);
+			CloneObject(sandbox->ToObject(), moduleContext->Global());
+			//Classes not exposed yet are not in the sandbox
+			LazyExposer::installFrom(parent->Global(), moduleContext->Global());
+			CloneObject(moduleArg, moduleContext->Global());
 
 			result = script->Run();
 
@@ -171,22 +253,26 @@ namespace bea{
 				//Copy everything back to the mod object
 				Handle<Value> mod = moduleContext->Global()->Get(v8::String::New("module"));
 				if (!mod.IsEmpty() && mod->IsObject()){
-					CloneObject(mod->ToObject(), args[1]->ToObject()); 
+					CloneObject(mod->ToObject(), moduleArg); 
 				}
 			}
 		}
-		return result;
+		return scope.Close(result);
 	}
 	
 	//Execute a string of script
 	v8::Handle<v8::Value> _BeaScript::execute( v8::Handle<v8::String> script, v8::Handle<v8::String> fileName )
 	{
 		HandleScope scope;
+#ifdef BEA_ENABLE_TRACE
+		v8::String::Utf8Value traceName(fileName);
+		BEA_TRACE_SPAN("execute", *traceName);
+#endif
 		TryCatch try_catch;
 		v8::Handle<v8::Value> result; 
 
 		// Compile the script and check for errors.
-		v8::Handle<v8::Script> compiled_script = v8::Script::Compile(script, fileName);
+		v8::Handle<v8::Script> compiled_script = compile(script, fileName, true);
 		if (compiled_script.IsEmpty()) {
 			reportError(try_catch);
 			return result;
@@ -205,21 +291,54 @@ namespace bea{
 
 	//Report the error from an exception, store it in lastError
 	void BeaContext::reportError(TryCatch& try_catch){
+		//Terminated scripts have no exception; report why they were stopped
+		if (try_catch.HasCaught() && !try_catch.CanContinue()){
+			lastErrorKind = ScriptTerminated;
+			lastError = "Script execution terminated";
+			if (s_running){
+				boost::lock_guard<boost::mutex> guard(s_running->m_terminateLock);
+				const std::string& reason = s_running->building() ? s_running->m_buildTerminationReason : s_running->m_terminationReason;
+				if (!reason.empty())
+					lastError = reason;
+			}
+			Logger::instance().log(LogError, lastError.c_str(), (int)lastError.size());
+			return;
+		}
+
+		lastErrorKind = ScriptException;
 		lastError = *v8::String::Utf8Value(try_catch.Exception());
-		if (m_logger)
-			m_logger(*v8::String::Utf8Value(try_catch.StackTrace()));
+		v8::String::Utf8Value stackTrace(try_catch.StackTrace());
+		if (*stackTrace)
+			Logger::instance().log(LogError, *stackTrace, stackTrace.length());
+		else
+			Logger::instance().log(LogError, lastError.c_str(), (int)lastError.size());
+	}
+
+	//m_logger is served by a callback sink of the logger, limited to errors as before
+	static CallbackSink* s_loggerSink = NULL;
+
+	void BeaContext::setLogCallback(logCallback cb){
+		if (s_loggerSink){
+			Logger::instance().removeSink(s_loggerSink);
+			s_loggerSink = NULL;
+		}
+		m_logger = cb;
+		if (cb){
+			s_loggerSink = new CallbackSink(cb, LogError);
+			Logger::instance().addSink(s_loggerSink);
+		}
 	}
 
-	v8::Handle<v8::Value> _BeaScript::executeScript(const char* fileName){
+	v8::Handle<v8::Value> _BeaScript::executeScript(const char* fileName, v8::Handle<v8::Context> context){
 
 		scriptPath = boost::filesystem::system_complete(fileName);
 
 		Global::scriptDir = scriptPath.parent_path().string();
 
-		Context::Scope context_scope(m_context);
+		Context::Scope context_scope(context);
 
 		HandleScope scope;
-		v8::Handle<v8::String> str = ReadFile(fileName);
+		v8::Handle<v8::String> str = readSource(fileName);
 
 		v8::Handle<v8::Value> v;
 
@@ -233,13 +352,31 @@ namespace bea{
 	//Initialize the javascript context and load a script file into it
 	bool _BeaScript::loadScript( const char* fileName )
 	{
+		BEA_TRACE_SPAN("script", fileName);
 		v8::Locker locker; 
-		if (!init())
+		RunScope running(this);
+		Watchdog::Guard deadline(this, m_timeoutMs);
+		m_mainScript = FileWatcher::normalize(fileName);
+		if (m_watcher)
+			m_watcher->addFile(m_mainScript);
+		if (!init() || lastErrorKind == ScriptTerminated){
+			//A deadline hit while loader.js ran counts like any other
+			if (deadline.disarm())
+				m_timeoutCount++;
 			return false; 
+		}
+		m_callsServed = 0;
+		m_loadedNs = nowNs();
 
 	
 		HandleScope scope; 
-		Handle<Value> v = executeScript(fileName);
+		Handle<Value> v = executeScript(fileName, m_context);
+
+		if (deadline.disarm()){
+			m_timeoutCount++;
+			if (!v.IsEmpty())
+				discardTermination();
+		}
 
 		return !v.IsEmpty();
 	}
@@ -252,6 +389,16 @@ namespace bea{
 		global->Set(v8::String::New("log"), v8::FunctionTemplate::New(Log));
 		global->Set(v8::String::New("yield"), v8::FunctionTemplate::New(yield));
 		global->Set(v8::String::New("collectGarbage"), v8::FunctionTemplate::New(collectGarbage));
+		global->Set(v8::String::New("memoryStats"), v8::FunctionTemplate::New(memoryStats));
+		global->Set(v8::String::New("sharedRegion"), v8::FunctionTemplate::New(SharedRegion::jsSharedRegion));
+		global->Set(v8::String::New("profiler"), Profiler::objectTemplate());
+		global->Set(v8::String::New("memoStats"), v8::FunctionTemplate::New(MemoCache::jsMemoStats));
+#ifdef BEA_ENABLE_STATS
+		global->Set(v8::String::New("callStats"), v8::FunctionTemplate::New(Stats::jsCallStats));
+#endif
+#ifdef BEA_ENABLE_TRACE
+		global->Set(v8::String::New("trace"), v8::FunctionTemplate::New(Tracer::jsTrace));
+#endif
 		return global;
 	}
 
@@ -260,30 +407,41 @@ namespace bea{
 	{
 		
 		lastError = "";
+		lastErrorKind = NoError;
+		return createContext(m_context, globalSandbox);
+	}
+
+	bool _BeaScript::createContext(v8::Persistent<v8::Context>& context, v8::Persistent<v8::Object>& sandbox)
+	{
 		HandleScope handle_scope;
+		installHeapHooks();
 
 		if (globalTemplate.IsEmpty()){
 			globalTemplate = v8::Persistent<v8::ObjectTemplate>::New(createGlobal());
 		}
 		
 		//Create the context
-		m_context = v8::Context::New(NULL, globalTemplate);
+		context = v8::Context::New(NULL, globalTemplate);
 
-		Context::Scope context_scope(m_context);
+		Context::Scope context_scope(context);
 
-		globalSandbox = v8::Persistent<v8::Object>::New(v8::Object::New()); 
+		sandbox = v8::Persistent<v8::Object>::New(v8::Object::New()); 
+		//Modules loaded by this context clone its sandbox (see runModule)
+		context->Global()->SetHiddenValue(v8::String::NewSymbol("bea::sandbox"), sandbox);
 
 		Handle<Value> vCmdLine = bea::Convert<std::vector<std::string> >::ToJS(cmdLine);
 
 		Handle<Object> objProcess = v8::Object::New();
 		objProcess->Set(v8::String::New("argv"), vCmdLine);
 
-		m_context->Global()->Set(v8::String::New("process"), objProcess);
+		context->Global()->Set(v8::String::New("process"), objProcess);
+		BufferOps::expose(context->Global());
+		FileReader::expose(context->Global());
 		
-		expose();
+		expose(context->Global());
 
-		executeScript("./lib/loader.js");
-		CloneObject(m_context->Global(), globalSandbox);
+		executeScript("./lib/loader.js", context);
+		CloneObject(context->Global(), sandbox);
 
 
 		return true; 
@@ -314,52 +472,118 @@ namespace bea{
 
 
 	//Call a javascript function, store the found function in a local cache for faster access
-	v8::Handle<v8::Value> BeaContext::call(const char *fnName, int argc, v8::Handle<v8::Value> argv[]){
+	v8::Handle<v8::Value> BeaContext::call(const char *fnName, int argc, v8::Handle<v8::Value> argv[], int timeoutMs){
+		BEA_TRACE_SPAN("call", fnName);
+		//lastError describes this call only
+		lastError.clear();
+		lastErrorKind = NoError;
 		
+		//Pick up changed scripts, unless this call comes from a script already running in this context
+		if (m_reloadPending && m_runDepth == 0)
+			reloadChanged();
+		pollRecycle();
+
 		HandleScope scope;
 		Context::Scope context_scope(m_context);
+		RunScope running(this);
 
-		//Lookup function in cache
 		JFunction fn;
-		CacheMap::iterator iter = m_fnCached.find(std::string(fnName));
+		if (!lookupFunction(fnName, fn))
+			return v8::False();
 
-		if (iter != m_fnCached.end())
-			fn = iter->second;
-		else {
-			//Lookup function in the script 
-			v8::Handle<v8::Value> fnv = m_context->Global()->Get(v8::String::New(fnName));
-
-			if (!fnv->IsFunction()) {
-				std::stringstream strstr;
-				strstr << "Error: " << fnName << " is not a function";
-				lastError = strstr.str();
-				return v8::False();
-			} else {
-
-				//Store found function in our cache
-				fn = Persistent<Function>::New(v8::Handle<Function>::Cast(fnv));
-				m_fnCached[std::string(fnName)] = fn;
-			}
-		}
+#ifdef BEA_ENABLE_STATS
+		BEA_STATS_CALL_SCOPE(functionStats(fnName));
+#endif
 
 		//Call the function
+		Watchdog::Guard deadline(this, timeoutMs < 0 ? m_timeoutMs : timeoutMs);
 		TryCatch try_catch;
 		v8::Handle<v8::Value> result = fn->Call(m_context->Global(), argc, argv);
+		bool timedOut = deadline.disarm();
 
-		if (result.IsEmpty())
+		if (result.IsEmpty()){
+			BEA_STATS_FAILURE();
 			reportError(try_catch);
+		}
+		else if (timedOut)
+			discardTermination();
+
+		if (timedOut)
+			m_timeoutCount++;
 
 		return scope.Close(result);
 	}
 
 
-	BeaContext::BeaContext()
-	{
+	void BeaContext::startCpuProfile(const char* title, int samplingIntervalUs){
+		Profiler::startCpuProfile(title, samplingIntervalUs);
+	}
+
+	bool BeaContext::stopCpuProfile(const char* title, const char* fileName){
+		HandleScope scope;
+		return Profiler::stopCpuProfile(title, fileName, m_context->GetSecurityToken());
+	}
 
+	bool BeaContext::writeHeapSnapshot(const char* fileName){
+		return Profiler::writeHeapSnapshot(fileName);
+	}
+
+	//Find a global function, from the cache if it was looked up before
+	bool BeaContext::lookupFunction(const char* fnName, JFunction& fn){
+		CacheMap::iterator iter = m_fnCached.find(std::string(fnName));
+		if (iter != m_fnCached.end()){
+			fn = iter->second;
+			return true;
+		}
+
+		v8::Handle<v8::Value> fnv = m_context->Global()->Get(v8::String::New(fnName));
+		if (!fnv->IsFunction()) {
+			std::stringstream strstr;
+			strstr << "Error: " << fnName << " is not a function";
+			lastError = strstr.str();
+			return false;
+		}
+
+		//Store found function in our cache
+		fn = Persistent<Function>::New(v8::Handle<Function>::Cast(fnv));
+		m_fnCached[std::string(fnName)] = fn;
+		return true;
+	}
+
+#ifdef BEA_ENABLE_STATS
+	CallStats* BeaContext::functionStats(const char* fnName){
+		if (!Stats::enabled())
+			return NULL;
+		std::map<std::string, CallStats*>::iterator siter = m_fnStats.find(fnName);
+		if (siter != m_fnStats.end())
+			return siter->second;
+		return m_fnStats[fnName] = Stats::get(std::string("call:") + fnName);
+	}
+#endif
+
+	//Message of a caught exception, for callBatch errors
+	std::string BeaContext::exceptionText(v8::TryCatch& try_catch){
+		if (!try_catch.HasCaught())
+			return "Unknown error";
+		v8::String::Utf8Value text(try_catch.Exception());
+		return *text ? std::string(*text, text.length()) : std::string("Unknown error");
+	}
+
+	BeaContext::BeaContext(): m_heapLimit(0), m_timeoutMs(0), m_timeoutCount(0), m_executor(NULL), 
+		m_callsServed(0), m_loadedNs(nowNs()), m_recycleCount(0)
+	{
+		m_runDepth = 0;
+		m_threadId = -1;
+		m_buildThreadId = -1;
+		m_reloadPending = false;
+		m_recycleState = RecycleIdle;
+		m_recycleRequested = false;
 	}
 
 	BeaContext::~BeaContext()
 	{
+		stopExecutor();
+		stopRecycling();
 		for (CacheMap::iterator iter = m_fnCached.begin(); iter!= m_fnCached.end(); iter++){
 			iter->second.Dispose();
 		}
@@ -368,6 +592,90 @@ namespace bea{
 		m_context.Dispose();
 	}
 
+	ContextExecutor* BeaContext::startExecutor(int batchSize)
+	{
+		if (!m_executor)
+			m_executor = new ContextExecutor(this, batchSize);
+		return m_executor;
+	}
+
+	void BeaContext::stopExecutor()
+	{
+		delete m_executor;
+		m_executor = NULL;
+	}
+
+	_BeaScript::~_BeaScript()
+	{
+		stopExecutor();
+		stopRecycling();
+		delete m_watcher;
+		for (ModuleMap::iterator iter = m_modules.begin(); iter != m_modules.end(); iter++)
+			iter->second.Dispose();
+		for (ModuleMap::iterator iter = m_stagedModules.begin(); iter != m_stagedModules.end(); iter++)
+			iter->second.Dispose();
+	}
+
+	void _BeaScript::enableHotReload(bool enable)
+	{
+		if (enable && !m_watcher){
+			m_watcher = new FileWatcher(&m_reloadPending);
+			if (!m_mainScript.empty())
+				m_watcher->addFile(m_mainScript);
+		}
+		else if (!enable && m_watcher){
+			delete m_watcher;
+			m_watcher = NULL;
+			m_reloadPending = false;
+		}
+	}
+
+	//Re-evaluate the changed main script and modules in place, then drop cached functions which were replaced
+	bool _BeaScript::reloadChanged()
+	{
+		if (!m_watcher)
+			return false;
+
+		m_reloadPending = false;
+		std::vector<std::string> changed;
+		m_watcher->takeChanged(changed);
+		if (changed.empty())
+			return false;
+
+		HandleScope scope;
+		Context::Scope context_scope(m_context);
+		RunScope running(this);
+		bool ok = true;
+
+		for (size_t k = 0; k < changed.size(); k++){
+			const std::string& fileName = changed[k];
+			Logger::instance().log(LogInfo, ("Reloading " + fileName).c_str());
+
+			ModuleMap::iterator iter = m_modules.find(fileName);
+			if (iter != m_modules.end()){
+				v8::Handle<v8::String> source = ReadFile(fileName.c_str());
+				v8::Handle<v8::Value> res;
+				if (!source.IsEmpty())
+					res = runModule(source, v8::String::New(fileName.c_str()), iter->second, m_context);
+				ok = ok && !res.IsEmpty() && !res->IsNull();
+			}
+			else if (fileName == m_mainScript)
+				ok = !executeScript(fileName.c_str(), m_context).IsEmpty() && ok;
+		}
+
+		for (CacheMap::iterator iter = m_fnCached.begin(); iter != m_fnCached.end(); ){
+			v8::Handle<v8::Value> current = m_context->Global()->Get(v8::String::New(iter->first.c_str()));
+			if (!current->StrictEquals(iter->second)){
+				iter->second.Dispose();
+				m_fnCached.erase(iter++);
+			}
+			else
+				iter++;
+		}
+
+		return ok;
+	}
+
 	bool BeaContext::exposeGlobal( const char* name, v8::InvocationCallback cb )
 	{
 		return BEA_SET_METHOD(m_context->Global(), name, cb);
@@ -383,4 +691,333 @@ namespace bea{
 		}
 		return false; 
 	}
+
+	//////////////////////////////////////////////////////////////////////////
+	//Context recycling
+
+	void BeaContext::recycleStep(){
+		int state = m_recycleState;
+		if (state == RecycleReady){
+			swapContext();
+			return;
+		}
+		if (state != RecycleIdle)
+			return;
+
+		bool due = m_recycleRequested || 
+			(m_recyclePolicy.maxCalls && m_callsServed >= m_recyclePolicy.maxCalls) ||
+			(m_recyclePolicy.maxAgeMs && nowNs() - m_loadedNs >= (uint64)m_recyclePolicy.maxAgeMs * 1000000ULL);
+		if (!due)
+			return;
+
+		//A failed build leaves its thread to be joined
+		if (m_recycleThread.joinable())
+			m_recycleThread.join();
+		m_recycleState = RecycleBuilding;
+		//A thread in V8 without the lock can't share V8 with the recycling thread: build here, this call waits for it
+		if (!v8::Locker::IsLocked()){
+			prepareNext();
+			if (m_recycleState == RecycleReady)
+				swapContext();
+			return;
+		}
+		m_recycleThread = boost::thread(&BeaContext::buildNextContext, this);
+	}
+
+	void BeaContext::buildNextContext(){
+		BEA_TRACE_THREAD_NAME("recycler");
+		v8::Locker locker;
+		prepareNext();
+	}
+
+	void BeaContext::prepareNext(){
+		BEA_TRACE_SPAN("script", "recycle");
+		HandleScope scope;
+		std::string error;
+		bool ok;
+		{
+			BuildScope building(this);
+			ok = prepareContext(m_nextContext, m_nextSandbox, error);
+		}
+		if (ok){
+			m_recycleState = RecycleReady;
+			return;
+		}
+
+		std::string msg = "Context recycling failed: " + error;
+		Logger::instance().log(LogError, msg.c_str(), (int)msg.size());
+		//Wait for the triggers to fire again rather than rebuilding on every call
+		m_callsServed = 0;
+		m_loadedNs = nowNs();
+		m_recycleRequested = false;
+		m_recycleState = RecycleIdle;
+	}
+
+	//Called with no script running in this context, so nothing holds on to the old one
+	void BeaContext::swapContext(){
+		if (m_recycleThread.joinable())
+			m_recycleThread.join();
+
+		HandleScope scope;
+		v8::Persistent<v8::Context> old = m_context;
+		m_context = m_nextContext;
+		m_nextContext.Clear();
+		if (!m_nextSandbox.IsEmpty()){
+			globalSandbox.Dispose();
+			globalSandbox = m_nextSandbox;
+			m_nextSandbox.Clear();
+		}
+
+		//Same cached names, looked up in the new context
+		Context::Scope context_scope(m_context);
+		for (CacheMap::iterator iter = m_fnCached.begin(); iter != m_fnCached.end(); ){
+			iter->second.Dispose();
+			v8::Handle<v8::Value> fnv = m_context->Global()->Get(v8::String::New(iter->first.c_str()));
+			if (fnv->IsFunction()){
+				iter->second = Persistent<Function>::New(v8::Handle<Function>::Cast(fnv));
+				iter++;
+			}
+			else
+				m_fnCached.erase(iter++);
+		}
+
+		old.Dispose();
+		v8::V8::ContextDisposedNotification();
+
+		m_callsServed = 0;
+		m_loadedNs = nowNs();
+		m_recycleCount++;
+		m_recycleRequested = false;
+		m_recycleState = RecycleIdle;
+		contextSwapped();
+		Logger::instance().log(LogInfo, "Context recycled");
+	}
+
+	void BeaContext::stopRecycling(){
+		if (m_recycleThread.joinable()){
+			//The build needs the locker to finish
+			if (v8::Locker::IsLocked()){
+				v8::Unlocker unlocker;
+				m_recycleThread.join();
+			}
+			else
+				m_recycleThread.join();
+		}
+		m_nextContext.Dispose();
+		m_nextContext.Clear();
+		m_nextSandbox.Dispose();
+		m_nextSandbox.Clear();
+		m_recycleState = RecycleIdle;
+	}
+
+	bool _BeaScript::prepareContext(v8::Persistent<v8::Context>& next, v8::Persistent<v8::Object>& sandbox, std::string& error){
+		if (m_mainScript.empty()){
+			error = "No main script";
+			return false;
+		}
+
+		std::string servingError = lastError;
+		ErrorKind servingErrorKind = lastErrorKind;
+		lastError = "";
+		lastErrorKind = NoError;
+
+		bool ok;
+		{
+			Watchdog::Guard deadline(this, m_timeoutMs);
+			ok = createContext(next, sandbox) && lastErrorKind != ScriptTerminated && !executeScript(m_mainScript.c_str(), next).IsEmpty();
+			if (deadline.disarm()){
+				m_timeoutCount++;
+				if (ok)
+					discardTermination(next);
+			}
+		}
+
+		error = lastError;
+		lastError = servingError;
+		lastErrorKind = servingErrorKind;
+
+		if (!ok){
+			next.Dispose();
+			next.Clear();
+			sandbox.Dispose();
+			sandbox.Clear();
+			for (ModuleMap::iterator iter = m_stagedModules.begin(); iter != m_stagedModules.end(); iter++)
+				iter->second.Dispose();
+			m_stagedModules.clear();
+			return false;
+		}
+		return true;
+	}
+
+	//The modules of the new context are the ones hot reload re-evaluates from now on; the old ones died with their context
+	void _BeaScript::contextSwapped(){
+		for (ModuleMap::iterator iter = m_modules.begin(); iter != m_modules.end(); iter++)
+			iter->second.Dispose();
+		m_modules.swap(m_stagedModules);
+		m_stagedModules.clear();
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+	//Heap limits and memory statistics
+
+	BeaContext::RunScope::RunScope(BeaContext* ctx): m_prev(s_running), m_ctx(ctx){
+		s_running = ctx;
+		if (ctx->m_runDepth++ == 0)
+			ctx->m_threadId = v8::V8::GetCurrentThreadId();
+	}
+
+	BeaContext::RunScope::~RunScope(){
+		s_running = m_prev;
+		//Outermost run of this context finished: the termination has been reported
+		if (--m_ctx->m_runDepth == 0){
+			boost::lock_guard<boost::mutex> guard(m_ctx->m_terminateLock);
+			m_ctx->m_terminationReason.clear();
+		}
+	}
+
+	BeaContext::BuildScope::BuildScope(BeaContext* ctx): m_prev(s_running), m_ctx(ctx){
+		s_running = ctx;
+		ctx->m_buildThreadId = v8::V8::GetCurrentThreadId();
+	}
+
+	BeaContext::BuildScope::~BuildScope(){
+		s_running = m_prev;
+		boost::lock_guard<boost::mutex> guard(m_ctx->m_terminateLock);
+		m_ctx->m_buildThreadId = -1;
+		m_ctx->m_buildTerminationReason.clear();
+	}
+
+	void BeaContext::terminate(const char* reason){
+		{
+			boost::lock_guard<boost::mutex> guard(m_terminateLock);
+			if (m_runDepth == 0)
+				return;
+			if (m_terminationReason.empty())
+				m_terminationReason = reason;
+		}
+		v8::V8::TerminateExecution(m_threadId);
+	}
+
+	void BeaContext::terminate(int threadId, const char* reason){
+		{
+			boost::lock_guard<boost::mutex> guard(m_terminateLock);
+			if (threadId != m_buildThreadId){
+				if (m_runDepth == 0 || threadId != m_threadId)
+					return;
+				if (m_terminationReason.empty())
+					m_terminationReason = reason;
+			}
+			else if (m_buildTerminationReason.empty())
+				m_buildTerminationReason = reason;
+		}
+		v8::V8::TerminateExecution(threadId);
+	}
+
+	//The watchdog may request termination after the script returned; run an empty function so the
+	//pending termination is raised and caught here instead of in the next script
+	void BeaContext::discardTermination(v8::Handle<v8::Context> context){
+		HandleScope scope;
+		Context::Scope context_scope(context);
+		TryCatch try_catch;
+		v8::Handle<v8::Script> script = v8::Script::Compile(v8::String::New("(function(){})()"));
+		if (!script.IsEmpty())
+			script->Run();
+	}
+
+	bool BeaContext::setResourceConstraints(int maxYoungSpace, int maxOldSpace, int maxExecutable){
+		v8::ResourceConstraints constraints;
+		if (maxYoungSpace > 0)
+			constraints.set_max_young_space_size(maxYoungSpace);
+		if (maxOldSpace > 0)
+			constraints.set_max_old_space_size(maxOldSpace);
+		if (maxExecutable > 0)
+			constraints.set_max_executable_size(maxExecutable);
+		return v8::SetResourceConstraints(&constraints);
+	}
+
+	void BeaContext::installHeapHooks(){
+		static bool installed = false;
+		if (installed)
+			return;
+		installed = true;
+		v8::V8::AddGCEpilogueCallback(onGCEpilogue);
+	}
+
+	//After each collection, check the heap of the running context against its soft limit
+	void BeaContext::onGCEpilogue(v8::GCType type, v8::GCCallbackFlags flags){
+		BeaContext* ctx = s_running;
+		if (!ctx || (ctx->m_heapLimit == 0 && ctx->m_recyclePolicy.maxHeapBytes == 0))
+			return;
+		//The limits are for the serving context, not a replacement being loaded
+		if (ctx->building())
+			return;
+
+		v8::HeapStatistics hs;
+		v8::V8::GetHeapStatistics(&hs);
+		if (ctx->m_recyclePolicy.maxHeapBytes && hs.used_heap_size() > ctx->m_recyclePolicy.maxHeapBytes)
+			ctx->m_recycleRequested = true;
+		if (ctx->m_heapLimit == 0 || hs.used_heap_size() <= ctx->m_heapLimit)
+			return;
+
+		{
+			boost::lock_guard<boost::mutex> guard(ctx->m_terminateLock);
+			if (!ctx->m_terminationReason.empty())
+				return;
+		}
+
+		if (m_heapLimitCb)
+			m_heapLimitCb(ctx, hs.used_heap_size(), ctx->m_heapLimit);
+
+		std::stringstream s;
+		s << "Heap limit exceeded: " << hs.used_heap_size() << " bytes used, limit " << ctx->m_heapLimit;
+		ctx->terminate(s.str().c_str());
+	}
+
+	//V8 cannot continue after a fatal error (eg. the hard heap limit was hit); make sure it is logged
+	void BeaContext::onFatalError(const char* location, const char* message){
+		std::stringstream s;
+		s << "V8 fatal error in " << (location ? location : "?") << ": " << (message ? message : "");
+		lastError = s.str();
+		Logger::instance().log(LogError, lastError.c_str(), (int)lastError.size());
+		Logger::instance().flush();
+		abort();
+	}
+
+	void BeaContext::getMemoryStatistics(MemoryStatistics& stats){
+		v8::HeapStatistics hs;
+		v8::V8::GetHeapStatistics(&hs);
+		stats.totalHeapSize = hs.total_heap_size();
+		stats.totalHeapSizeExecutable = hs.total_heap_size_executable();
+		stats.usedHeapSize = hs.used_heap_size();
+		stats.heapSizeLimit = hs.heap_size_limit();
+		stats.externalMemory = v8::V8::AdjustAmountOfExternalAllocatedMemory(0);
+		stats.sharedMemory = SharedRegion::totalBytes();
+		WrapperCensus::snapshot(stats.wrappers);
+	}
+
+	v8::Handle<v8::Value> BeaContext::memoryStats(const v8::Arguments& args){
+		HandleScope scope;
+		MemoryStatistics stats;
+		getMemoryStatistics(stats);
+
+		v8::Local<v8::Object> res = v8::Object::New();
+		res->Set(v8::String::NewSymbol("heapUsed"), v8::Number::New((double)stats.usedHeapSize));
+		res->Set(v8::String::NewSymbol("heapTotal"), v8::Number::New((double)stats.totalHeapSize));
+		res->Set(v8::String::NewSymbol("heapExecutable"), v8::Number::New((double)stats.totalHeapSizeExecutable));
+		res->Set(v8::String::NewSymbol("heapLimit"), v8::Number::New((double)stats.heapSizeLimit));
+		res->Set(v8::String::NewSymbol("external"), v8::Number::New((double)stats.externalMemory));
+		res->Set(v8::String::NewSymbol("shared"), v8::Number::New((double)stats.sharedMemory));
+		if (s_running && s_running->m_heapLimit)
+			res->Set(v8::String::NewSymbol("contextLimit"), v8::Number::New((double)s_running->m_heapLimit));
+
+		v8::Local<v8::Object> wrappers = v8::Object::New();
+		for (size_t k = 0; k < stats.wrappers.size(); k++){
+			v8::Local<v8::Object> w = v8::Object::New();
+			w->Set(v8::String::NewSymbol("created"), v8::Number::New((double)stats.wrappers[k].created));
+			w->Set(v8::String::NewSymbol("live"), v8::Number::New((double)stats.wrappers[k].live));
+			wrappers->Set(v8::String::New(stats.wrappers[k].name.c_str()), w);
+		}
+		res->Set(v8::String::NewSymbol("wrappers"), wrappers);
+		return scope.Close(res);
+	}
 }	//namespace bea
\ No newline at end of file
@@ -2,7 +2,11 @@
 #define __BEASCRIPT_H__
 
 #include "bea.h"
+#include "bealog.h"
+#include "beawatchdog.h"
+#include "beawatcher.h"
 #include <boost/filesystem/path.hpp>
+#include <boost/tuple/tuple.hpp>
 #include <v8.h>
 
 namespace bea{
@@ -10,12 +14,126 @@ namespace bea{
 	//Thin wrapper around a v8 context
 	//Allows calling functions, holds a map of cached js functions
 	//Context can be re-assigned (v8::Persistent<> is ref-counted)
-	typedef void (*logCallback)(const char* msg);
 	typedef void (*yieldCallback)(int timeout);
+
+	class BeaContext;
+	class ContextExecutor;
+	class ScriptBundle;
+	//Called when a context goes over its heap limit, before the script is terminated
+	typedef void (*heapLimitCallback)(BeaContext* ctx, size_t usedHeap, size_t limit);
+
+	//Heap and wrapper statistics. The heap figures are those of the V8 heap shared by all contexts.
+	struct MemoryStatistics{
+		size_t totalHeapSize;
+		size_t totalHeapSizeExecutable;
+		size_t usedHeapSize;
+		size_t heapSizeLimit;
+		intptr_t externalMemory;
+		size_t sharedMemory;	//SharedRegion memory, counted once for all contexts
+		std::vector<WrapperCount> wrappers;
+	};
+
+	//Arguments of one callBatch record: a value, a std::pair or a boost::tuple of up to 5 values
+	template<class T> struct BatchArgs{
+		enum {Count = 1};
+		static inline int ToJS(const T& r, v8::Handle<v8::Value>* argv){
+			argv[0] = Convert<T>::ToJS(r);
+			return 1;
+		}
+	};
+
+	template<class A, class B> struct BatchArgs<std::pair<A, B> >{
+		enum {Count = 2};
+		static inline int ToJS(const std::pair<A, B>& r, v8::Handle<v8::Value>* argv){
+			argv[0] = Convert<A>::ToJS(r.first);
+			argv[1] = Convert<B>::ToJS(r.second);
+			return 2;
+		}
+	};
+
+	template<class A> struct BatchArgs<boost::tuple<A> >{
+		enum {Count = 1};
+		static inline int ToJS(const boost::tuple<A>& r, v8::Handle<v8::Value>* argv){
+			argv[0] = Convert<A>::ToJS(r.template get<0>());
+			return 1;
+		}
+	};
+
+	template<class A, class B> struct BatchArgs<boost::tuple<A, B> >{
+		enum {Count = 2};
+		static inline int ToJS(const boost::tuple<A, B>& r, v8::Handle<v8::Value>* argv){
+			argv[0] = Convert<A>::ToJS(r.template get<0>());
+			argv[1] = Convert<B>::ToJS(r.template get<1>());
+			return 2;
+		}
+	};
+
+	template<class A, class B, class C> struct BatchArgs<boost::tuple<A, B, C> >{
+		enum {Count = 3};
+		static inline int ToJS(const boost::tuple<A, B, C>& r, v8::Handle<v8::Value>* argv){
+			argv[0] = Convert<A>::ToJS(r.template get<0>());
+			argv[1] = Convert<B>::ToJS(r.template get<1>());
+			argv[2] = Convert<C>::ToJS(r.template get<2>());
+			return 3;
+		}
+	};
+
+	template<class A, class B, class C, class D> struct BatchArgs<boost::tuple<A, B, C, D> >{
+		enum {Count = 4};
+		static inline int ToJS(const boost::tuple<A, B, C, D>& r, v8::Handle<v8::Value>* argv){
+			argv[0] = Convert<A>::ToJS(r.template get<0>());
+			argv[1] = Convert<B>::ToJS(r.template get<1>());
+			argv[2] = Convert<C>::ToJS(r.template get<2>());
+			argv[3] = Convert<D>::ToJS(r.template get<3>());
+			return 4;
+		}
+	};
+
+	template<class A, class B, class C, class D, class E> struct BatchArgs<boost::tuple<A, B, C, D, E> >{
+		enum {Count = 5};
+		static inline int ToJS(const boost::tuple<A, B, C, D, E>& r, v8::Handle<v8::Value>* argv){
+			argv[0] = Convert<A>::ToJS(r.template get<0>());
+			argv[1] = Convert<B>::ToJS(r.template get<1>());
+			argv[2] = Convert<C>::ToJS(r.template get<2>());
+			argv[3] = Convert<D>::ToJS(r.template get<3>());
+			argv[4] = Convert<E>::ToJS(r.template get<4>());
+			return 5;
+		}
+	};
+
+	//When a context is replaced by a freshly loaded one (see BeaContext::setRecyclePolicy). 0 disables a trigger.
+	struct RecyclePolicy{
+		uint64 maxCalls;		//Calls served by the context
+		size_t maxHeapBytes;	//Used size of the process-wide V8 heap after a garbage collection, while the context runs script
+		int maxAgeMs;			//Time since the context was loaded
+
+		RecyclePolicy(uint64 calls = 0, size_t heapBytes = 0, int ageMs = 0): maxCalls(calls), maxHeapBytes(heapBytes), maxAgeMs(ageMs){}
+
+		bool enabled() const{
+			return maxCalls || maxHeapBytes || maxAgeMs;
+		}
+	};
+
+	//A record of callBatch that failed
+	struct BatchError{
+		size_t index;
+		std::string message;
+		BatchError(size_t i, const std::string& msg): index(i), message(msg){}
+	};
+
 	class BeaContext{
 
 	public:
+		//What lastError describes
+		enum ErrorKind{
+			NoError = 0,
+			ScriptException,	//Compile error or uncaught javascript exception
+			ScriptTerminated	//Script stopped by a deadline, the heap limit or terminate()
+		};
+
+		//Error of the last loadScript, call or callBatch; cleared when the next one starts
 		static std::string lastError;
+		static ErrorKind lastErrorKind;
 		static logCallback	m_logger;
 		static yieldCallback m_yielder;
 		static std::vector<std::string> cmdLine; 
@@ -29,13 +147,200 @@ namespace bea{
 		typedef std::map<std::string, JFunction> CacheMap;
 		//Cached javascript functions
 		CacheMap m_fnCached;
-		//Report the error from an exception, store it in lastError
+		//Soft heap limit in bytes, 0 for none
+		size_t m_heapLimit;
+		//Why the running script was terminated, reported in lastError
+		std::string m_terminationReason;
+		boost::mutex m_terminateLock;
+		//Nesting depth of RunScopes on this context
+		boost::atomic<int> m_runDepth;
+		//V8 id of the thread running script in this context
+		boost::atomic<int> m_threadId;
+		//V8 id of the thread building a replacement context (-1 for none) and why its script was terminated
+		boost::atomic<int> m_buildThreadId;
+		std::string m_buildTerminationReason;
+		//Default deadline of calls and loadScript, in milliseconds (0 for none)
+		int m_timeoutMs;
+		//Number of runs stopped by a deadline
+		uint64 m_timeoutCount;
+		//Set by the file watcher when a script changed (see _BeaScript::enableHotReload)
+		boost::atomic<bool> m_reloadPending;
+		static heapLimitCallback m_heapLimitCb;
+		//Thread running submitted calls (see startExecutor)
+		ContextExecutor* m_executor;
+		//Context currently running script
+		static BeaContext* s_running;
+		//Context recycling: the replacement is built on m_recycleThread and swapped in by the next call
+		enum RecycleState{
+			RecycleIdle = 0,
+			RecycleBuilding,
+			RecycleReady
+		};
+		RecyclePolicy m_recyclePolicy;
+		uint64 m_callsServed;
+		uint64 m_loadedNs;
+		uint64 m_recycleCount;
+		boost::atomic<int> m_recycleState;
+		boost::atomic<bool> m_recycleRequested;
+		boost::thread m_recycleThread;
+		v8::Persistent<v8::Context> m_nextContext;
+		v8::Persistent<v8::Object> m_nextSandbox;
+#ifdef BEA_ENABLE_STATS
+		//Call statistics of the functions in m_fnCached
+		std::map<std::string, CallStats*> m_fnStats;
+#endif
+		//Marks a context as the one running script for the lifetime of the scope
+		class RunScope{
+			BeaContext* m_prev;
+			BeaContext* m_ctx;
+		public:
+			RunScope(BeaContext* ctx);
+			~RunScope();
+		};
+		//Marks the current thread as building a replacement context for the lifetime of the scope.
+		//The run state of the serving context is left alone.
+		class BuildScope{
+			BeaContext* m_prev;
+			BeaContext* m_ctx;
+		public:
+			BuildScope(BeaContext* ctx);
+			~BuildScope();
+		};
+		friend class Watchdog;
+
+		//True on the thread building a replacement context
+		inline bool building(){
+			return m_buildThreadId == v8::V8::GetCurrentThreadId();
+		}
+
+		static void onGCEpilogue(v8::GCType type, v8::GCCallbackFlags flags);
+		static void onFatalError(const char* location, const char* message);
+		static void installHeapHooks();
+
+		//Swallow a termination requested by a deadline that expired just as the script finished
+		void discardTermination(v8::Handle<v8::Context> context);
+		void discardTermination(){
+			discardTermination(m_context);
+		}
+		//Deadline of the script run by threadId: the build of a replacement context or a serving run
+		void terminate(int threadId, const char* reason);
+
+		//Build a replacement context into next, leaving m_context and its run state alone: calls served while the build
+		//yields run as before. Called with the V8 lock held, inside a BuildScope.
+		//lastError is left as it was; error gets the reason of a failed build.
+		virtual bool prepareContext(v8::Persistent<v8::Context>& next, v8::Persistent<v8::Object>& sandbox, std::string& error){
+			return false;
+		}
+		//Called by swapContext() once the replacement serves
+		virtual void contextSwapped(){}
+		//Recycling thread
+		void buildNextContext();
+		//Build into m_nextContext; the state becomes RecycleReady, or RecycleIdle if the build failed
+		void prepareNext();
+		void swapContext();
+		void recycleStep();
+		//Wait for a replacement being built and drop it. Derived classes call it first in their destructor.
+		void stopRecycling();
+
+		//Count a call; start building a replacement, or swap in a ready one, when no call is running
+		inline void pollRecycle(){
+			m_callsServed++;
+			if (m_runDepth == 0 && (m_recycleState != RecycleIdle || m_recycleRequested || m_recyclePolicy.enabled()))
+				recycleStep();
+		}
+		bool lookupFunction(const char* fnName, JFunction& fn);
+		static std::string exceptionText(v8::TryCatch& try_catch);
+#ifdef BEA_ENABLE_STATS
+		CallStats* functionStats(const char* fnName);
+#endif
+
+		template<class R, class Record>
+		size_t runBatch(const char* fnName, const std::vector<Record>& records, std::vector<R>* results, std::vector<BatchError>* errors, int timeoutMs);
 		
 		BeaContext();
 	public:
 		virtual ~BeaContext();
-		//Call a function in Javascript
-		v8::Handle<v8::Value> call(const char* fnName, int argc, v8::Handle<v8::Value> argv[]);
+		//Call a function in Javascript.
+		//timeoutMs: deadline of this call; -1 uses the context's execution timeout, 0 means none.
+		v8::Handle<v8::Value> call(const char* fnName, int argc, v8::Handle<v8::Value> argv[], int timeoutMs = -1);
+
+		//Call a function once per record, entering the context once. Records are converted with BatchArgs<Record>,
+		//results with Convert<R>. A failed record is added to errors (or logged if errors is NULL) and the batch goes on;
+		//a deadline or terminate() fails the remaining records. Returns the number of successful calls.
+		template<class R, class Record>
+		size_t callBatch(const char* fnName, const std::vector<Record>& records, std::vector<R>& results, 
+			std::vector<BatchError>* errors = NULL, int timeoutMs = -1){
+			results.resize(records.size());
+			return runBatch(fnName, records, &results, errors, timeoutMs);
+		}
+
+		//Same, ignoring the results
+		template<class Record>
+		size_t callBatch(const char* fnName, const std::vector<Record>& records, std::vector<BatchError>* errors = NULL, int timeoutMs = -1){
+			return runBatch(fnName, records, (std::vector<int>*)NULL, errors, timeoutMs);
+		}
+
+		//Replace the context with a freshly loaded one when a trigger of the policy fires. If the thread calling holds a
+		//v8::Locker (as the executor does), the replacement is built on a background thread, which needs the V8 lock:
+		//release it from time to time. Otherwise the call which finds the trigger fired builds it. The next call() outside
+		//any running script swaps it in and moves the cached functions over. maxHeapBytes should be well above the heap
+		//of a freshly loaded context.
+		//The build holds the V8 lock while it initializes the context and runs the main script, so calls made
+		//meanwhile wait for it: recycling hides the cost of the swap, not of loading the script.
+		void setRecyclePolicy(const RecyclePolicy& policy){
+			m_recyclePolicy = policy;
+		}
+
+		const RecyclePolicy& recyclePolicy(){
+			return m_recyclePolicy;
+		}
+
+		//Recycle at the next call, whatever the policy
+		void requestRecycle(){
+			m_recycleRequested = true;
+		}
+
+		//Number of times the context was replaced
+		uint64 recycleCount(){
+			return m_recycleCount;
+		}
+
+		//Stop the script running in this context (from any thread). reason is reported in lastError.
+		void terminate(const char* reason);
+
+		//Default deadline for call() and loadScript(), in milliseconds (0 for none)
+		void setExecutionTimeout(int timeoutMs){
+			m_timeoutMs = timeoutMs;
+		}
+
+		int executionTimeout(){
+			return m_timeoutMs;
+		}
+
+		//Number of calls in this context stopped by a deadline (see Watchdog for process totals)
+		uint64 timeoutCount(){
+			return m_timeoutCount;
+		}
+
+		//Apply pending script changes. Called by call() when the file watcher reported changes.
+		virtual bool reloadChanged(){
+			return false;
+		}
+
+		//Start the thread which runs the calls submitted through executor() (see beaexecutor.h).
+		//Call after the script is loaded, from the thread that owns the context.
+		ContextExecutor* startExecutor(int batchSize = 64);
+		//Finish the submitted calls and stop the thread. Also done by the destructor.
+		void stopExecutor();
+		ContextExecutor* executor(){
+			return m_executor;
+		}
+
+		//CPU profile and heap snapshot, written as .cpuprofile and .heapsnapshot files (see beaprofiler.h).
+		//The CPU profile keeps the functions of this context only.
+		void startCpuProfile(const char* title, int samplingIntervalUs = 0);
+		bool stopCpuProfile(const char* title, const char* fileName);
+		bool writeHeapSnapshot(const char* fileName);
 
 		bool exposeGlobal(const char* name, v8::InvocationCallback cb);
 		static void reportError(v8::TryCatch& try_catch);
@@ -54,14 +359,43 @@ namespace bea{
 			return lastError;
 		}
 
-		static void setLogCallback(logCallback cb){
-			m_logger = cb;
-		}
+		//Receives error stack traces, on the logger thread (see bealog.h)
+		static void setLogCallback(logCallback cb);
 
 		static void setYieldCallback(yieldCallback cb){
 			m_yielder = cb;
 		}
 
+		//Process-wide V8 heap constraints in bytes (0 keeps the default). Must be called before the first context is created.
+		static bool setResourceConstraints(int maxYoungSpace, int maxOldSpace, int maxExecutable = 0);
+
+		//Log V8 fatal errors (eg. the hard heap limit was hit) and flush the log before aborting. This replaces the
+		//fatal error handler of the host, so it is not installed unless asked for.
+		static void logFatalErrors(){
+			v8::V8::SetFatalErrorHandler(onFatalError);
+		}
+
+		//Soft heap limit for scripts running in this context. The limit is compared with the used size of the V8 heap,
+		//which all contexts of the process share: when it is over the limit after a garbage collection that happens
+		//while this context runs script, the heap limit callback is called and the script is terminated.
+		//Set it above the heap used by the other contexts.
+		void setHeapLimit(size_t bytes){
+			m_heapLimit = bytes;
+		}
+
+		size_t heapLimit(){
+			return m_heapLimit;
+		}
+
+		static void setHeapLimitCallback(heapLimitCallback cb){
+			m_heapLimitCb = cb;
+		}
+
+		static void getMemoryStatistics(MemoryStatistics& stats);
+
+		//Javascript: memoryStats() returns {heapUsed, heapTotal, heapLimit, external, wrappers: {Class: {created, live}}}
+		static v8::Handle<v8::Value> memoryStats(const v8::Arguments& args);
+
 		static void setCommandLine(int argc, char** argv){
 			for (int k = 0; k < argc; k++){
 				cmdLine.push_back(std::string(argv[k]));
@@ -69,13 +403,115 @@ namespace bea{
 		}
 	};
 
+	template<class R, class Record>
+	size_t BeaContext::runBatch(const char* fnName, const std::vector<Record>& records, std::vector<R>* results, 
+		std::vector<BatchError>* errors, int timeoutMs){
+
+		enum {ChunkSize = 256};
+		BEA_TRACE_SPAN("batch", fnName);
+		lastError.clear();
+		lastErrorKind = NoError;
+		if (m_reloadPending && m_runDepth == 0)
+			reloadChanged();
+		pollRecycle();
+
+		v8::HandleScope scope;
+		v8::Context::Scope contextScope(m_context);
+		RunScope running(this);
+
+		size_t n = records.size();
+		JFunction fn;
+		if (!lookupFunction(fnName, fn)){
+			for (size_t k = 0; k < n && errors; k++)
+				errors->push_back(BatchError(k, lastError));
+			return 0;
+		}
+
+		v8::Handle<v8::Object> global = m_context->Global();
+		v8::Handle<v8::Value> argv[BatchArgs<Record>::Count];
+		size_t succeeded = 0;
+#ifdef BEA_ENABLE_STATS
+		CallStats* stats = functionStats(fnName);
+#endif
+
+		Watchdog::Guard deadline(this, timeoutMs < 0 ? m_timeoutMs : timeoutMs);
+		v8::TryCatch try_catch;
+		for (size_t start = 0; start < n; start += ChunkSize){
+			v8::HandleScope chunkScope;
+			size_t end = start + ChunkSize < n ? start + ChunkSize : n;
+			for (size_t k = start; k < end; k++){
+#ifdef BEA_ENABLE_STATS
+				BEA_STATS_CALL_SCOPE(stats);
+#endif
+				bool failed = false;
+				try {
+					int argc = BatchArgs<Record>::ToJS(records[k], argv);
+					v8::Handle<v8::Value> res = fn->Call(global, argc, argv);
+					if (res.IsEmpty())
+						failed = true;
+					else {
+						if (results)
+							(*results)[k] = Convert<R>::FromJS(res, 0);
+						succeeded++;
+					}
+				}
+				catch (bea::ArgConvertException&){
+					failed = true;
+				}
+
+				if (!failed)
+					continue;
+
+				BEA_STATS_FAILURE();
+				if (try_catch.HasCaught() && !try_catch.CanContinue()){
+					//Terminated: the rest of the batch cannot run
+					reportError(try_catch);
+					for (size_t j = k; j < n && errors; j++)
+						errors->push_back(BatchError(j, lastError));
+					start = n;
+					break;
+				}
+				if (errors)
+					errors->push_back(BatchError(k, exceptionText(try_catch)));
+				else
+					reportError(try_catch);
+				try_catch.Reset();
+			}
+		}
+
+		if (deadline.disarm()){
+			m_timeoutCount++;
+			if (succeeded == n)
+				discardTermination();
+		}
+		return succeeded;
+	}
+
 	//Helper class to run a javascript script
 	class _BeaScript : public BeaContext{
 		static boost::filesystem::path scriptPath; 
+		static ScriptBundle* s_bundle;
+
+		//Scripts are read from the bundle when it has them, from disk otherwise
+		static bool sourceExists(const std::string& fileName);
+		static v8::Handle<v8::String> readSource(const std::string& fileName);
+		static v8::Handle<v8::Script> compile(v8::Handle<v8::String> source, v8::Handle<v8::String> fileName, bool bind);
 	protected:
+		//Hot reload: watcher (NULL when disabled), main script and the module objects of loaded modules
+		FileWatcher* m_watcher;
+		std::string m_mainScript;
+		typedef std::map<std::string, v8::Persistent<v8::Object> > ModuleMap;
+		ModuleMap m_modules;
+		//Modules loaded while building a replacement context; they replace m_modules when it is swapped in
+		ModuleMap m_stagedModules;
+
 		//Invocation callback for the 'require' javascript function
 		static v8::Handle<v8::Value> loadScriptSource(const std::string& fileName);
 		static v8::Handle<v8::Value> include(const v8::Arguments& args);
+		//Run a module in a new context and copy its 'module' object back to moduleArg.
+		//parent is the context loading the module: its security token and lazy classes are passed on.
+		static v8::Handle<v8::Value> runModule(v8::Handle<v8::String> source, v8::Handle<v8::String> fileName, 
+			v8::Handle<v8::Object> moduleArg, v8::Handle<v8::Context> parent);
 		static v8::Handle<v8::Value> enumProperties(const v8::Arguments& args);
 		static v8::Handle<v8::ObjectTemplate> createGlobal();
 		
@@ -85,22 +521,37 @@ namespace bea{
 		static v8::Handle<v8::Value> yield(const v8::Arguments& args);
 		static v8::Handle<v8::Value> collectGarbage(const v8::Arguments& args);
 
-		virtual void expose() {}
-		v8::Handle<v8::Value> executeScript(const char* fileName);
+		//Expose the objects of the script to global
+		virtual void expose(v8::Handle<v8::Object> global) {}
+		v8::Handle<v8::Value> executeScript(const char* fileName, v8::Handle<v8::Context> context);
+		//Init a new context and run the main script in it, for recycling
+		bool prepareContext(v8::Persistent<v8::Context>& next, v8::Persistent<v8::Object>& sandbox, std::string& error);
+		void contextSwapped();
 		//Init the script context and expose the objects offered by IBeaExposer
 		bool init();
+		//Create a context with the globals, the exposed objects and ./lib/loader.js; sandbox gets its globals for modules
+		bool createContext(v8::Persistent<v8::Context>& context, v8::Persistent<v8::Object>& sandbox);
 
 	public:
-		inline _BeaScript(){
-
-		}
-		virtual ~_BeaScript(){
+		inline _BeaScript(): m_watcher(NULL){
 
 		}
+		virtual ~_BeaScript();
 		
 		//Load, compile and execute a script 
 		bool loadScript(const char* fileName);
 
+		//Serve the main script, ./lib/loader.js and modules from a bundle (see beabundle.h), for all contexts.
+		//Call before loadScript. Paths missing from the bundle are read from disk. NULL closes the bundle.
+		static bool useBundle(const char* fileName, const char* root = NULL);
+
+		//Watch the main script and the modules loaded with loadCommonJSModule. Call before loadScript.
+		//Changed files are re-evaluated in this context before the next call(): modules update their
+		//exports in place, the main script redefines its globals, and stale cached functions are dropped.
+		void enableHotReload(bool enable = true);
+
+		bool reloadChanged();
+
 
 
 	};
@@ -108,8 +559,8 @@ namespace bea{
 	template <class TExposer>
 	class BeaScript : public _BeaScript{
 	protected:
-		void expose(){
-			TExposer::expose(m_context->Global());
+		void expose(v8::Handle<v8::Object> global){
+			TExposer::expose(global);
 		}
 	};
 
@@ -0,0 +1,153 @@
+#include "beashared.h"
+#include <string.h>
+#include <map>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+
+namespace bea{
+
+	typedef std::map<std::string, SharedRegion*> RegionMap;
+
+	static RegionMap& regions(){
+		static RegionMap s_regions;
+		return s_regions;
+	}
+
+	static boost::mutex& regionLock(){
+		static boost::mutex s_lock;
+		return s_lock;
+	}
+
+	static size_t s_totalBytes = 0;
+
+	//Template of read-only views; shared by all contexts
+	static v8::Persistent<v8::ObjectTemplate> s_readOnlyTemplate;
+
+	SharedRegion::SharedRegion(const std::string& name, int byteSize, int type, bool readOnly): 
+		m_name(name), m_readOnly(readOnly), m_refs(1), m_views(0){
+		m_buffer = new BeaBuffer(byteSize, type);
+		memset(m_buffer->ptr(), 0, byteSize);
+	}
+
+	SharedRegion::~SharedRegion(){
+		delete m_buffer;
+	}
+
+	SharedRegion* SharedRegion::create(const std::string& name, int byteSize, int type, bool readOnly){
+		int elemSize = externalArrayElementSize(type);
+		if (!elemSize || byteSize < 0 || byteSize % elemSize)
+			return NULL;
+
+		boost::lock_guard<boost::mutex> guard(regionLock());
+		if (regions().find(name) != regions().end())
+			return NULL;
+		SharedRegion* region = new SharedRegion(name, byteSize, type, readOnly);
+		regions()[name] = region;
+		s_totalBytes += byteSize;
+		return region;
+	}
+
+	SharedRegion* SharedRegion::find(const std::string& name){
+		boost::lock_guard<boost::mutex> guard(regionLock());
+		RegionMap::iterator iter = regions().find(name);
+		if (iter == regions().end())
+			return NULL;
+		iter->second->m_refs.fetch_add(1);
+		return iter->second;
+	}
+
+	size_t SharedRegion::totalBytes(){
+		boost::lock_guard<boost::mutex> guard(regionLock());
+		return s_totalBytes;
+	}
+
+	void SharedRegion::retain(){
+		m_refs.fetch_add(1);
+	}
+
+	void SharedRegion::release(){
+		//find() takes the lock before adding a reference, so the last release must hold it too
+		boost::lock_guard<boost::mutex> guard(regionLock());
+		if (m_refs.fetch_sub(1) != 1)
+			return;
+		regions().erase(m_name);
+		s_totalBytes -= m_buffer->size();
+		delete this;
+	}
+
+	void SharedRegion::ReleaseView(v8::Persistent<v8::Value> value, void* data){
+		SharedRegion* region = static_cast<SharedRegion*>(data);
+		region->m_views.fetch_sub(1);
+		region->release();
+		value.Dispose();
+	}
+
+	//Reads an element of a read-only view
+	v8::Handle<v8::Value> SharedRegion::GetIndexed(uint32_t index, const v8::AccessorInfo& info){
+		SharedRegion* region = static_cast<SharedRegion*>(info.Holder()->GetPointerFromInternalField(0));
+		if (index >= (uint32_t)region->length())
+			return v8::Handle<v8::Value>();
+
+		char* p = static_cast<char*>(region->ptr());
+		switch (region->type()){
+			case v8::kExternalByteArray: return v8::Integer::New(((char*)p)[index]);
+			case v8::kExternalPixelArray:
+			case v8::kExternalUnsignedByteArray: return v8::Integer::New(((unsigned char*)p)[index]);
+			case v8::kExternalShortArray: return v8::Integer::New(((short*)p)[index]);
+			case v8::kExternalUnsignedShortArray: return v8::Integer::New(((unsigned short*)p)[index]);
+			case v8::kExternalIntArray: return v8::Integer::New(((int*)p)[index]);
+			case v8::kExternalUnsignedIntArray: return v8::Integer::NewFromUnsigned(((unsigned int*)p)[index]);
+			case v8::kExternalFloatArray: return v8::Number::New(((float*)p)[index]);
+			case v8::kExternalDoubleArray: return v8::Number::New(((double*)p)[index]);
+		}
+		return v8::Handle<v8::Value>();
+	}
+
+	v8::Handle<v8::Value> SharedRegion::SetIndexed(uint32_t index, v8::Local<v8::Value> value, const v8::AccessorInfo& info){
+		return v8::ThrowException(v8::Exception::TypeError(v8::String::New("Shared region is read-only")));
+	}
+
+	v8::Handle<v8::Object> SharedRegion::view(){
+		v8::HandleScope scope;
+		v8::Handle<v8::Object> obj;
+
+		if (m_readOnly){
+			//External array elements bypass interceptors, so read-only views go through an indexed handler instead
+			if (s_readOnlyTemplate.IsEmpty()){
+				v8::Handle<v8::ObjectTemplate> otmpl = v8::ObjectTemplate::New();
+				otmpl->SetInternalFieldCount(1);
+				otmpl->SetIndexedPropertyHandler(GetIndexed, SetIndexed);
+				s_readOnlyTemplate = v8::Persistent<v8::ObjectTemplate>::New(otmpl);
+			}
+			obj = s_readOnlyTemplate->NewInstance();
+			obj->SetPointerInInternalField(0, this);
+		}
+		else {
+			obj = v8::Object::New();
+			obj->SetIndexedPropertiesToExternalArrayData(ptr(), (v8::ExternalArrayType)type(), length());
+		}
+
+		v8::PropertyAttribute attr = static_cast<v8::PropertyAttribute>(v8::ReadOnly | v8::DontEnum | v8::DontDelete);
+		obj->Set(v8::String::NewSymbol("length"), v8::Integer::New(length()), attr);
+		obj->Set(v8::String::NewSymbol("name"), v8::String::New(m_name.c_str()), attr);
+		obj->Set(v8::String::NewSymbol("readOnly"), v8::Boolean::New(m_readOnly), attr);
+
+		retain();
+		m_views.fetch_add(1);
+		v8::Persistent<v8::Object>::New(obj).MakeWeak(this, ReleaseView);
+		return scope.Close(obj);
+	}
+
+	v8::Handle<v8::Value> SharedRegion::jsSharedRegion(const v8::Arguments& args){
+		METHOD_BEGIN(1);
+		std::string name = bea::Convert<std::string>::FromJS(args[0], 0);
+		SharedRegion* region = find(name);
+		if (!region)
+			return v8::Undefined();
+		v8::Handle<v8::Value> res = region->view();
+		region->release();
+		return res;
+		METHOD_END();
+		return v8::Undefined();
+	}
+}
@@ -0,0 +1,89 @@
+#ifndef __BEASHARED_H__
+#define __BEASHARED_H__
+
+//Native memory shared by every context of the process.
+//A region is loaded once and each context gets a view of it: an object whose indexed properties
+//are the region's memory (no copy). The region is refcounted: C++ owners and javascript views each hold
+//a reference and the memory is freed when the last one is released.
+
+#include <v8.h>
+#include <string>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/static_assert.hpp>
+#include "bea.h"
+
+namespace bea{
+
+	class SharedRegion{
+		BeaBuffer* m_buffer;
+		std::string m_name;
+		bool m_readOnly;
+		boost::atomic<int> m_refs;
+		boost::atomic<int> m_views;
+
+		SharedRegion(const std::string& name, int byteSize, int type, bool readOnly);
+		~SharedRegion();
+
+		static void ReleaseView(v8::Persistent<v8::Value> value, void* data);
+		static v8::Handle<v8::Value> GetIndexed(uint32_t index, const v8::AccessorInfo& info);
+		static v8::Handle<v8::Value> SetIndexed(uint32_t index, v8::Local<v8::Value> value, const v8::AccessorInfo& info);
+
+	public:
+		//Create and register a region. The caller owns the returned reference.
+		//Returns NULL if type is not an external array type or the name is already registered.
+		static SharedRegion* create(const std::string& name, int byteSize, int type, bool readOnly = false);
+
+		//Region of count elements of T (an element type of external arrays: char, short, int, float, double...)
+		template<class T>
+		static SharedRegion* create(const std::string& name, int count, bool readOnly = false){
+			BOOST_STATIC_ASSERT(IndexType<T>::Value != 0);
+			return create(name, count * (int)sizeof(T), IndexType<T>::Value, readOnly);
+		}
+
+		//Find a registered region by name. The caller owns the returned reference (NULL if not found).
+		static SharedRegion* find(const std::string& name);
+
+		//Bytes held by all live regions
+		static size_t totalBytes();
+
+		void retain();
+		void release();
+
+		//A view of the region in the current context. Each view holds a reference until it is collected.
+		//Writable views are plain external arrays; writes to read-only views are rejected with a TypeError.
+		v8::Handle<v8::Object> view();
+
+		template<class T>
+		T* ptr(){
+			return static_cast<T*>(m_buffer->ptr());
+		}
+		void* ptr(){
+			return m_buffer->ptr();
+		}
+		int byteSize(){
+			return m_buffer->size();
+		}
+		int type(){
+			return m_buffer->type();
+		}
+		int length(){
+			return m_buffer->size() / externalArrayElementSize(m_buffer->type());
+		}
+		const std::string& name(){
+			return m_name;
+		}
+		bool readOnly(){
+			return m_readOnly;
+		}
+		//Number of live javascript views, across all contexts
+		int views(){
+			return m_views.load();
+		}
+
+		//Javascript: sharedRegion(name) returns a view of the region, or undefined
+		static v8::Handle<v8::Value> jsSharedRegion(const v8::Arguments& args);
+	};
+}
+
+#endif //__BEASHARED_H__
@@ -0,0 +1,207 @@
+#include "beasimd.h"
+
+#if defined(__AVX__)
+#define BEA_SIMD_AVX
+#include <immintrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BEA_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+
+//Float vector of the widest available instruction set
+#if defined(BEA_SIMD_AVX)
+typedef __m256 vfloat;
+#define VWIDTH 8
+#define VLOAD(p) _mm256_loadu_ps(p)
+#define VSTORE(p, v) _mm256_storeu_ps((p), (v))
+#define VSET1(x) _mm256_set1_ps(x)
+#define VADD(a, b) _mm256_add_ps((a), (b))
+#define VMUL(a, b) _mm256_mul_ps((a), (b))
+#define VMIN(a, b) _mm256_min_ps((a), (b))
+#define VMAX(a, b) _mm256_max_ps((a), (b))
+#elif defined(BEA_SIMD_SSE2)
+typedef __m128 vfloat;
+#define VWIDTH 4
+#define VLOAD(p) _mm_loadu_ps(p)
+#define VSTORE(p, v) _mm_storeu_ps((p), (v))
+#define VSET1(x) _mm_set1_ps(x)
+#define VADD(a, b) _mm_add_ps((a), (b))
+#define VMUL(a, b) _mm_mul_ps((a), (b))
+#define VMIN(a, b) _mm_min_ps((a), (b))
+#define VMAX(a, b) _mm_max_ps((a), (b))
+#endif
+
+namespace bea{
+	namespace simd{
+
+		const char* instructionSet(){
+#if defined(BEA_SIMD_AVX)
+			return "avx";
+#elif defined(BEA_SIMD_SSE2)
+			return "sse2";
+#else
+			return "scalar";
+#endif
+		}
+
+		void fill(float* dst, int n, float value){
+			int k = 0;
+#ifdef VWIDTH
+			vfloat v = VSET1(value);
+			for (; k + VWIDTH <= n; k += VWIDTH)
+				VSTORE(dst + k, v);
+#endif
+			for (; k < n; k++)
+				dst[k] = value;
+		}
+
+		void scaleOffset(float* dst, const float* src, int n, float scale, float offset){
+			int k = 0;
+#ifdef VWIDTH
+			vfloat vs = VSET1(scale), vo = VSET1(offset);
+			for (; k + VWIDTH <= n; k += VWIDTH)
+				VSTORE(dst + k, VADD(VMUL(VLOAD(src + k), vs), vo));
+#endif
+			for (; k < n; k++)
+				dst[k] = src[k] * scale + offset;
+		}
+
+		void add(float* dst, const float* a, const float* b, int n){
+			int k = 0;
+#ifdef VWIDTH
+			for (; k + VWIDTH <= n; k += VWIDTH)
+				VSTORE(dst + k, VADD(VLOAD(a + k), VLOAD(b + k)));
+#endif
+			for (; k < n; k++)
+				dst[k] = a[k] + b[k];
+		}
+
+		void mul(float* dst, const float* a, const float* b, int n){
+			int k = 0;
+#ifdef VWIDTH
+			for (; k + VWIDTH <= n; k += VWIDTH)
+				VSTORE(dst + k, VMUL(VLOAD(a + k), VLOAD(b + k)));
+#endif
+			for (; k < n; k++)
+				dst[k] = a[k] * b[k];
+		}
+
+		float min(const float* src, int n){
+			if (n <= 0)
+				return 0;
+			float res = src[0];
+			int k = 0;
+#ifdef VWIDTH
+			if (n >= VWIDTH){
+				vfloat v = VLOAD(src);
+				for (k = VWIDTH; k + VWIDTH <= n; k += VWIDTH)
+					v = VMIN(v, VLOAD(src + k));
+				float lanes[VWIDTH];
+				VSTORE(lanes, v);
+				for (int i = 0; i < VWIDTH; i++)
+					if (lanes[i] < res) res = lanes[i];
+			}
+#endif
+			for (; k < n; k++)
+				if (src[k] < res) res = src[k];
+			return res;
+		}
+
+		float max(const float* src, int n){
+			if (n <= 0)
+				return 0;
+			float res = src[0];
+			int k = 0;
+#ifdef VWIDTH
+			if (n >= VWIDTH){
+				vfloat v = VLOAD(src);
+				for (k = VWIDTH; k + VWIDTH <= n; k += VWIDTH)
+					v = VMAX(v, VLOAD(src + k));
+				float lanes[VWIDTH];
+				VSTORE(lanes, v);
+				for (int i = 0; i < VWIDTH; i++)
+					if (lanes[i] > res) res = lanes[i];
+			}
+#endif
+			for (; k < n; k++)
+				if (src[k] > res) res = src[k];
+			return res;
+		}
+
+		//Float lanes are summed in blocks and each block is added in double, to bound the rounding error
+		double sum(const float* src, int n){
+			enum {Block = 1024};
+			double res = 0;
+			int k = 0;
+#ifdef VWIDTH
+			while (k + VWIDTH <= n){
+				int end = k + Block < n ? k + Block : n;
+				vfloat v = VSET1(0.0f);
+				for (; k + VWIDTH <= end; k += VWIDTH)
+					v = VADD(v, VLOAD(src + k));
+				float lanes[VWIDTH];
+				VSTORE(lanes, v);
+				for (int i = 0; i < VWIDTH; i++)
+					res += lanes[i];
+			}
+#endif
+			for (; k < n; k++)
+				res += src[k];
+			return res;
+		}
+
+		void u8ToFloat(float* dst, const unsigned char* src, int n, float scale){
+			int k = 0;
+#ifdef BEA_SIMD_SSE2
+			__m128 vs = _mm_set1_ps(scale);
+			__m128i zero = _mm_setzero_si128();
+			for (; k + 16 <= n; k += 16){
+				__m128i b = _mm_loadu_si128((const __m128i*)(src + k));
+				__m128i lo = _mm_unpacklo_epi8(b, zero);
+				__m128i hi = _mm_unpackhi_epi8(b, zero);
+				_mm_storeu_ps(dst + k, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), vs));
+				_mm_storeu_ps(dst + k + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), vs));
+				_mm_storeu_ps(dst + k + 8, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), vs));
+				_mm_storeu_ps(dst + k + 12, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), vs));
+			}
+#endif
+			for (; k < n; k++)
+				dst[k] = src[k] * scale;
+		}
+
+		void floatToU8(unsigned char* dst, const float* src, int n, float scale){
+			int k = 0;
+#ifdef BEA_SIMD_SSE2
+			//Clamp first (max returns 0 for NaN), truncate, then round up fractions of 0.5 and more: v - trunc(v) is exact
+			__m128 vs = _mm_set1_ps(scale);
+			__m128 zero = _mm_setzero_ps();
+			__m128 top = _mm_set1_ps(255.0f);
+			__m128 half = _mm_set1_ps(0.5f);
+			__m128i i[4];
+			for (; k + 16 <= n; k += 16){
+				for (int j = 0; j < 4; j++){
+					__m128 v = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + k + j * 4), vs), zero), top);
+					__m128i t = _mm_cvttps_epi32(v);
+					__m128 up = _mm_cmpge_ps(_mm_sub_ps(v, _mm_cvtepi32_ps(t)), half);
+					i[j] = _mm_sub_epi32(t, _mm_castps_si128(up));
+				}
+				__m128i w = _mm_packus_epi16(_mm_packs_epi32(i[0], i[1]), _mm_packs_epi32(i[2], i[3]));
+				_mm_storeu_si128((__m128i*)(dst + k), w);
+			}
+#endif
+			for (; k < n; k++){
+				float v = src[k] * scale;
+				if (!(v > 0.0f))
+					dst[k] = 0;		//NaN too
+				else if (v >= 255.0f)
+					dst[k] = 255;
+				else {
+					int t = (int)v;
+					dst[k] = (unsigned char)(v - (float)t >= 0.5f ? t + 1 : t);
+				}
+			}
+		}
+	}
+}
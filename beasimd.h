@@ -0,0 +1,31 @@
+#ifndef __BEASIMD_H__
+#define __BEASIMD_H__
+
+//Bulk kernels over float and byte buffers.
+//Uses AVX when the library is compiled with AVX enabled (BEA_ENABLE_AVX), SSE2 on x86, and plain loops elsewhere.
+//Pointers need no particular alignment.
+
+namespace bea{
+	namespace simd{
+
+		//"avx", "sse2" or "scalar"
+		const char* instructionSet();
+
+		void fill(float* dst, int n, float value);
+		//dst[i] = src[i] * scale + offset; dst may be src
+		void scaleOffset(float* dst, const float* src, int n, float scale, float offset);
+		void add(float* dst, const float* a, const float* b, int n);
+		void mul(float* dst, const float* a, const float* b, int n);
+
+		float min(const float* src, int n);
+		float max(const float* src, int n);
+		double sum(const float* src, int n);
+
+		//dst[i] = src[i] * scale
+		void u8ToFloat(float* dst, const unsigned char* src, int n, float scale);
+		//dst[i] = src[i] * scale, clamped to 0..255 and rounded half away from zero, as BufferOps saturates; NaN gives 0
+		void floatToU8(unsigned char* dst, const float* src, int n, float scale);
+	}
+}
+
+#endif //__BEASIMD_H__
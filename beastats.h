@@ -0,0 +1,329 @@
+#ifndef __BEASTATS_H__
+#define __BEASTATS_H__
+
+//Per-binding call instrumentation.
+//Only compiled in when BEA_ENABLE_STATS is defined; bea.h turns the hooks into no-ops otherwise.
+
+#include <v8.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include "beaplatform.h"
+
+namespace bea{
+
+	//Lock-free latency histogram. Bucket k holds samples in [2^k, 2^(k+1)) nanoseconds.
+	class LatencyHistogram{
+	public:
+		enum {BucketCount = 48};
+	private:
+		boost::atomic<uint64> m_buckets[BucketCount];
+	public:
+		LatencyHistogram(){
+			reset();
+		}
+
+		static inline int bucketOf(uint64 ns){
+			int b = 0;
+			while (ns >>= 1) b++;
+			return b < BucketCount ? b : BucketCount - 1;
+		}
+
+		inline void record(uint64 ns){
+			m_buckets[bucketOf(ns)].fetch_add(1, boost::memory_order_relaxed);
+		}
+
+		//Approximate p-th percentile (0..100) in nanoseconds, interpolated inside the bucket
+		uint64 percentile(double p) const{
+			uint64 counts[BucketCount];
+			uint64 total = 0;
+			for (int k = 0; k < BucketCount; k++){
+				counts[k] = m_buckets[k].load(boost::memory_order_relaxed);
+				total += counts[k];
+			}
+			if (total == 0)
+				return 0;
+
+			double rank = p / 100.0 * (double)total;
+			uint64 seen = 0;
+			for (int k = 0; k < BucketCount; k++){
+				if (counts[k] == 0) continue;
+				if ((double)(seen + counts[k]) >= rank){
+					double lo = k == 0 ? 0.0 : (double)(1ULL << k);
+					double hi = (double)(1ULL << (k + 1));
+					double frac = (rank - (double)seen) / (double)counts[k];
+					return (uint64)(lo + (hi - lo) * frac);
+				}
+				seen += counts[k];
+			}
+			return 1ULL << BucketCount;
+		}
+
+		void reset(){
+			for (int k = 0; k < BucketCount; k++)
+				m_buckets[k].store(0, boost::memory_order_relaxed);
+		}
+	};
+
+	//Counters of a single binding (exposed method, JS function called from C++, or derived class callback)
+	struct CallStats{
+		std::string name;
+		boost::atomic<uint64> calls;
+		boost::atomic<uint64> totalNs;
+		boost::atomic<uint64> maxNs;
+		boost::atomic<uint64> convertNs;
+		boost::atomic<uint64> failures;
+		boost::atomic<uint64> bytesIn;
+		boost::atomic<uint64> bytesOut;
+		LatencyHistogram latency;
+
+		CallStats(const std::string& n): name(n){
+			reset();
+		}
+
+		inline void record(uint64 elapsed, uint64 convert){
+			calls.fetch_add(1, boost::memory_order_relaxed);
+			totalNs.fetch_add(elapsed, boost::memory_order_relaxed);
+			convertNs.fetch_add(convert, boost::memory_order_relaxed);
+			latency.record(elapsed);
+
+			uint64 prev = maxNs.load(boost::memory_order_relaxed);
+			while (elapsed > prev && !maxNs.compare_exchange_weak(prev, elapsed, boost::memory_order_relaxed)) {}
+		}
+
+		void reset(){
+			calls = 0; totalNs = 0; maxNs = 0; convertNs = 0;
+			failures = 0; bytesIn = 0; bytesOut = 0;
+			latency.reset();
+		}
+	};
+
+	//Plain copy of CallStats, for querying from C++
+	struct CallStatsSnapshot{
+		std::string name;
+		uint64 calls, totalNs, maxNs, convertNs, failures, bytesIn, bytesOut;
+		uint64 p50Ns, p90Ns, p99Ns;
+	};
+
+	//An exposed callback routed through Stats::trampoline
+	struct CallBinding{
+		v8::InvocationCallback cb;
+		CallStats* stats;
+	};
+
+	//The binding call currently running on this thread. Conversions and failures are attributed to it.
+	class CallScope{
+		CallStats* m_stats;
+		CallScope* m_prev;
+		uint64 m_start;
+		uint64 m_convertNs;
+		int m_convertDepth;
+		friend class ConvertScope;
+	public:
+		static inline CallScope*& current(){
+			static BEA_THREAD_LOCAL CallScope* s_current = NULL;
+			return s_current;
+		}
+
+		inline CallScope(CallStats* stats): m_stats(stats), m_start(0), m_convertNs(0), m_convertDepth(0){
+			m_prev = current();
+			current() = this;
+			if (m_stats)
+				m_start = nowNs();
+		}
+
+		inline ~CallScope(){
+			if (m_stats)
+				m_stats->record(nowNs() - m_start, m_convertNs);
+			current() = m_prev;
+		}
+
+		static inline void failure(){
+			CallScope* s = current();
+			if (s && s->m_stats)
+				s->m_stats->failures.fetch_add(1, boost::memory_order_relaxed);
+		}
+
+		static inline void bytesIn(size_t n){
+			CallScope* s = current();
+			if (s && s->m_stats)
+				s->m_stats->bytesIn.fetch_add(n, boost::memory_order_relaxed);
+		}
+
+		static inline void bytesOut(size_t n){
+			CallScope* s = current();
+			if (s && s->m_stats)
+				s->m_stats->bytesOut.fetch_add(n, boost::memory_order_relaxed);
+		}
+	};
+
+	//Times a Convert<T> call. Only the outermost conversion of a nested one (eg. vector of strings) is timed.
+	class ConvertScope{
+		CallScope* m_call;
+		uint64 m_start;
+	public:
+		inline ConvertScope(): m_call(CallScope::current()), m_start(0){
+			if (m_call && !m_call->m_stats)
+				m_call = NULL;
+			if (m_call && m_call->m_convertDepth++ == 0)
+				m_start = nowNs();
+		}
+		inline ~ConvertScope(){
+			if (m_call && --m_call->m_convertDepth == 0)
+				m_call->m_convertNs += nowNs() - m_start;
+		}
+	};
+
+	//Registry of all binding statistics
+	class Stats{
+		typedef std::map<std::string, CallStats*> StatsMap;
+
+		static inline StatsMap& registry(){
+			static StatsMap s_map;
+			return s_map;
+		}
+
+		static inline std::vector<CallBinding*>& bindings(){
+			static std::vector<CallBinding*> s_bindings;
+			return s_bindings;
+		}
+
+		static inline boost::mutex& lock(){
+			static boost::mutex s_lock;
+			return s_lock;
+		}
+
+		static inline boost::atomic<bool>& enabledFlag(){
+			static boost::atomic<bool> s_enabled(true);
+			return s_enabled;
+		}
+
+		static inline double ms(uint64 ns){
+			return (double)ns / 1e6;
+		}
+
+	public:
+		static inline bool enabled(){
+			return enabledFlag().load(boost::memory_order_relaxed);
+		}
+
+		static inline void setEnabled(bool enabled){
+			enabledFlag().store(enabled);
+		}
+
+		//Find or create the statistics for a binding. Returned pointers stay valid for the life of the process.
+		static CallStats* get(const std::string& name){
+			boost::lock_guard<boost::mutex> guard(lock());
+			StatsMap::iterator iter = registry().find(name);
+			if (iter != registry().end())
+				return iter->second;
+			CallStats* stats = new CallStats(name);
+			registry()[name] = stats;
+			return stats;
+		}
+
+		//Wrap an exposed callback so that each call is counted and timed
+		static v8::Handle<v8::FunctionTemplate> instrument(const std::string& name, v8::InvocationCallback cb){
+			CallBinding* binding = new CallBinding();
+			binding->cb = cb;
+			binding->stats = get(name);
+			{
+				boost::lock_guard<boost::mutex> guard(lock());
+				bindings().push_back(binding);
+			}
+			return v8::FunctionTemplate::New(trampoline, v8::External::New(binding));
+		}
+
+		static v8::Handle<v8::Value> trampoline(const v8::Arguments& args){
+			v8::Local<v8::External> edata = v8::Local<v8::External>::Cast(args.Data());
+			CallBinding* binding = static_cast<CallBinding*>(edata->Value());
+#ifdef BEA_ENABLE_TRACE
+			TraceSpan span("native", binding->stats->name.c_str());
+#endif
+			if (!enabled())
+				return binding->cb(args);
+
+			CallScope scope(binding->stats);
+			return binding->cb(args);
+		}
+
+		static void reset(){
+			boost::lock_guard<boost::mutex> guard(lock());
+			for (StatsMap::iterator iter = registry().begin(); iter != registry().end(); iter++)
+				iter->second->reset();
+		}
+
+		static void snapshot(std::vector<CallStatsSnapshot>& out){
+			boost::lock_guard<boost::mutex> guard(lock());
+			out.clear();
+			for (StatsMap::iterator iter = registry().begin(); iter != registry().end(); iter++){
+				CallStats* s = iter->second;
+				CallStatsSnapshot snap;
+				snap.name = s->name;
+				snap.calls = s->calls;
+				snap.totalNs = s->totalNs;
+				snap.maxNs = s->maxNs;
+				snap.convertNs = s->convertNs;
+				snap.failures = s->failures;
+				snap.bytesIn = s->bytesIn;
+				snap.bytesOut = s->bytesOut;
+				snap.p50Ns = s->latency.percentile(50);
+				snap.p90Ns = s->latency.percentile(90);
+				snap.p99Ns = s->latency.percentile(99);
+				out.push_back(snap);
+			}
+		}
+
+		//Statistics as a javascript object: { "Class.method": {calls, totalMs, ...}, ... }
+		static v8::Handle<v8::Value> ToJS(){
+			v8::HandleScope scope;
+			std::vector<CallStatsSnapshot> snaps;
+			snapshot(snaps);
+
+			v8::Local<v8::Object> res = v8::Object::New();
+			for (size_t k = 0; k < snaps.size(); k++){
+				const CallStatsSnapshot& s = snaps[k];
+				v8::Local<v8::Object> o = v8::Object::New();
+				o->Set(v8::String::NewSymbol("calls"), v8::Number::New((double)s.calls));
+				o->Set(v8::String::NewSymbol("totalMs"), v8::Number::New(ms(s.totalNs)));
+				o->Set(v8::String::NewSymbol("convertMs"), v8::Number::New(ms(s.convertNs)));
+				o->Set(v8::String::NewSymbol("nativeMs"), v8::Number::New(ms(s.totalNs - s.convertNs)));
+				o->Set(v8::String::NewSymbol("maxMs"), v8::Number::New(ms(s.maxNs)));
+				o->Set(v8::String::NewSymbol("p50Ms"), v8::Number::New(ms(s.p50Ns)));
+				o->Set(v8::String::NewSymbol("p90Ms"), v8::Number::New(ms(s.p90Ns)));
+				o->Set(v8::String::NewSymbol("p99Ms"), v8::Number::New(ms(s.p99Ns)));
+				o->Set(v8::String::NewSymbol("failures"), v8::Number::New((double)s.failures));
+				o->Set(v8::String::NewSymbol("bytesIn"), v8::Number::New((double)s.bytesIn));
+				o->Set(v8::String::NewSymbol("bytesOut"), v8::Number::New((double)s.bytesOut));
+				res->Set(v8::String::New(s.name.c_str()), o);
+			}
+			return scope.Close(res);
+		}
+
+		//Javascript: callStats() returns the statistics; callStats('reset'), callStats(false), callStats(true)
+		static v8::Handle<v8::Value> jsCallStats(const v8::Arguments& args){
+			if (args.Length() > 0){
+				if (args[0]->IsBoolean())
+					setEnabled(args[0]->BooleanValue());
+				else if (args[0]->IsString() && std::string(*v8::String::Utf8Value(args[0])) == "reset")
+					reset();
+				return v8::Undefined();
+			}
+			return ToJS();
+		}
+	};
+}
+
+//The hooks used by bea.h; LatencyHistogram and the other classes can be used without them
+#ifdef BEA_ENABLE_STATS
+#define BEA_STATS_CALL_SCOPE(stats) bea::CallScope __bea_call_scope((stats))
+#define BEA_STATS_CONVERT_SCOPE() bea::ConvertScope __bea_convert_scope
+#define BEA_STATS_FAILURE() bea::CallScope::failure()
+#define BEA_STATS_BYTES_IN(n) bea::CallScope::bytesIn((n))
+#define BEA_STATS_BYTES_OUT(n) bea::CallScope::bytesOut((n))
+#endif
+
+#endif //__BEASTATS_H__
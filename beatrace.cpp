@@ -0,0 +1,200 @@
+#include "beatrace.h"
+#include "beajson.h"
+#include <stdio.h>
+#include <vector>
+#include <sstream>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+
+namespace bea{
+
+	//All thread buffers, for the exporter. Buffers are kept when their thread exits.
+	static std::vector<TraceBuffer*>& buffers(){
+		static std::vector<TraceBuffer*> s_buffers;
+		return s_buffers;
+	}
+
+	static boost::mutex& traceLock(){
+		static boost::mutex s_lock;
+		return s_lock;
+	}
+
+	//Bumped by start(); buffers of an older generation are emptied by their thread before the next event
+	static boost::atomic<unsigned int> s_generation(0);
+	static size_t s_capacity = 65536;
+
+	//An exposed callback routed through Tracer::trampoline
+	struct TraceBinding{
+		v8::InvocationCallback cb;
+		std::string name;
+	};
+
+	TraceBuffer* Tracer::createBuffer(){
+		boost::lock_guard<boost::mutex> guard(traceLock());
+		TraceBuffer* b = new TraceBuffer();
+		b->events = NULL;
+		b->capacity = 0;
+		b->count = 0;
+		b->dropped = 0;
+		b->generation = (unsigned int)-1;
+		b->tid = (int)buffers().size() + 1;
+		std::stringstream s;
+		s << "thread " << b->tid;
+		b->threadName = s.str();
+		buffers().push_back(b);
+		return b;
+	}
+
+	TraceBuffer* Tracer::buffer(){
+		TraceBuffer*& b = threadBuffer();
+		if (!b)
+			b = createBuffer();
+		unsigned int generation = s_generation.load(boost::memory_order_acquire);
+		if (b->generation != generation){
+			//Under the lock, so the exporter never reads a buffer being reset
+			boost::lock_guard<boost::mutex> guard(traceLock());
+			if (b->capacity != s_capacity){
+				delete[] b->events;
+				b->events = new TraceEvent[s_capacity];
+				b->capacity = s_capacity;
+			}
+			b->count.store(0, boost::memory_order_relaxed);
+			b->dropped.store(0, boost::memory_order_relaxed);
+			b->generation = generation;
+		}
+		return b;
+	}
+
+	void Tracer::start(size_t eventsPerThread){
+		boost::lock_guard<boost::mutex> guard(traceLock());
+		s_capacity = eventsPerThread > 0 ? eventsPerThread : 1;
+		startTime().store(nowNs(), boost::memory_order_relaxed);
+		s_generation.fetch_add(1, boost::memory_order_release);
+		enabledFlag().store(true);
+	}
+
+	void Tracer::stop(){
+		enabledFlag().store(false);
+	}
+
+	void Tracer::setThreadName(const char* name){
+		TraceBuffer*& b = threadBuffer();
+		if (!b)
+			b = createBuffer();
+		boost::lock_guard<boost::mutex> guard(traceLock());
+		b->threadName = name;
+	}
+
+	size_t Tracer::dropped(){
+		boost::lock_guard<boost::mutex> guard(traceLock());
+		unsigned int generation = s_generation.load();
+		size_t n = 0;
+		for (size_t k = 0; k < buffers().size(); k++){
+			if (buffers()[k]->generation == generation)
+				n += buffers()[k]->dropped.load(boost::memory_order_relaxed);
+		}
+		return n;
+	}
+
+	//{"traceEvents": [...], "displayTimeUnit": "ms", "otherData": {"dropped": n}}, timestamps in microseconds
+	//from start(). Complete events ("X") for the spans, one metadata event ("M") per thread for its name.
+	void Tracer::exportJSON(std::string& out){
+		JSONWriter w;
+		size_t dropped = 0;
+		{
+			boost::lock_guard<boost::mutex> guard(traceLock());
+			unsigned int generation = s_generation.load();
+			uint64 startNs = startTime().load();
+
+			w.beginObject();
+			w.key("traceEvents");
+			w.beginArray();
+			for (size_t k = 0; k < buffers().size(); k++){
+				TraceBuffer* b = buffers()[k];
+				if (b->generation != generation)
+					continue;
+				dropped += b->dropped.load(boost::memory_order_relaxed);
+
+				w.beginObject();
+				w.key("ph"); w.value("M", 1);
+				w.key("name"); w.value(std::string("thread_name"));
+				w.key("pid"); w.value(1LL);
+				w.key("tid"); w.value((long long)b->tid);
+				w.key("args");
+				w.beginObject();
+				w.key("name"); w.value(b->threadName);
+				w.endObject();
+				w.endObject();
+
+				size_t n = b->count.load(boost::memory_order_acquire);
+				for (size_t j = 0; j < n; j++){
+					const TraceEvent& e = b->events[j];
+					//Recorded by a thread which had not yet seen the latest start()
+					if (e.startNs < startNs)
+						continue;
+					w.beginObject();
+					w.key("ph"); w.value("X", 1);
+					w.key("cat"); w.value(e.category, strlen(e.category));
+					w.key("name"); w.value(e.name, strlen(e.name));
+					w.key("ts"); w.value((double)(e.startNs - startNs) / 1000.0);
+					w.key("dur"); w.value((double)e.durationNs / 1000.0);
+					w.key("pid"); w.value(1LL);
+					w.key("tid"); w.value((long long)b->tid);
+					w.endObject();
+				}
+			}
+			w.endArray();
+		}
+		w.key("displayTimeUnit"); w.value(std::string("ms"));
+		w.key("otherData");
+		w.beginObject();
+		w.key("dropped"); w.value((unsigned long long)dropped);
+		w.endObject();
+		w.endObject();
+		out = w.str();
+	}
+
+	bool Tracer::writeFile(const char* fileName){
+		std::string json;
+		exportJSON(json);
+		FILE* file = fopen(fileName, "wb");
+		if (!file)
+			return false;
+		bool ok = fwrite(json.data(), 1, json.size(), file) == json.size();
+		return fclose(file) == 0 && ok;
+	}
+
+	v8::Handle<v8::FunctionTemplate> Tracer::instrument(const std::string& name, v8::InvocationCallback cb){
+		TraceBinding* binding = new TraceBinding();
+		binding->cb = cb;
+		binding->name = name;
+		return v8::FunctionTemplate::New(trampoline, v8::External::New(binding));
+	}
+
+	v8::Handle<v8::Value> Tracer::trampoline(const v8::Arguments& args){
+		v8::Local<v8::External> edata = v8::Local<v8::External>::Cast(args.Data());
+		TraceBinding* binding = static_cast<TraceBinding*>(edata->Value());
+		if (!enabled())
+			return binding->cb(args);
+
+		TraceSpan span("native", binding->name.c_str());
+		return binding->cb(args);
+	}
+
+	v8::Handle<v8::Value> Tracer::jsTrace(const v8::Arguments& args){
+		if (args.Length() > 0){
+			if (args[0]->IsBoolean()){
+				if (args[0]->BooleanValue())
+					start();
+				else
+					stop();
+			}
+			else if (args[0]->IsString())
+				return v8::Boolean::New(writeFile(*v8::String::Utf8Value(args[0])));
+			return v8::Undefined();
+		}
+		std::string json;
+		exportJSON(json);
+		return v8::String::New(json.data(), (int)json.size());
+	}
+}
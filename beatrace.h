@@ -0,0 +1,128 @@
+#ifndef __BEATRACE_H__
+#define __BEATRACE_H__
+
+//Timeline tracing.
+//Spans (script and module loads, compiles, calls into javascript, native methods, derived class callbacks) are
+//recorded into per-thread buffers and exported in the Chrome trace-event format (chrome://tracing, Perfetto).
+//Only compiled in when BEA_ENABLE_TRACE is defined; recording is switched on at runtime and costs a flag test when off.
+
+#include <v8.h>
+#include <string>
+#include <string.h>
+#include <boost/atomic.hpp>
+#include "beaplatform.h"
+
+namespace bea{
+
+	struct TraceEvent{
+		enum {NameSize = 48};
+		const char* category;	//String literal
+		uint64 startNs;
+		uint64 durationNs;
+		char name[NameSize];
+	};
+
+	//Events of one thread. Only the owning thread writes; the exporter reads the events published by count.
+	struct TraceBuffer{
+		TraceEvent* events;
+		size_t capacity;
+		boost::atomic<size_t> count;
+		boost::atomic<size_t> dropped;
+		unsigned int generation;
+		int tid;
+		std::string threadName;
+	};
+
+	class Tracer{
+		static inline boost::atomic<bool>& enabledFlag(){
+			static boost::atomic<bool> s_enabled(false);
+			return s_enabled;
+		}
+
+		//Time of the last start(); spans which began before it belong to no trace
+		static inline boost::atomic<uint64>& startTime(){
+			static boost::atomic<uint64> s_startNs(0);
+			return s_startNs;
+		}
+
+		static inline TraceBuffer*& threadBuffer(){
+			static BEA_THREAD_LOCAL TraceBuffer* s_buffer = NULL;
+			return s_buffer;
+		}
+
+		static TraceBuffer* createBuffer();
+		//Buffer of the calling thread, emptied if it holds events of an earlier start()
+		static TraceBuffer* buffer();
+
+	public:
+		static inline bool enabled(){
+			return enabledFlag().load(boost::memory_order_relaxed);
+		}
+
+		//Start recording, dropping the events of the previous trace. Each thread keeps up to eventsPerThread events.
+		static void start(size_t eventsPerThread = 65536);
+		static void stop();
+
+		static inline void record(const char* category, const char* name, uint64 startNs, uint64 endNs){
+			TraceBuffer* b = buffer();
+			if (startNs < startTime().load(boost::memory_order_relaxed))
+				return;
+			size_t n = b->count.load(boost::memory_order_relaxed);
+			if (n >= b->capacity){
+				b->dropped.fetch_add(1, boost::memory_order_relaxed);
+				return;
+			}
+			TraceEvent& e = b->events[n];
+			e.category = category;
+			e.startNs = startNs;
+			e.durationNs = endNs - startNs;
+			strncpy(e.name, name ? name : "", TraceEvent::NameSize - 1);
+			e.name[TraceEvent::NameSize - 1] = '\0';
+			b->count.store(n + 1, boost::memory_order_release);
+		}
+
+		//Name shown for the calling thread
+		static void setThreadName(const char* name);
+
+		//Events lost because a thread buffer was full
+		static size_t dropped();
+
+		//The recorded events as Chrome trace-event JSON
+		static void exportJSON(std::string& out);
+		static bool writeFile(const char* fileName);
+
+		//Wrap an exposed callback so that each call is recorded as a span
+		static v8::Handle<v8::FunctionTemplate> instrument(const std::string& name, v8::InvocationCallback cb);
+		static v8::Handle<v8::Value> trampoline(const v8::Arguments& args);
+
+		//Javascript: trace(true) starts, trace(false) stops, trace('file.json') writes the trace to a file,
+		//trace() returns it as a string
+		static v8::Handle<v8::Value> jsTrace(const v8::Arguments& args);
+	};
+
+	//Records the lifetime of the scope as a span, if tracing was on when it started
+	class TraceSpan{
+		const char* m_category;
+		const char* m_name;
+		uint64 m_start;
+	public:
+		inline TraceSpan(const char* category, const char* name): m_category(category), m_name(name), m_start(0){
+			if (Tracer::enabled())
+				m_start = nowNs();
+		}
+		inline ~TraceSpan(){
+			if (m_start)
+				Tracer::record(m_category, m_name, m_start, nowNs());
+		}
+	};
+}
+
+//The hooks used by bea.h and the runtime
+#ifdef BEA_ENABLE_TRACE
+#define BEA_TRACE_CAT2(a, b) a##b
+#define BEA_TRACE_CAT(a, b) BEA_TRACE_CAT2(a, b)
+#define BEA_TRACE_SPAN(category, name) bea::TraceSpan BEA_TRACE_CAT(__bea_trace_span_, __LINE__)((category), (name))
+#define BEA_TRACE_THREAD_NAME(name) bea::Tracer::setThreadName((name))
+#endif
+
+#endif //__BEATRACE_H__
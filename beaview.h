@@ -0,0 +1,149 @@
+#ifndef __BEAVIEW_H__
+#define __BEAVIEW_H__
+
+//Struct views: a native struct returned to javascript without copying its fields into a new object.
+//Javascript gets an instance of a per-type template whose accessors read the fields from a native copy of the
+//struct, so the conversion cost depends on the fields the script actually reads, not on the size of the struct.
+
+#include "bea.h"
+
+namespace bea{
+
+	//One described field of T
+	template<class T>
+	struct ViewField{
+		virtual ~ViewField(){}
+		virtual v8::Handle<v8::Value> get(const T& obj) = 0;
+		virtual void set(T& obj, v8::Handle<v8::Value> v) = 0;
+	};
+
+	template<class T, class F>
+	struct ViewMember : public ViewField<T>{
+		F T::*member;
+		ViewMember(F T::*m): member(m){}
+
+		v8::Handle<v8::Value> get(const T& obj){
+			return Convert<F>::ToJS(obj.*member);
+		}
+		void set(T& obj, v8::Handle<v8::Value> v){
+			obj.*member = Convert<F>::FromJS(v, 0);
+		}
+	};
+
+	//A struct returned by view. Writes from javascript go to the native copy when writable is set,
+	//otherwise they throw.
+	template<class T>
+	struct view{
+		T value;
+		bool writable;
+		view(const T& v, bool canWrite = false): value(v), writable(canWrite){}
+	};
+
+	//Adds the accessors of the described fields to the view template
+	template<class T>
+	class ViewBuilder{
+		v8::Handle<v8::ObjectTemplate> m_tmpl;
+
+		static inline view<T>* holder(const v8::AccessorInfo& info){
+			return static_cast<view<T>*>(info.Holder()->GetPointerFromInternalField(0));
+		}
+
+		static inline ViewField<T>* field(const v8::AccessorInfo& info){
+			return static_cast<ViewField<T>*>(v8::Local<v8::External>::Cast(info.Data())->Value());
+		}
+
+		static v8::Handle<v8::Value> Get(v8::Local<v8::String> property, const v8::AccessorInfo& info){
+			return field(info)->get(holder(info)->value);
+		}
+
+		static void Set(v8::Local<v8::String> property, v8::Local<v8::Value> value, const v8::AccessorInfo& info){
+			view<T>* v = holder(info);
+			if (!v->writable){
+				v8::ThrowException(v8::Exception::TypeError(v8::String::NewSymbol("Native view is read-only")));
+				return;
+			}
+			try{
+				field(info)->set(v->value, value);
+			} catch(bea::ArgConvertException&){
+				//Already thrown to javascript
+			}
+		}
+
+	public:
+		ViewBuilder(v8::Handle<v8::ObjectTemplate> tmpl): m_tmpl(tmpl){}
+
+		//The field objects live as long as the template, that is, for the life of the process
+		template<class F>
+		void field(const char* name, F T::*member){
+			ViewField<T>* f = new ViewMember<T, F>(member);
+			m_tmpl->SetAccessor(v8::String::NewSymbol(name), Get, Set, v8::External::New(f), v8::DEFAULT, v8::DontDelete);
+		}
+	};
+
+	//Field list of a struct, specialized with the BEA_VIEW_STRUCT macros
+	template<class T> struct ViewFields;
+
+	//bea::view<T>
+	template<class T>
+	struct Convert<view<T> >{
+		typedef view<T> View;
+
+		static v8::Handle<v8::FunctionTemplate> functionTemplate(){
+			static v8::Persistent<v8::FunctionTemplate> s_tmpl;
+			if (s_tmpl.IsEmpty()){
+				v8::Handle<v8::FunctionTemplate> ftmpl = v8::FunctionTemplate::New();
+				ftmpl->SetClassName(v8::String::NewSymbol(ViewFields<T>::className()));
+				v8::Handle<v8::ObjectTemplate> otmpl = ftmpl->InstanceTemplate();
+				otmpl->SetInternalFieldCount(1);
+				ViewBuilder<T> builder(otmpl);
+				ViewFields<T>::Describe(builder);
+				s_tmpl = v8::Persistent<v8::FunctionTemplate>::New(ftmpl);
+			}
+			return s_tmpl;
+		}
+
+		static void WeakCallback(v8::Persistent<v8::Value> value, void* data){
+			delete static_cast<View*>(data);
+			value.Dispose();
+		}
+
+		static inline bool Is(v8::Handle<v8::Value> v){
+			return !v.IsEmpty() && functionTemplate()->HasInstance(v);
+		}
+
+		//Returns the native copy, including the writes made from javascript
+		static inline View FromJS(v8::Handle<v8::Value> v, int nArg){
+			static const char* msg = "Native view expected";
+			if (!Is(v)) BEATHROW();
+			return *static_cast<View*>(v->ToObject()->GetPointerFromInternalField(0));
+		}
+
+		static inline v8::Handle<v8::Value> ToJS(const View& val){
+			v8::HandleScope scope;
+			v8::Local<v8::Object> obj = functionTemplate()->InstanceTemplate()->NewInstance();
+			View* v = new View(val);
+			obj->SetPointerInInternalField(0, v);
+			v8::Persistent<v8::Object>::New(obj).MakeWeak(v, WeakCallback);
+			return scope.Close(obj);
+		}
+	};
+
+	template<class T> struct ArgMask<view<T> >{
+		enum {Value = BEA_ARG_BIT(ArgObject)};
+	};
+}
+
+//Describes the fields of a struct for bea::view<T>. Use at global scope:
+//	BEA_VIEW_STRUCT_BEGIN(Record)
+//		BEA_VIEW_FIELD(id)
+//		BEA_VIEW_FIELD(name)
+//	BEA_VIEW_STRUCT_END()
+#define BEA_VIEW_STRUCT_BEGIN(type) \
+	namespace bea{ template<> struct ViewFields<type >{ \
+		typedef type ViewType; \
+		static inline const char* className(){ return #type; } \
+		static inline void Describe(bea::ViewBuilder<type >& b){
+#define BEA_VIEW_FIELD(name) b.field(#name, &ViewType::name);
+#define BEA_VIEW_STRUCT_END() } }; }
+
+#endif //__BEAVIEW_H__
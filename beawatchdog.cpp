@@ -0,0 +1,91 @@
+#include "beawatchdog.h"
+#include "beascript.h"
+#include <sstream>
+
+namespace bea{
+
+	Watchdog::Watchdog(): m_nextToken(1), m_stop(false), m_started(false){
+		m_armed = 0;
+		m_timeouts = 0;
+	}
+
+	Watchdog::~Watchdog(){
+		{
+			boost::lock_guard<boost::mutex> guard(m_lock);
+			m_stop = true;
+		}
+		m_wake.notify_one();
+		if (m_started)
+			m_thread.join();
+	}
+
+	Watchdog& Watchdog::instance(){
+		static Watchdog s_watchdog;
+		return s_watchdog;
+	}
+
+	Watchdog::Token Watchdog::arm(BeaContext* ctx, int timeoutMs){
+		if (timeoutMs <= 0)
+			return 0;
+
+		Entry e;
+		e.ctx = ctx;
+		e.threadId = v8::V8::GetCurrentThreadId();
+		e.deadline = nowNs() + (uint64)timeoutMs * 1000000ULL;
+		e.timeoutMs = timeoutMs;
+		e.fired = false;
+
+		Token token;
+		{
+			boost::lock_guard<boost::mutex> guard(m_lock);
+			if (!m_started){
+				m_thread = boost::thread(&Watchdog::run, this);
+				m_started = true;
+			}
+			token = m_nextToken++;
+			m_entries[token] = e;
+		}
+		m_armed.fetch_add(1, boost::memory_order_relaxed);
+		m_wake.notify_one();
+		return token;
+	}
+
+	bool Watchdog::disarm(Token token){
+		//Holding the lock guarantees the watchdog won't terminate this entry after we return
+		boost::lock_guard<boost::mutex> guard(m_lock);
+		EntryMap::iterator iter = m_entries.find(token);
+		if (iter == m_entries.end())
+			return false;
+		bool fired = iter->second.fired;
+		m_entries.erase(iter);
+		return fired;
+	}
+
+	void Watchdog::run(){
+		boost::unique_lock<boost::mutex> lock(m_lock);
+		while (!m_stop){
+			uint64 now = nowNs();
+			uint64 next = 0;
+
+			for (EntryMap::iterator iter = m_entries.begin(); iter != m_entries.end(); iter++){
+				Entry& e = iter->second;
+				if (e.fired)
+					continue;
+				if (e.deadline <= now){
+					e.fired = true;
+					m_timeouts.fetch_add(1, boost::memory_order_relaxed);
+					std::stringstream s;
+					s << "Execution timed out after " << e.timeoutMs << " ms";
+					e.ctx->terminate(e.threadId, s.str().c_str());
+				}
+				else if (next == 0 || e.deadline < next)
+					next = e.deadline;
+			}
+
+			if (next == 0)
+				m_wake.wait(lock);
+			else
+				m_wake.timed_wait(lock, boost::posix_time::microseconds((next - now) / 1000 + 1));
+		}
+	}
+}
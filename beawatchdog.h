@@ -0,0 +1,87 @@
+#ifndef __BEAWATCHDOG_H__
+#define __BEAWATCHDOG_H__
+
+//Execution deadlines.
+//A single background thread watches the deadlines armed by running scripts and terminates
+//the script (V8::TerminateExecution) when one expires.
+
+#include <map>
+#include <boost/atomic.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include "beaplatform.h"
+
+namespace bea{
+
+	class BeaContext;
+
+	class Watchdog{
+	public:
+		typedef uint64 Token;
+	private:
+		struct Entry{
+			BeaContext* ctx;
+			int threadId;		//V8 id of the thread running the script
+			uint64 deadline;
+			int timeoutMs;
+			bool fired;
+		};
+		typedef std::map<Token, Entry> EntryMap;
+
+		EntryMap m_entries;
+		Token m_nextToken;
+		bool m_stop;
+		bool m_started;
+		boost::mutex m_lock;
+		boost::condition_variable m_wake;
+		boost::thread m_thread;
+		boost::atomic<uint64> m_armed;
+		boost::atomic<uint64> m_timeouts;
+
+		void run();
+
+	public:
+		Watchdog();
+		~Watchdog();
+
+		static Watchdog& instance();
+
+		//Start watching a deadline for the script this thread runs in ctx. Returns 0 if timeoutMs <= 0.
+		Token arm(BeaContext* ctx, int timeoutMs);
+
+		//Stop watching; returns true if the deadline expired and the script was terminated
+		bool disarm(Token token);
+
+		//Number of deadlines armed and hit since startup
+		uint64 armed(){
+			return m_armed.load();
+		}
+		uint64 timeouts(){
+			return m_timeouts.load();
+		}
+
+		//Arms a deadline for the lifetime of the scope
+		class Guard{
+			Token m_token;
+			bool m_fired;
+		public:
+			Guard(BeaContext* ctx, int timeoutMs): m_fired(false){
+				m_token = timeoutMs > 0 ? Watchdog::instance().arm(ctx, timeoutMs) : 0;
+			}
+			~Guard(){
+				disarm();
+			}
+			//Returns true if the deadline expired
+			bool disarm(){
+				if (m_token){
+					m_fired = Watchdog::instance().disarm(m_token);
+					m_token = 0;
+				}
+				return m_fired;
+			}
+		};
+	};
+}
+
+#endif //__BEAWATCHDOG_H__
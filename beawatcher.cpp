@@ -0,0 +1,120 @@
+#include "beawatcher.h"
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+namespace bea{
+
+	FileWatcher::FileWatcher(boost::atomic<bool>* flag, int pollMs): m_flag(flag), m_pollMs(pollMs), m_stop(false){
+#ifdef __linux__
+		m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+		m_thread = boost::thread(&FileWatcher::run, this);
+	}
+
+	FileWatcher::~FileWatcher(){
+		{
+			boost::lock_guard<boost::mutex> guard(m_lock);
+			m_stop = true;
+		}
+		m_thread.join();
+#ifdef __linux__
+		if (m_fd >= 0)
+			close(m_fd);
+#endif
+	}
+
+	std::string FileWatcher::normalize(const std::string& path){
+		boost::filesystem::path p = boost::filesystem::system_complete(path);
+		return p.parent_path().string() + "/" + p.filename().string();
+	}
+
+	void FileWatcher::addFile(const std::string& path){
+		std::string key = normalize(path);
+		boost::lock_guard<boost::mutex> guard(m_lock);
+		if (!m_files.insert(key).second)
+			return;
+
+#ifdef __linux__
+		//Watch the directory: editors often replace the file instead of writing to it
+		std::string dir = boost::filesystem::path(key).parent_path().string();
+		for (std::map<int, std::string>::iterator iter = m_dirs.begin(); iter != m_dirs.end(); iter++){
+			if (iter->second == dir)
+				return;
+		}
+		if (m_fd >= 0){
+			int wd = inotify_add_watch(m_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+			if (wd >= 0)
+				m_dirs[wd] = dir;
+		}
+#else
+		boost::system::error_code ec;
+		m_mtimes[key] = boost::filesystem::last_write_time(key, ec);
+#endif
+	}
+
+	//Called with m_lock held
+	void FileWatcher::changed(const std::string& path){
+		if (m_files.find(path) == m_files.end())
+			return;
+		m_changed.insert(path);
+		m_flag->store(true);
+	}
+
+	void FileWatcher::takeChanged(std::vector<std::string>& out){
+		boost::lock_guard<boost::mutex> guard(m_lock);
+		out.assign(m_changed.begin(), m_changed.end());
+		m_changed.clear();
+	}
+
+	void FileWatcher::run(){
+		for (;;){
+			{
+				boost::lock_guard<boost::mutex> guard(m_lock);
+				if (m_stop)
+					break;
+			}
+
+#ifdef __linux__
+			if (m_fd < 0){
+				boost::this_thread::sleep(boost::posix_time::milliseconds(m_pollMs));
+				continue;
+			}
+
+			pollfd pfd;
+			pfd.fd = m_fd;
+			pfd.events = POLLIN;
+			if (poll(&pfd, 1, m_pollMs) <= 0)
+				continue;
+
+			char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+			ssize_t len;
+			while ((len = read(m_fd, buf, sizeof(buf))) > 0){
+				boost::lock_guard<boost::mutex> guard(m_lock);
+				for (char* ptr = buf; ptr < buf + len; ){
+					inotify_event* ev = (inotify_event*)ptr;
+					std::map<int, std::string>::iterator dir = m_dirs.find(ev->wd);
+					if (ev->len > 0 && dir != m_dirs.end())
+						changed(dir->second + "/" + ev->name);
+					ptr += sizeof(inotify_event) + ev->len;
+				}
+			}
+#else
+			boost::this_thread::sleep(boost::posix_time::milliseconds(m_pollMs));
+			boost::lock_guard<boost::mutex> guard(m_lock);
+			for (std::map<std::string, std::time_t>::iterator iter = m_mtimes.begin(); iter != m_mtimes.end(); iter++){
+				boost::system::error_code ec;
+				std::time_t t = boost::filesystem::last_write_time(iter->first, ec);
+				if (!ec && t != iter->second){
+					iter->second = t;
+					changed(iter->first);
+				}
+			}
+#endif
+		}
+	}
+}
@@ -0,0 +1,50 @@
+#ifndef __BEAWATCHER_H__
+#define __BEAWATCHER_H__
+
+//Watches script files for changes (inotify on Linux, modification times elsewhere).
+//Changes are collected on a background thread; the script thread picks them up with takeChanged().
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <ctime>
+#include <boost/atomic.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace bea{
+
+	class FileWatcher{
+		boost::atomic<bool>* m_flag;
+		int m_pollMs;
+		bool m_stop;
+		boost::mutex m_lock;
+		std::set<std::string> m_files;
+		std::set<std::string> m_changed;
+		boost::thread m_thread;
+#ifdef __linux__
+		int m_fd;
+		std::map<int, std::string> m_dirs;	//inotify watch descriptor -> directory
+#else
+		std::map<std::string, std::time_t> m_mtimes;
+#endif
+		void run();
+		void changed(const std::string& path);
+
+	public:
+		//flag is set whenever a watched file changes
+		FileWatcher(boost::atomic<bool>* flag, int pollMs = 250);
+		~FileWatcher();
+
+		//Key under which a file is watched and reported
+		static std::string normalize(const std::string& path);
+
+		void addFile(const std::string& path);
+
+		//Files changed since the last call
+		void takeChanged(std::vector<std::string>& out);
+	};
+}
+
+#endif //__BEAWATCHER_H__
@@ -0,0 +1,81 @@
+#ifndef __BEA_BENCH_H__
+#define __BEA_BENCH_H__
+
+//Microbenchmark harness for the binding layer.
+//A benchmark is a function which runs its operation 'iterations' times; the harness picks
+//the iteration count, repeats the measurement and reports nanoseconds per operation.
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <cstdlib>
+#include "beascript.h"
+
+namespace beabench{
+
+	typedef void (*BenchFn)(size_t iterations, int arg);
+
+	struct Benchmark{
+		std::string name;
+		BenchFn fn;
+		int arg;
+	};
+
+	std::vector<Benchmark>& benchmarks();
+
+	//Registers a benchmark at static initialization time. Use the BEA_BENCH macros.
+	struct Registrar{
+		Registrar(const char* name, BenchFn fn, int arg){
+			Benchmark b;
+			b.name = name;
+			b.fn = fn;
+			b.arg = arg;
+			benchmarks().push_back(b);
+		}
+	};
+
+	extern const void* volatile g_sink;
+
+	//Keep the compiler from optimizing away a computed value
+	template<class T>
+	inline void keep(const T& v){
+		g_sink = &v;
+	}
+
+	//Benchmarks check their results where a wrong result would go unnoticed; a failed check ends the run
+	inline void check(bool ok, const char* what){
+		if (!ok){
+			std::cerr << "Check failed: " << what << std::endl;
+			exit(1);
+		}
+	}
+
+	//Script context shared by all benchmarks (bench.js loaded, entered by the harness)
+	bea::BeaContext* context();
+
+	//Directory holding the benchmark scripts
+	std::string benchDir();
+
+	//Native class exposed to the benchmark scripts as BenchPoint
+	struct BenchPoint{
+		int x, y;
+		BenchPoint(): x(0), y(0){}
+	};
+
+	//Native object receiving callbacks from an overriding javascript object
+	class BenchListener : public bea::DerivedClass{
+	public:
+		inline v8::Handle<v8::Value> fire(int value){
+			v8::Handle<v8::Value> argv[1] = {v8::Integer::New(value)};
+			return bea_derived_callJS("onEvent", 1, argv);
+		}
+	};
+}
+
+#define BEA_BENCH_CAT2(a, b) a##b
+#define BEA_BENCH_CAT(a, b) BEA_BENCH_CAT2(a, b)
+
+#define BEA_BENCH(name, fn) static beabench::Registrar BEA_BENCH_CAT(__bench_, __LINE__)(name, fn, 0)
+#define BEA_BENCH_ARG(name, fn, arg) static beabench::Registrar BEA_BENCH_CAT(__bench_, __LINE__)(name, fn, arg)
+
+#endif //__BEA_BENCH_H__
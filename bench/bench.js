@@ -0,0 +1,97 @@
+//Functions called by the bea_bench harness
+
+function benchEmpty(){
+}
+
+function benchAdd(a, b){
+	return a + b;
+}
+
+function benchNativeCall(n){
+	var p = new BenchPoint();
+	for (var i = 0; i < n; i++)
+		p.add(1, 2);
+	return p.x;
+}
+
+function benchCreateListener(){
+	return {
+		onEvent: function(x){
+			return x;
+		}
+	};
+}
+
+function benchInclude(n, fileName){
+	for (var i = 0; i < n; i++){
+		var module = {exports: {}};
+		loadCommonJSModule(fileName, {module: module, exports: module.exports});
+	}
+}
+
+//Array of records with repeated property names, for the clone benchmarks
+function benchMakeGraph(n){
+	var res = [];
+	for (var i = 0; i < n; i++){
+		res.push({
+			id: i,
+			name: "record " + i,
+			score: i * 0.5,
+			active: (i & 1) == 0,
+			tags: ["a", "b", "c"],
+			pos: {x: i, y: -i}
+		});
+	}
+	return res;
+}
+
+//Records sharing one object, with a cycle below the top level: clones must keep both
+function benchSharedGraph(n){
+	var res = [];
+	for (var i = 0; i < n; i++){
+		var shared = {id: i};
+		var node = {name: "node " + i};
+		node.self = node;
+		res.push({a: shared, b: shared, inner: {node: node, again: node}});
+	}
+	return res;
+}
+
+function benchCheckShared(v){
+	for (var i = 0; i < v.length; i++){
+		var r = v[i];
+		if (r.a !== r.b || r.a.id !== i)
+			return false;
+		if (r.inner.node !== r.inner.again || r.inner.node.self !== r.inner.node)
+			return false;
+	}
+	return true;
+}
+
+function benchStringify(v){
+	return JSON.stringify(v);
+}
+
+function benchParse(s){
+	return JSON.parse(s);
+}
+
+//Calls an overloaded method with each of its signatures; method is "set" (OverloadSet) or "setProbe"
+function benchOverload(n, method){
+	var p = new BenchPoint();
+	var q = new BenchPoint();
+	var set = p[method];
+	for (var i = 0; i < n; i += 5){
+		set.call(p, 1);
+		set.call(p, 1.5);
+		set.call(p, "abc");
+		set.call(p, q);
+		set.call(p, 1, 2);
+	}
+	return p.x;
+}
+
+//Reads two fields of a record returned by bench_view
+function benchReadTwo(r){
+	return r.f0 + r.f31;
+}
@@ -0,0 +1,147 @@
+//Wrapping, calls across the JS/native boundary, module loading and context creation
+
+#include "bench.h"
+#include "beaexecutor.h"
+
+using namespace beabench;
+
+namespace{
+
+	v8::Handle<v8::Value> callJS(const char* fnName, int argc, v8::Handle<v8::Value> argv[]){
+		return context()->call(fnName, argc, argv);
+	}
+
+	void wrap(size_t iterations, int){
+		BenchPoint pt;
+		for (size_t k = 0; k < iterations; k++){
+			v8::HandleScope scope;
+			keep(bea::ExposedClass<BenchPoint>::ToJS(&pt));
+		}
+	}
+
+	void unwrap(size_t iterations, int){
+		BenchPoint pt;
+		v8::HandleScope scope;
+		v8::Handle<v8::Value> obj = bea::ExposedClass<BenchPoint>::ToJS(&pt);
+		for (size_t k = 0; k < iterations; k++)
+			keep(bea::ExposedClass<BenchPoint>::FromJS(obj, 0));
+	}
+
+	//JS -> C++: bench.js calls BenchPoint.add 'iterations' times
+	void jsToNative(size_t iterations, int){
+		v8::HandleScope scope;
+		v8::Handle<v8::Value> argv[1] = {v8::Number::New((double)iterations)};
+		callJS("benchNativeCall", 1, argv);
+	}
+
+	//C++ -> JS: BeaContext::call of an empty function and of a function with two arguments
+	void nativeToJS(size_t iterations, int argc){
+		for (size_t k = 0; k < iterations; k++){
+			v8::HandleScope scope;
+			v8::Handle<v8::Value> argv[2] = {v8::Integer::New(1), v8::Integer::New(2)};
+			keep(callJS(argc == 0 ? "benchEmpty" : "benchAdd", argc, argv));
+		}
+	}
+
+	//Overloaded native method: OverloadSet table dispatch (0) or sequential Convert<T>::Is probes (1)
+	void overloadDispatch(size_t iterations, int probe){
+		v8::HandleScope scope;
+		v8::Handle<v8::Value> argv[2] = {
+			v8::Number::New((double)iterations),
+			v8::String::New(probe ? "setProbe" : "set")
+		};
+		callJS("benchOverload", 2, argv);
+	}
+
+	//Calls submitted from this thread to the context executor: one at a time (0) or pipelined (1)
+	void executorCall(size_t iterations, int pipelined){
+		bea::ContextExecutor* executor = context()->executor();
+		if (!executor)
+			executor = context()->startExecutor();
+
+		//The executor takes the locker held by the harness
+		v8::Unlocker unlocker;
+		boost::shared_future<int> last;
+		for (size_t k = 0; k < iterations; k++){
+			last = executor->call<int>("benchAdd", 1, 2);
+			if (!pipelined)
+				last.get();
+		}
+		if (last.valid())
+			last.get();
+	}
+
+	//benchAdd over 1000 records: one BeaContext::call per record (0) or one callBatch (1)
+	void batchCall(size_t iterations, int batched){
+		std::vector<std::pair<int, int> > records;
+		for (int k = 0; k < 1000; k++)
+			records.push_back(std::make_pair(k, 2 * k));
+		std::vector<int> results(records.size());
+
+		for (size_t k = 0; k < iterations; k++){
+			if (batched)
+				context()->callBatch("benchAdd", records, results);
+			else {
+				for (size_t i = 0; i < records.size(); i++){
+					v8::HandleScope scope;
+					v8::Handle<v8::Value> argv[2] = {
+						bea::Convert<int>::ToJS(records[i].first), 
+						bea::Convert<int>::ToJS(records[i].second)
+					};
+					results[i] = bea::Convert<int>::FromJS(callJS("benchAdd", 2, argv), 0);
+				}
+			}
+		}
+		keep(results);
+	}
+
+	//C++ -> JS through a DerivedClass override
+	void derivedCallback(size_t iterations, int){
+		v8::HandleScope scope;
+		v8::Handle<v8::Value> jsObj = callJS("benchCreateListener", 0, NULL);
+		BenchListener listener;
+		listener.bea_derived_setInstance(jsObj->ToObject());
+		for (size_t k = 0; k < iterations; k++){
+			v8::HandleScope inner;
+			keep(listener.fire((int)k));
+		}
+	}
+
+	//loadCommonJSModule of a small module
+	void includeModule(size_t iterations, int){
+		v8::HandleScope scope;
+		v8::Handle<v8::Value> argv[2] = {
+			v8::Number::New((double)iterations),
+			bea::Convert<std::string>::ToJS(benchDir() + "/bench_module.js")
+		};
+		callJS("benchInclude", 2, argv);
+	}
+
+	struct EmptyExposer{
+		static void expose(v8::Handle<v8::Object> target){}
+	};
+
+	//Full context setup: init(), loader.js, and an empty main script
+	void createContext(size_t iterations, int){
+		std::string fileName = benchDir() + "/bench_empty.js";
+		for (size_t k = 0; k < iterations; k++){
+			bea::BeaScript<EmptyExposer> script;
+			keep(script.loadScript(fileName.c_str()));
+		}
+	}
+}
+
+BEA_BENCH("wrap/toJS", wrap);
+BEA_BENCH("wrap/fromJS", unwrap);
+BEA_BENCH("call/js_to_native", jsToNative);
+BEA_BENCH_ARG("call/native_to_js/0args", nativeToJS, 0);
+BEA_BENCH_ARG("call/native_to_js/2args", nativeToJS, 2);
+BEA_BENCH_ARG("call/overload/table", overloadDispatch, 0);
+BEA_BENCH_ARG("call/overload/probe", overloadDispatch, 1);
+BEA_BENCH_ARG("call/executor/roundtrip", executorCall, 0);
+BEA_BENCH_ARG("call/executor/pipelined", executorCall, 1);
+BEA_BENCH_ARG("call/batch/1000/call", batchCall, 0);
+BEA_BENCH_ARG("call/batch/1000/callBatch", batchCall, 1);
+BEA_BENCH("call/derived_callback", derivedCallback);
+BEA_BENCH("module/include", includeModule);
+BEA_BENCH("context/create", createContext);
@@ -0,0 +1,62 @@
+//Moving a value between contexts: binary structured clone vs JSON.stringify/JSON.parse
+
+#include "bench.h"
+#include "beaclone.h"
+
+using namespace beabench;
+
+namespace{
+
+	v8::Handle<v8::Value> makeGraph(int records){
+		v8::Handle<v8::Value> argv[1] = {v8::Integer::New(records)};
+		return context()->call("benchMakeGraph", 1, argv);
+	}
+
+	void cloneBinary(size_t iterations, int records){
+		v8::HandleScope scope;
+		v8::Handle<v8::Value> graph = makeGraph(records);
+		bea::ValueSerializer writer;
+		for (size_t k = 0; k < iterations; k++){
+			v8::HandleScope inner;
+			writer.write(graph);
+			bea::ValueDeserializer reader(writer.data(), writer.size());
+			keep(reader.read());
+		}
+	}
+
+	//Shared and cyclic references below the top level; the result is checked on every iteration
+	void cloneShared(size_t iterations, int records){
+		v8::HandleScope scope;
+		v8::Handle<v8::Value> argv[1] = {v8::Integer::New(records)};
+		v8::Handle<v8::Value> graph = context()->call("benchSharedGraph", 1, argv);
+		bea::ValueSerializer writer;
+		for (size_t k = 0; k < iterations; k++){
+			v8::HandleScope inner;
+			check(writer.write(graph), "clone/shared: write");
+			bea::ValueDeserializer reader(writer.data(), writer.size());
+			argv[0] = reader.read();
+			v8::Handle<v8::Value> ok = context()->call("benchCheckShared", 1, argv);
+			check(!ok.IsEmpty() && ok->IsTrue(), "clone/shared: references preserved");
+		}
+	}
+
+	void cloneJSON(size_t iterations, int records){
+		v8::HandleScope scope;
+		v8::Handle<v8::Value> graph = makeGraph(records);
+		for (size_t k = 0; k < iterations; k++){
+			v8::HandleScope inner;
+			v8::Handle<v8::Value> argv[1] = {graph};
+			argv[0] = context()->call("benchStringify", 1, argv);
+			keep(context()->call("benchParse", 1, argv));
+		}
+	}
+}
+
+BEA_BENCH_ARG("clone/binary/10", cloneBinary, 10);
+BEA_BENCH_ARG("clone/binary/1000", cloneBinary, 1000);
+BEA_BENCH_ARG("clone/binary/10000", cloneBinary, 10000);
+BEA_BENCH_ARG("clone/shared/10", cloneShared, 10);
+BEA_BENCH_ARG("clone/shared/1000", cloneShared, 1000);
+BEA_BENCH_ARG("clone/json/10", cloneJSON, 10);
+BEA_BENCH_ARG("clone/json/1000", cloneJSON, 1000);
+BEA_BENCH_ARG("clone/json/10000", cloneJSON, 10000);
@@ -0,0 +1,232 @@
+//Convert<T> round trips for every built-in specialization
+
+#include "bench.h"
+#include <sstream>
+
+namespace{
+
+	//Sample<T>::make(size) builds a representative value; size is the length of strings and vectors
+	template<class T> struct Sample{
+		static T make(int){ return (T)100; }
+	};
+
+	template<> struct Sample<bool>{
+		static bool make(int){ return true; }
+	};
+
+	template<> struct Sample<double>{
+		static double make(int){ return 3.14159; }
+	};
+
+	template<> struct Sample<float>{
+		static float make(int){ return 3.14159f; }
+	};
+
+	template<> struct Sample<std::string>{
+		static std::string make(int size){ return std::string((size_t)size, 'x'); }
+	};
+
+	template<> struct Sample<bea::string>{
+		static bea::string make(int size){
+			bea::string s;
+			s.assign((size_t)size, 'x');
+			return s;
+		}
+	};
+
+	template<class T> struct Sample<std::vector<T> >{
+		static std::vector<T> make(int size){ return std::vector<T>((size_t)size, Sample<T>::make(16)); }
+	};
+
+	template<class T> struct Sample<bea::vector<T> >{
+		static bea::vector<T> make(int size){
+			bea::vector<T> v;
+			v.assign((size_t)size, Sample<T>::make(16));
+			return v;
+		}
+	};
+
+	template<class T> struct Sample<bea::lazy_vector<T> >{
+		static bea::lazy_vector<T> make(int size){ return bea::lazy_vector<T>(Sample<std::vector<T> >::make(size)); }
+	};
+
+	//Scratch values only point at their data; the samples point into storage kept by make()
+	template<> struct Sample<bea::scratch_string>{
+		static bea::scratch_string make(int size){
+			static std::string s_data;
+			s_data.assign((size_t)size, 'x');
+			return bea::scratch_string(s_data.c_str(), s_data.size());
+		}
+	};
+
+	template<class T> struct Sample<bea::scratch_vector<T> >{
+		static bea::scratch_vector<T> make(int size){
+			static std::vector<T> s_data;
+			s_data = Sample<std::vector<T> >::make(size);
+			return bea::scratch_vector<T>(s_data.empty() ? NULL : &s_data[0], s_data.size());
+		}
+	};
+
+	//size entries with keys "key0".."key<size-1>"
+	template<class M> struct SampleMap{
+		static M make(int size){
+			M m;
+			for (int k = 0; k < size; k++){
+				std::ostringstream key;
+				key << "key" << k;
+				m[key.str()] = Sample<typename M::mapped_type>::make(16);
+			}
+			return m;
+		}
+	};
+
+	template<class T> struct Sample<std::map<std::string, T> > : public SampleMap<std::map<std::string, T> >{
+	};
+
+	template<class T> struct Sample<boost::unordered_map<std::string, T> > : public SampleMap<boost::unordered_map<std::string, T> >{
+	};
+
+	template<class A, class B> struct Sample<std::pair<A, B> >{
+		static std::pair<A, B> make(int size){ return std::pair<A, B>(Sample<A>::make(size), Sample<B>::make(size)); }
+	};
+
+	template<class T> struct Sample<bea::external<T> >{
+		static bea::external<T> make(int){
+			static T buffer[16];
+			return bea::external<T>(buffer);
+		}
+	};
+
+	template<class T>
+	void toJS(size_t iterations, int size){
+		T val = Sample<T>::make(size);
+		for (size_t k = 0; k < iterations; k++){
+			v8::HandleScope scope;
+			beabench::keep(bea::Convert<T>::ToJS(val));
+		}
+	}
+
+	template<class T>
+	void fromJS(size_t iterations, int size){
+		v8::HandleScope scope;
+		v8::Handle<v8::Value> v = bea::Convert<T>::ToJS(Sample<T>::make(size));
+		for (size_t k = 0; k < iterations; k++){
+			//As METHOD_BEGIN does for each call
+			bea::ScratchScope scratch;
+			v8::HandleScope inner;
+			T res = bea::Convert<T>::FromJS(v, 0);
+			beabench::keep(res);
+		}
+	}
+
+	//Convert a vector of 1k elements and read the first reads elements, as a script would
+	template<class T>
+	void toJSRead(size_t iterations, int reads){
+		T val = Sample<T>::make(1024);
+		for (size_t k = 0; k < iterations; k++){
+			v8::HandleScope scope;
+			v8::Local<v8::Object> obj = bea::Convert<T>::ToJS(val)->ToObject();
+			for (int i = 0; i < reads; i++)
+				beabench::keep(obj->Get((uint32_t)i));
+		}
+	}
+
+	//The loops a binding writes without the map specializations: a new key string per entry
+	template<class T>
+	void mapToJSByHand(size_t iterations, int size){
+		std::map<std::string, T> val = Sample<std::map<std::string, T> >::make(size);
+		for (size_t k = 0; k < iterations; k++){
+			v8::HandleScope scope;
+			v8::Local<v8::Object> obj = v8::Object::New();
+			for (typename std::map<std::string, T>::const_iterator iter = val.begin(); iter != val.end(); iter++)
+				obj->Set(v8::String::New(iter->first.c_str()), bea::Convert<T>::ToJS(iter->second));
+			beabench::keep(obj);
+		}
+	}
+
+	template<class T>
+	void mapFromJSByHand(size_t iterations, int size){
+		v8::HandleScope scope;
+		v8::Handle<v8::Value> v = bea::Convert<std::map<std::string, T> >::ToJS(Sample<std::map<std::string, T> >::make(size));
+		for (size_t k = 0; k < iterations; k++){
+			v8::HandleScope inner;
+			v8::Local<v8::Object> obj = v->ToObject();
+			v8::Local<v8::Array> names = obj->GetPropertyNames();
+			std::map<std::string, T> res;
+			for (uint32_t i = 0; i < names->Length(); i++){
+				v8::Local<v8::Value> name = names->Get(i);
+				res[*v8::String::AsciiValue(name)] = bea::Convert<T>::FromJS(obj->Get(name), 0);
+			}
+			beabench::keep(res);
+		}
+	}
+}
+
+#define BENCH_CONVERT(T, name, size) \
+	static beabench::Registrar BEA_BENCH_CAT(__benchToJS_, __LINE__)("convert/" name "/toJS", toJS<T >, size); \
+	static beabench::Registrar BEA_BENCH_CAT(__benchFromJS_, __LINE__)("convert/" name "/fromJS", fromJS<T >, size)
+
+BENCH_CONVERT(int, "int", 0);
+BENCH_CONVERT(unsigned int, "uint", 0);
+BENCH_CONVERT(long, "long", 0);
+BENCH_CONVERT(unsigned long, "ulong", 0);
+BENCH_CONVERT(short, "short", 0);
+BENCH_CONVERT(unsigned short, "ushort", 0);
+BENCH_CONVERT(char, "char", 0);
+BENCH_CONVERT(unsigned char, "uchar", 0);
+BENCH_CONVERT(double, "double", 0);
+BENCH_CONVERT(float, "float", 0);
+BENCH_CONVERT(bool, "bool", 0);
+BENCH_CONVERT(bea::external<float>, "external", 0);
+
+BENCH_CONVERT(std::string, "string/16", 16);
+BENCH_CONVERT(std::string, "string/1k", 1024);
+BENCH_CONVERT(std::string, "string/64k", 65536);
+BENCH_CONVERT(bea::string, "bea_string/16", 16);
+BENCH_CONVERT(bea::scratch_string, "scratch_string/16", 16);
+BENCH_CONVERT(bea::scratch_string, "scratch_string/1k", 1024);
+BENCH_CONVERT(bea::scratch_string, "scratch_string/64k", 65536);
+
+BENCH_CONVERT(std::vector<int>, "vector_int/16", 16);
+BENCH_CONVERT(std::vector<int>, "vector_int/1k", 1024);
+BENCH_CONVERT(std::vector<int>, "vector_int/64k", 65536);
+BENCH_CONVERT(std::vector<double>, "vector_double/16", 16);
+BENCH_CONVERT(std::vector<double>, "vector_double/1k", 1024);
+BENCH_CONVERT(std::vector<double>, "vector_double/64k", 65536);
+BENCH_CONVERT(std::vector<std::string>, "vector_string/16", 16);
+BENCH_CONVERT(std::vector<std::string>, "vector_string/1k", 1024);
+BENCH_CONVERT(bea::vector<int>, "bea_vector_int/1k", 1024);
+BENCH_CONVERT(bea::scratch_vector<int>, "scratch_vector_int/1k", 1024);
+BENCH_CONVERT(bea::scratch_vector<int>, "scratch_vector_int/64k", 65536);
+BENCH_CONVERT(bea::scratch_vector<double>, "scratch_vector_double/1k", 1024);
+BENCH_CONVERT(bea::scratch_vector<std::string>, "scratch_vector_string/1k", 1024);
+BENCH_CONVERT(bea::lazy_vector<std::string>, "lazy_vector_string/16", 16);
+BENCH_CONVERT(bea::lazy_vector<std::string>, "lazy_vector_string/1k", 1024);
+
+//Element access: lazy vectors pay per element read
+BEA_BENCH_ARG("convert/vector_string/1k/toJS_read1", toJSRead<std::vector<std::string> >, 1);
+BEA_BENCH_ARG("convert/vector_string/1k/toJS_read32", toJSRead<std::vector<std::string> >, 32);
+BEA_BENCH_ARG("convert/vector_string/1k/toJS_readAll", toJSRead<std::vector<std::string> >, 1024);
+BEA_BENCH_ARG("convert/lazy_vector_string/1k/toJS_read1", toJSRead<bea::lazy_vector<std::string> >, 1);
+BEA_BENCH_ARG("convert/lazy_vector_string/1k/toJS_read32", toJSRead<bea::lazy_vector<std::string> >, 32);
+BEA_BENCH_ARG("convert/lazy_vector_string/1k/toJS_readAll", toJSRead<bea::lazy_vector<std::string> >, 1024);
+
+typedef std::map<std::string, int> MapInt;
+typedef std::map<std::string, std::string> MapString;
+typedef boost::unordered_map<std::string, int> UnorderedMapInt;
+typedef std::pair<int, std::string> PairIntString;
+
+BENCH_CONVERT(MapInt, "map_int/16", 16);
+BENCH_CONVERT(MapInt, "map_int/1k", 1024);
+BENCH_CONVERT(MapString, "map_string/16", 16);
+BENCH_CONVERT(UnorderedMapInt, "unordered_map_int/16", 16);
+BENCH_CONVERT(UnorderedMapInt, "unordered_map_int/1k", 1024);
+BENCH_CONVERT(PairIntString, "pair_int_string/16", 16);
+
+#define BENCH_MAP_BY_HAND(T, name, size) \
+	static beabench::Registrar BEA_BENCH_CAT(__benchToJSByHand_, __LINE__)("convert/" name "/by_hand/toJS", mapToJSByHand<T >, size); \
+	static beabench::Registrar BEA_BENCH_CAT(__benchFromJSByHand_, __LINE__)("convert/" name "/by_hand/fromJS", mapFromJSByHand<T >, size)
+
+BENCH_MAP_BY_HAND(int, "map_int/16", 16);
+BENCH_MAP_BY_HAND(int, "map_int/1k", 1024);
+BENCH_MAP_BY_HAND(std::string, "map_string/16", 16);
@@ -0,0 +1 @@
+//Main script of the context/create benchmark
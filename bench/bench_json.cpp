@@ -0,0 +1,77 @@
+//Vectors of structs returned to javascript: Convert<T>::ToJS (one Object::Set per property) against
+//JSONConvert<T>::WriteJSON + JSON.parse, for growing sizes to show where the JSON path starts to win
+
+#include "bench.h"
+#include "beajson.h"
+
+namespace beabench{
+	struct BenchRecord{
+		int id;
+		double score;
+		std::string name;
+		std::vector<int> tags;
+	};
+}
+
+BEA_JSON_STRUCT_BEGIN(beabench::BenchRecord)
+	BEA_JSON_FIELD(id)
+	BEA_JSON_FIELD(score)
+	BEA_JSON_FIELD(name)
+	BEA_JSON_FIELD(tags)
+BEA_JSON_STRUCT_END()
+
+namespace bea{
+	template<> struct Convert<beabench::BenchRecord>{
+		static v8::Handle<v8::Value> ToJS(const beabench::BenchRecord& v){
+			v8::HandleScope scope;
+			v8::Local<v8::Object> obj = v8::Object::New();
+			obj->Set(v8::String::NewSymbol("id"), Convert<int>::ToJS(v.id));
+			obj->Set(v8::String::NewSymbol("score"), Convert<double>::ToJS(v.score));
+			obj->Set(v8::String::NewSymbol("name"), Convert<std::string>::ToJS(v.name));
+			obj->Set(v8::String::NewSymbol("tags"), Convert<std::vector<int> >::ToJS(v.tags));
+			return scope.Close(obj);
+		}
+	};
+}
+
+using namespace beabench;
+
+namespace{
+
+	std::vector<BenchRecord> makeRecords(int n){
+		std::vector<BenchRecord> res(n);
+		for (int k = 0; k < n; k++){
+			res[k].id = k;
+			res[k].score = k * 0.25;
+			res[k].name = "record";
+			res[k].tags.assign(3, k);
+		}
+		return res;
+	}
+
+	void perProperty(size_t iterations, int n){
+		std::vector<BenchRecord> records = makeRecords(n);
+		for (size_t k = 0; k < iterations; k++){
+			v8::HandleScope scope;
+			keep(bea::Convert<std::vector<BenchRecord> >::ToJS(records));
+		}
+	}
+
+	void viaJSON(size_t iterations, int n){
+		std::vector<BenchRecord> records = makeRecords(n);
+		for (size_t k = 0; k < iterations; k++){
+			v8::HandleScope scope;
+			keep(bea::Convert<bea::json<std::vector<BenchRecord> > >::ToJS(bea::json<std::vector<BenchRecord> >(records)));
+		}
+	}
+}
+
+#define BENCH_JSON(n) \
+	static beabench::Registrar BEA_BENCH_CAT(__benchSet_, __LINE__)("json/records/" #n "/set", perProperty, n); \
+	static beabench::Registrar BEA_BENCH_CAT(__benchJSON_, __LINE__)("json/records/" #n "/json", viaJSON, n)
+
+BENCH_JSON(1);
+BENCH_JSON(10);
+BENCH_JSON(100);
+BENCH_JSON(1000);
+BENCH_JSON(10000);
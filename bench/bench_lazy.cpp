@@ -0,0 +1,98 @@
+//Context startup with a large binding (200 classes of 10 methods):
+//every class exposed up front against classes exposed on first use (bea::LazyExposer)
+
+#include "bench.h"
+#include "bealazy.h"
+#include <sstream>
+
+namespace beabench{
+
+	enum {ClassCount = 200, MethodCount = 10};
+
+	struct LazyBenchObject{
+		int x;
+		LazyBenchObject(): x(0){}
+	};
+
+	static v8::Handle<v8::Value> construct(const v8::Arguments& args){
+		return v8::External::New(new LazyBenchObject());
+	}
+
+	static v8::Handle<v8::Value> method(const v8::Arguments& args){
+		return args.This();
+	}
+
+	static v8::Handle<v8::Value> accGet_x(v8::Local<v8::String> prop, const v8::AccessorInfo& info){
+		return v8::Integer::New(0);
+	}
+
+	static std::string className(int n){
+		std::stringstream s;
+		s << "BenchClass" << n;
+		return s.str();
+	}
+
+	static bea::ExposedClass<LazyBenchObject>* createClass(int n){
+		bea::ExposedClass<LazyBenchObject>* obj = new bea::ExposedClass<LazyBenchObject>(className(n).c_str());
+		obj->setConstructor(construct);
+		for (int k = 0; k < MethodCount; k++){
+			std::stringstream s;
+			s << "method" << k;
+			obj->exposeMethod(s.str().c_str(), method);
+		}
+		obj->exposeProperty("x", accGet_x, NULL);
+		return obj;
+	}
+
+	//BenchClass1 .. BenchClassN; each class is created once, by whichever context exposes it first
+	template<int N>
+	struct BenchClasses{
+		static void expose(v8::Handle<v8::Object> target){
+			static bea::ExposedClass<LazyBenchObject>* s_class = createClass(N);
+			s_class->exposeTo(target);
+		}
+		static void exposeAll(v8::Handle<v8::Object> target){
+			BenchClasses<N - 1>::exposeAll(target);
+			expose(target);
+		}
+		static void addAll(bea::LazyExposer& lazy){
+			BenchClasses<N - 1>::addAll(lazy);
+			lazy.add(className(N).c_str(), expose);
+		}
+	};
+
+	template<>
+	struct BenchClasses<0>{
+		static void exposeAll(v8::Handle<v8::Object> target){}
+		static void addAll(bea::LazyExposer& lazy){}
+	};
+
+	struct EagerClassExposer{
+		static void expose(v8::Handle<v8::Object> target){
+			BenchClasses<ClassCount>::exposeAll(target);
+		}
+	};
+
+	struct LazyClassExposer{
+		static void expose(v8::Handle<v8::Object> target){
+			static bea::LazyExposer s_classes;
+			if (s_classes.empty())
+				BenchClasses<ClassCount>::addAll(s_classes);
+			s_classes.install(target);
+		}
+	};
+
+	template<class TExposer>
+	void createContext(size_t iterations, int useClasses){
+		std::string fileName = benchDir() + (useClasses ? "/bench_lazy.js" : "/bench_empty.js");
+		for (size_t k = 0; k < iterations; k++){
+			bea::BeaScript<TExposer> script;
+			keep(script.loadScript(fileName.c_str()));
+		}
+	}
+}
+
+BEA_BENCH_ARG("context/create/eager/200", beabench::createContext<beabench::EagerClassExposer>, 0);
+BEA_BENCH_ARG("context/create/eager/200/use3", beabench::createContext<beabench::EagerClassExposer>, 1);
+BEA_BENCH_ARG("context/create/lazy/200", beabench::createContext<beabench::LazyClassExposer>, 0);
+BEA_BENCH_ARG("context/create/lazy/200/use3", beabench::createContext<beabench::LazyClassExposer>, 1);
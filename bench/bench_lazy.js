@@ -0,0 +1,2 @@
+//Main script of the context/create/lazy/.../use3 benchmark: reads 3 of the classes exposed by bench_lazy.cpp
+var used = [BenchClass1, BenchClass100, BenchClass200];
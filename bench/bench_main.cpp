@@ -0,0 +1,294 @@
+#include "bench.h"
+#include "beaplatform.h"
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <ctime>
+#include <cstdlib>
+
+using namespace beabench;
+
+DECLARE_EXPOSED_CLASS(BenchPoint);
+
+namespace beabench{
+
+	std::vector<Benchmark>& benchmarks(){
+		static std::vector<Benchmark> s_benchmarks;
+		return s_benchmarks;
+	}
+
+	const void* volatile g_sink = NULL;
+
+	static bea::BeaContext* s_context = NULL;
+
+	bea::BeaContext* context(){
+		return s_context;
+	}
+
+	std::string benchDir(){
+		return BEA_BENCH_DIR;
+	}
+
+	static v8::Handle<v8::Value> __constructor(const v8::Arguments& args){
+		//ExposedClass<T>::ToJS() passes the wrapped pointer as an External
+		if (args.Length() == 1 && args[0]->IsExternal())
+			return args[0];
+		return v8::External::New(new BenchPoint());
+	}
+
+	static v8::Handle<v8::Value> add(const v8::Arguments& args){
+		METHOD_BEGIN(2);
+		BenchPoint* _this = bea::ExposedClass<BenchPoint>::FromJS(args.This(), 0);
+		int a = bea::Convert<int>::FromJS(args[0], 0);
+		int b = bea::Convert<int>::FromJS(args[1], 1);
+		_this->x += a + b;
+		return bea::Convert<int>::ToJS(_this->x);
+		METHOD_END();
+		return v8::Undefined();
+	}
+
+	static v8::Handle<v8::Value> accGet_x(v8::Local<v8::String> prop, const v8::AccessorInfo& info){
+		BenchPoint* _this = bea::ExposedClass<BenchPoint>::FromJS(info.Holder(), 0);
+		return bea::Convert<int>::ToJS(_this->x);
+	}
+
+	static void accSet_x(v8::Local<v8::String> prop, v8::Local<v8::Value> v, const v8::AccessorInfo& info){
+		DESTRUCTOR_BEGIN();
+		BenchPoint* _this = bea::ExposedClass<BenchPoint>::FromJS(info.Holder(), 0);
+		_this->x = bea::Convert<int>::FromJS(v, 0);
+		DESTRUCTOR_END();
+	}
+
+	//Overloads of BenchPoint.set, dispatched through an OverloadSet ("set") and by probing each one in turn ("setProbe")
+	static v8::Handle<v8::Value> set_int(const v8::Arguments& args){
+		METHOD_BEGIN(1);
+		BenchPoint* _this = bea::ExposedClass<BenchPoint>::FromJS(args.This(), 0);
+		_this->x = bea::Convert<int>::FromJS(args[0], 0);
+		return args.This();
+		METHOD_END();
+		return v8::Undefined();
+	}
+
+	static v8::Handle<v8::Value> set_double(const v8::Arguments& args){
+		METHOD_BEGIN(1);
+		BenchPoint* _this = bea::ExposedClass<BenchPoint>::FromJS(args.This(), 0);
+		_this->x = (int)bea::Convert<double>::FromJS(args[0], 0);
+		return args.This();
+		METHOD_END();
+		return v8::Undefined();
+	}
+
+	static v8::Handle<v8::Value> set_string(const v8::Arguments& args){
+		METHOD_BEGIN(1);
+		BenchPoint* _this = bea::ExposedClass<BenchPoint>::FromJS(args.This(), 0);
+		_this->x = (int)bea::Convert<std::string>::FromJS(args[0], 0).size();
+		return args.This();
+		METHOD_END();
+		return v8::Undefined();
+	}
+
+	static v8::Handle<v8::Value> set_point(const v8::Arguments& args){
+		METHOD_BEGIN(1);
+		BenchPoint* _this = bea::ExposedClass<BenchPoint>::FromJS(args.This(), 0);
+		_this->x = bea::ExposedClass<BenchPoint>::FromJS(args[0], 0)->x;
+		return args.This();
+		METHOD_END();
+		return v8::Undefined();
+	}
+
+	static v8::Handle<v8::Value> set_int_int(const v8::Arguments& args){
+		METHOD_BEGIN(2);
+		BenchPoint* _this = bea::ExposedClass<BenchPoint>::FromJS(args.This(), 0);
+		_this->x = bea::Convert<int>::FromJS(args[0], 0) + bea::Convert<int>::FromJS(args[1], 1);
+		return args.This();
+		METHOD_END();
+		return v8::Undefined();
+	}
+
+	static v8::Handle<v8::Value> setProbe(const v8::Arguments& args){
+		if (args.Length() == 1 && bea::Convert<int>::Is(args[0]))
+			return set_int(args);
+		if (args.Length() == 1 && bea::Convert<double>::Is(args[0]))
+			return set_double(args);
+		if (args.Length() == 1 && bea::Convert<std::string>::Is(args[0]))
+			return set_string(args);
+		if (args.Length() == 1 && bea::ExposedClass<BenchPoint>::Is(args[0]))
+			return set_point(args);
+		if (args.Length() == 2 && bea::Convert<int>::Is(args[0]) && bea::Convert<int>::Is(args[1]))
+			return set_int_int(args);
+		return v8::ThrowException(v8::Exception::TypeError(v8::String::New("No overload of BenchPoint.set accepts these arguments")));
+	}
+
+	static bea::OverloadSet* createSetOverloads(){
+		bea::OverloadSet* set = new bea::OverloadSet("BenchPoint.set");
+		set->add(bea::Overload(set_int).arg<int>())
+			.add(bea::Overload(set_double).arg<double>())
+			.add(bea::Overload(set_string).arg<std::string>())
+			.add(bea::Overload(set_point).object<BenchPoint>())
+			.add(bea::Overload(set_int_int).arg<int>().arg<int>());
+		return set;
+	}
+
+	struct BenchExposer{
+		static void expose(v8::Handle<v8::Object> target){
+			if (bea::ExposedClass<BenchPoint>::Instance == NULL){
+				bea::ExposedClass<BenchPoint>* obj = EXPOSE_CLASS(BenchPoint, "BenchPoint");
+				obj->setConstructor(__constructor);
+				obj->exposeMethod("add", add);
+				obj->exposeMethod("set", createSetOverloads());
+				obj->exposeMethod("setProbe", setProbe);
+				obj->exposeProperty("x", accGet_x, accSet_x);
+			}
+			bea::ExposedClass<BenchPoint>::Instance->exposeTo(target);
+		}
+	};
+
+	typedef bea::BeaScript<BenchExposer> BenchScript;
+
+	struct Result{
+		std::string name;
+		size_t iterations;
+		double nsPerOp;
+		double minNsPerOp;
+		int samples;
+	};
+
+	//Creating a context replaces the script globals shared with the bench.js context (sandbox, script path),
+	//so the context/ benchmarks run after all the others
+	static bool runOrder(const Benchmark& a, const Benchmark& b){
+		bool ca = a.name.compare(0, 8, "context/") == 0;
+		bool cb = b.name.compare(0, 8, "context/") == 0;
+		if (ca != cb)
+			return cb;
+		return a.name < b.name;
+	}
+
+	static double runOnce(const Benchmark& b, size_t iterations){
+		bea::uint64 start = bea::nowNs();
+		b.fn(iterations, b.arg);
+		return (double)(bea::nowNs() - start);
+	}
+
+	//Grow the iteration count until one sample takes at least minTimeNs, then take the median of 'samples' runs
+	static Result measure(const Benchmark& b, double minTimeNs, int samples){
+		size_t iterations = 1;
+		runOnce(b, 1);	//warm up
+		for (;;){
+			double t = runOnce(b, iterations);
+			if (t >= minTimeNs || iterations >= ((size_t)1 << 30))
+				break;
+			double grow = t > 0 ? minTimeNs / t * 1.2 : 10.0;
+			grow = std::min(std::max(grow, 2.0), 100.0);
+			iterations = (size_t)(iterations * grow);
+		}
+
+		std::vector<double> perOp;
+		for (int k = 0; k < samples; k++){
+			while (!v8::V8::IdleNotification()) {}
+			perOp.push_back(runOnce(b, iterations) / (double)iterations);
+		}
+		std::sort(perOp.begin(), perOp.end());
+
+		Result r;
+		r.name = b.name;
+		r.iterations = iterations;
+		r.nsPerOp = perOp[perOp.size() / 2];
+		r.minNsPerOp = perOp[0];
+		r.samples = samples;
+		return r;
+	}
+
+	static void writeJSON(std::ostream& out, const std::vector<Result>& results){
+		out << "{\n";
+		out << "  \"format\": 1,\n";
+		out << "  \"v8\": \"" << v8::V8::GetVersion() << "\",\n";
+		out << "  \"timestamp\": " << (long long)time(NULL) << ",\n";
+#ifdef BEA_ENABLE_STATS
+		out << "  \"stats\": true,\n";
+#else
+		out << "  \"stats\": false,\n";
+#endif
+		out << "  \"results\": [\n";
+		for (size_t k = 0; k < results.size(); k++){
+			const Result& r = results[k];
+			out << "    {\"name\": \"" << r.name << "\", \"iterations\": " << r.iterations
+				<< ", \"samples\": " << r.samples << ", \"ns_per_op\": " << r.nsPerOp
+				<< ", \"min_ns_per_op\": " << r.minNsPerOp << "}" << (k + 1 < results.size() ? "," : "") << "\n";
+		}
+		out << "  ]\n";
+		out << "}\n";
+	}
+}
+
+static void usage(){
+	std::cerr << "Usage: bea_bench [--filter substring] [--out file.json] [--min-time-ms n] [--samples n] [--list]" << std::endl;
+}
+
+int main(int argc, char* argv[]){
+	std::string filter, outFile;
+	double minTimeMs = 20;
+	int samples = 5;
+	bool list = false;
+
+	for (int k = 1; k < argc; k++){
+		std::string arg = argv[k];
+		if (arg == "--filter" && k + 1 < argc)
+			filter = argv[++k];
+		else if (arg == "--out" && k + 1 < argc)
+			outFile = argv[++k];
+		else if (arg == "--min-time-ms" && k + 1 < argc)
+			minTimeMs = atof(argv[++k]);
+		else if (arg == "--samples" && k + 1 < argc)
+			samples = std::max(1, atoi(argv[++k]));
+		else if (arg == "--list")
+			list = true;
+		else {
+			usage();
+			return 1;
+		}
+	}
+
+	std::vector<Benchmark> all = benchmarks();
+	std::sort(all.begin(), all.end(), runOrder);
+
+	if (list){
+		for (size_t k = 0; k < all.size(); k++)
+			std::cout << all[k].name << std::endl;
+		return 0;
+	}
+
+	BenchScript script;
+	if (!script.loadScript((benchDir() + "/bench.js").c_str())){
+		std::cerr << "Could not load bench.js: " << script.getLastError() << std::endl;
+		return 1;
+	}
+	s_context = &script;
+
+	std::vector<Result> results;
+	{
+		v8::Locker locker;
+		v8::HandleScope scope;
+		v8::Context::Scope contextScope(script.context());
+
+		for (size_t k = 0; k < all.size(); k++){
+			if (!filter.empty() && all[k].name.find(filter) == std::string::npos)
+				continue;
+			Result r = measure(all[k], minTimeMs * 1e6, samples);
+			std::cerr << r.name << ": " << r.nsPerOp << " ns/op" << std::endl;
+			results.push_back(r);
+		}
+	}
+
+	if (outFile.empty())
+		writeJSON(std::cout, results);
+	else {
+		std::ofstream out(outFile.c_str());
+		if (!out){
+			std::cerr << "Could not write " << outFile << std::endl;
+			return 1;
+		}
+		writeJSON(out, results);
+	}
+	return 0;
+}
@@ -0,0 +1,5 @@
+//Module loaded by the module/include benchmark
+exports.value = 42;
+exports.twice = function(x){
+	return x * 2;
+};
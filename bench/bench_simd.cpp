@@ -0,0 +1,102 @@
+//Buffer kernels (beasimd.h) against plain loops, on 64k elements
+
+#include "bench.h"
+#include "beasimd.h"
+#include <vector>
+#include <limits>
+
+using namespace beabench;
+
+namespace{
+
+	enum {N = 65536};
+
+	struct Buffers{
+		std::vector<float> a, b, dst;
+		std::vector<unsigned char> bytes;
+		Buffers(): a(N, 1.5f), b(N, 2.0f), dst(N), bytes(N, 128){}
+	};
+
+	Buffers& buffers(){
+		static Buffers s_buffers;
+		return s_buffers;
+	}
+
+	void scaleOffsetSimd(size_t iterations, int){
+		Buffers& B = buffers();
+		for (size_t k = 0; k < iterations; k++)
+			bea::simd::scaleOffset(&B.dst[0], &B.a[0], N, 2.0f, 1.0f);
+		keep(B.dst);
+	}
+
+	void scaleOffsetLoop(size_t iterations, int){
+		Buffers& B = buffers();
+		volatile float scale = 2.0f;
+		for (size_t k = 0; k < iterations; k++){
+			for (int i = 0; i < N; i++)
+				B.dst[i] = B.a[i] * scale + 1.0f;
+		}
+		keep(B.dst);
+	}
+
+	void sumSimd(size_t iterations, int){
+		Buffers& B = buffers();
+		double res = 0;
+		for (size_t k = 0; k < iterations; k++)
+			res += bea::simd::sum(&B.a[0], N);
+		keep(res);
+	}
+
+	void sumLoop(size_t iterations, int){
+		Buffers& B = buffers();
+		double res = 0;
+		for (size_t k = 0; k < iterations; k++){
+			for (int i = 0; i < N; i++)
+				res += B.a[i];
+		}
+		keep(res);
+	}
+
+	void u8ToFloatSimd(size_t iterations, int){
+		Buffers& B = buffers();
+		for (size_t k = 0; k < iterations; k++)
+			bea::simd::u8ToFloat(&B.dst[0], &B.bytes[0], N, 1.0f / 255.0f);
+		keep(B.dst);
+	}
+
+	//Same bytes as BufferOps' saturate<unsigned char>, whether an element goes through the vector body or the tail
+	void floatToU8Rounding(size_t iterations, int){
+		static const float values[] = {0.5f, 1.5f, 2.5f, 254.5f, 255.5f, -0.5f, -3.0f, 1e10f, -1e10f, 127.49f, 127.5f, 3.7f,
+			std::numeric_limits<float>::quiet_NaN(), std::numeric_limits<float>::infinity()};
+		const int count = (int)(sizeof(values) / sizeof(values[0]));
+		float src[37];
+		unsigned char dst[37];
+		for (size_t k = 0; k < iterations; k++){
+			for (int n = 1; n <= 37; n += 4){
+				for (int i = 0; i < n; i++)
+					src[i] = values[(i + k) % count];
+				bea::simd::floatToU8(dst, src, n, 1.0f);
+				for (int i = 0; i < n; i++){
+					double v = src[i];
+					unsigned char expected = !(v > 0) ? 0 : v >= 255 ? 255 : (unsigned char)(v + 0.5);
+					check(dst[i] == expected, "simd/float_to_u8: rounding");
+				}
+			}
+		}
+	}
+
+	void floatToU8Simd(size_t iterations, int){
+		Buffers& B = buffers();
+		for (size_t k = 0; k < iterations; k++)
+			bea::simd::floatToU8(&B.bytes[0], &B.a[0], N, 100.0f);
+		keep(B.bytes);
+	}
+}
+
+BEA_BENCH("simd/scale_offset/kernel", scaleOffsetSimd);
+BEA_BENCH("simd/scale_offset/loop", scaleOffsetLoop);
+BEA_BENCH("simd/sum/kernel", sumSimd);
+BEA_BENCH("simd/sum/loop", sumLoop);
+BEA_BENCH("simd/u8_to_float/kernel", u8ToFloatSimd);
+BEA_BENCH("simd/float_to_u8/kernel", floatToU8Simd);
+BEA_BENCH("simd/float_to_u8/rounding", floatToU8Rounding);
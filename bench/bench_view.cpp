@@ -0,0 +1,71 @@
+//A 32 field struct returned to javascript, which reads two of its fields:
+//eager copy into a new object against bea::view<T>
+
+#include "bench.h"
+#include "beaview.h"
+
+#define WIDE_FIELDS(X) \
+	X(f0) X(f1) X(f2) X(f3) X(f4) X(f5) X(f6) X(f7) \
+	X(f8) X(f9) X(f10) X(f11) X(f12) X(f13) X(f14) X(f15) \
+	X(f16) X(f17) X(f18) X(f19) X(f20) X(f21) X(f22) X(f23) \
+	X(f24) X(f25) X(f26) X(f27) X(f28) X(f29) X(f30) X(f31)
+
+namespace beabench{
+	struct WideRecord{
+		#define WIDE_DECLARE(name) double name;
+		WIDE_FIELDS(WIDE_DECLARE)
+		#undef WIDE_DECLARE
+	};
+}
+
+BEA_VIEW_STRUCT_BEGIN(beabench::WideRecord)
+	WIDE_FIELDS(BEA_VIEW_FIELD)
+BEA_VIEW_STRUCT_END()
+
+namespace bea{
+	template<> struct Convert<beabench::WideRecord>{
+		static v8::Handle<v8::Value> ToJS(const beabench::WideRecord& v){
+			v8::HandleScope scope;
+			v8::Local<v8::Object> obj = v8::Object::New();
+			#define WIDE_SET(name) obj->Set(v8::String::NewSymbol(#name), v8::Number::New(v.name));
+			WIDE_FIELDS(WIDE_SET)
+			#undef WIDE_SET
+			return scope.Close(obj);
+		}
+	};
+}
+
+using namespace beabench;
+
+namespace{
+
+	WideRecord makeRecord(){
+		WideRecord r;
+		double n = 0;
+		#define WIDE_INIT(name) r.name = n++;
+		WIDE_FIELDS(WIDE_INIT)
+		#undef WIDE_INIT
+		return r;
+	}
+
+	void copyRecord(size_t iterations, int){
+		WideRecord r = makeRecord();
+		for (size_t k = 0; k < iterations; k++){
+			v8::HandleScope scope;
+			v8::Handle<v8::Value> argv[1] = {bea::Convert<WideRecord>::ToJS(r)};
+			keep(context()->call("benchReadTwo", 1, argv));
+		}
+	}
+
+	void viewRecord(size_t iterations, int){
+		WideRecord r = makeRecord();
+		for (size_t k = 0; k < iterations; k++){
+			v8::HandleScope scope;
+			v8::Handle<v8::Value> argv[1] = {bea::Convert<bea::view<WideRecord> >::ToJS(bea::view<WideRecord>(r))};
+			keep(context()->call("benchReadTwo", 1, argv));
+		}
+	}
+}
+
+BEA_BENCH("view/wide32/copy", copyRecord);
+BEA_BENCH("view/wide32/view", viewRecord);
@@ -0,0 +1,57 @@
+//Packs a script tree into a single bundle file (see beabundle.h)
+//
+//	beapack [--precompile] [--root dir] bundle.bea path...
+//
+//Each path is a .js file or a directory searched for .js files. Bundle paths are relative to the root
+//(default: the current directory), which is where the runtime expects the scripts at load time.
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <v8.h>
+#include <boost/filesystem/operations.hpp>
+#include "beabundle.h"
+
+static int usage(){
+	fprintf(stderr, "usage: beapack [--precompile] [--root dir] bundle.bea path...\n");
+	return 2;
+}
+
+int main(int argc, char* argv[]){
+	bool precompile = false;
+	std::string root = ".";
+	int k = 1;
+	for (; k < argc && strncmp(argv[k], "--", 2) == 0; k++){
+		if (strcmp(argv[k], "--precompile") == 0)
+			precompile = true;
+		else if (strcmp(argv[k], "--root") == 0 && k + 1 < argc)
+			root = argv[++k];
+		else
+			return usage();
+	}
+	if (argc - k < 2)
+		return usage();
+	const char* out = argv[k++];
+
+	v8::Locker locker;
+	v8::HandleScope scope;
+	bea::BundleWriter writer(root, precompile);
+
+	for (; k < argc; k++){
+		if (boost::filesystem::is_directory(argv[k])){
+			if (writer.addDirectory(argv[k]) == 0)
+				fprintf(stderr, "%s: no scripts found\n", argv[k]);
+		}
+		else if (!writer.addFile(argv[k])){
+			fprintf(stderr, "%s: cannot read, or not below %s\n", argv[k], root.c_str());
+			return 1;
+		}
+	}
+
+	if (!writer.write(out)){
+		fprintf(stderr, "%s: write failed\n", out);
+		return 1;
+	}
+	printf("%s: %d scripts\n", out, (int)writer.count());
+	return 0;
+}